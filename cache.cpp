@@ -28,6 +28,9 @@
 
 #include <QDir>
 #include <QBuffer>
+#include <QtConcurrentMap>
+
+#include <stdio.h>
 
 #include "tag.h"
 #include "normalplaylist.h"
@@ -40,8 +43,63 @@
 
 using namespace ActionCollection;
 
-const int Cache::playlistListCacheVersion = 3;
-const int Cache::playlistItemsCacheVersion = 2;
+/**
+ * Decodes a single cache chunk.  Used from the worker threads, so this must
+ * not touch FileHandle or Tag, neither of which is thread-safe.
+ */
+struct CacheChunkDecoder
+{
+    typedef CachedTrackChunk result_type;
+
+    CacheChunkDecoder(const CacheFileReader *reader) : reader(reader) {}
+
+    CachedTrackChunk operator()(int chunk) const
+    {
+        CachedTrackChunk result;
+
+        if(!reader->readChunk(chunk, result)) {
+            kError() << "Rereading" << result.damagedTracks.count()
+                     << "files from damaged cache chunk" << chunk;
+        }
+
+        // Checking the files here keeps the stat() calls off of the GUI
+        // thread, and spreads them over all of the cores.  Tracks that pass
+        // don't need to be checked again once they are loaded.
+
+        CachedTrackList::Iterator it = result.tracks.begin();
+        while(it != result.tracks.end()) {
+            const FileStat stat = FileStat::read(it->path);
+
+            if(stat.matches(*it))
+                ++it;
+            else {
+                if(!stat.exists || !stat.isFile) {
+                    kWarning() << "File" << it->path << "no longer exists!";
+                    result.missingFiles.append(it->path);
+                }
+                else
+                    result.changedTracks.append(*it);
+
+                it = result.tracks.erase(it);
+            }
+        }
+
+        it = result.damagedTracks.begin();
+        while(it != result.damagedTracks.end()) {
+            if(QFile::exists(it->path))
+                ++it;
+            else
+                it = result.damagedTracks.erase(it);
+        }
+
+        return result;
+    }
+
+    const CacheFileReader *reader;
+};
+
+const int Cache::playlistListCacheVersion = 5;
+const int Cache::playlistItemsCacheVersion = CacheFile::formatVersion;
 
 ////////////////////////////////////////////////////////////////////////////////
 // public methods
@@ -72,6 +130,8 @@ void Cache::loadPlaylists(PlaylistCollection *collection) // static
     QDateTime cacheLastModified = QFileInfo(f).lastModified();
 
     switch(version) {
+    case 5:
+    case 4:
     case 3:
         dataStreamVersion = QDataStream::Qt_4_3;
         // Fall-through
@@ -142,6 +202,7 @@ void Cache::loadPlaylists(PlaylistCollection *collection) // static
                 {
                     FolderPlaylist *p = new FolderPlaylist(collection);
                     createdPlaylists.append(p);
+                    p->deferItems();
                     s >> *p;
                     playlist = p;
                     break;
@@ -150,7 +211,13 @@ void Cache::loadPlaylists(PlaylistCollection *collection) // static
                     NormalPlaylist *p = new NormalPlaylist(collection, true);
                     createdPlaylists.append(p);
                     // adds name and filename to hash tables
-                    s >> *p;
+                    p->read(s, version >= 4);
+
+                    if(version >= 5) {
+                        QDateTime diskFileLastModified;
+                        s >> diskFileLastModified;
+                        p->setDiskFileLastModified(diskFileLastModified);
+                    }
 
 #if 0
                     /* the following chunk of code is wrong for two reasons:
@@ -268,6 +335,8 @@ void Cache::savePlaylists(const PlaylistList &playlists)
 
     for(PlaylistList::ConstIterator it = playlists.begin(); it != playlists.end(); ++it) {
         if(*it) {
+            (*it)->finishAddingFiles();
+
             if(dynamic_cast<HistoryPlaylist *>(*it)) {
                 s << qint32(Playlist::Type::History)
                   << *static_cast<HistoryPlaylist *>(*it);
@@ -288,7 +357,9 @@ void Cache::savePlaylists(const PlaylistList &playlists)
             }
             else if(dynamic_cast<NormalPlaylist *>(*it)) {
                 s << qint32(Playlist::Type::Normal)
-                  << *static_cast<NormalPlaylist *>(*it);
+                  << *static_cast<NormalPlaylist *>(*it)
+                  << (*it)->collectionIds()
+                  << (*it)->diskFileLastModified();
             }
             else {
                 kError() << "Unrecognized playlist class";
@@ -313,21 +384,78 @@ void Cache::savePlaylists(const PlaylistList &playlists)
 
 bool Cache::cacheFileExists() // static
 {
-    return QFile::exists(KGlobal::dirs()->saveLocation("appdata") + "cache");
+    return QFile::exists(cacheFileName());
+}
+
+QString Cache::cacheFileName() // static
+{
+    return KGlobal::dirs()->saveLocation("appdata") + "cache";
+}
+
+QString Cache::journalFileName() // static
+{
+    return KGlobal::dirs()->saveLocation("appdata") + "cache.journal";
+}
+
+QString Cache::folderManifestFileName() // static
+{
+    return KGlobal::dirs()->saveLocation("appdata") + "folders";
+}
+
+bool Cache::writeCacheFile(const QString &fileName, const CachedTrackList &tracks) // static
+{
+    // KSaveFile isn't safe to use outside of the GUI thread, so do the same
+    // write-then-rename by hand.
+
+    QFile f(fileName + QLatin1String(".new"));
+
+    if(!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        kError() << "Error saving cache:" << f.errorString();
+        return false;
+    }
+
+    CacheFileWriter writer;
+
+    foreach(const CachedTrack &track, tracks)
+        writer.addTrack(track);
+
+    if(!writer.write(&f) || !f.flush()) {
+        kError() << "Error saving cache:" << f.errorString();
+        f.remove();
+        return false;
+    }
+
+    f.close();
+
+    if(::rename(QFile::encodeName(f.fileName()).constData(),
+                QFile::encodeName(fileName).constData()) != 0)
+    {
+        kError() << "Error saving cache: unable to rename" << f.fileName();
+        f.remove();
+        return false;
+    }
+
+    return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // private methods
 ////////////////////////////////////////////////////////////////////////////////
 
-Cache::Cache()
+Cache::Cache() :
+    m_cacheFileCurrent(false)
 {
 
 }
 
 bool Cache::prepareToLoadCachedItems()
 {
-    QString cacheFileName = KGlobal::dirs()->saveLocation("appdata") + "cache";
+    // The journal applies on top of whatever cache is found, if any.
+
+    m_journalEntries.clear();
+    m_journal.open(journalFileName(), &m_journalEntries);
+
+    const QString cacheFileName = Cache::cacheFileName();
 
     m_loadFile.setFileName(cacheFileName);
     if(!m_loadFile.open(QIODevice::ReadOnly))
@@ -340,6 +468,27 @@ bool Cache::prepareToLoadCachedItems()
     qint32 version;
     m_loadDataStream >> version;
 
+    if(version >= CacheFile::firstMappedVersion && version <= CacheFile::formatVersion) {
+        m_loadFile.close();
+        m_loadDataStream.setDevice(0);
+
+        if(version != CacheFile::formatVersion) {
+            kDebug() << "Discarding music cache from unreleased version" << version;
+            return false;
+        }
+
+        if(!m_reader.open(cacheFileName)) {
+            KMessageBox::sorry(0, i18n("The music data cache has been corrupted. JuK "
+                                       "needs to rescan it now. This may take some time."));
+            return false;
+        }
+
+        kDebug() << "Memory mapped cache has" << m_reader.count() << "items in"
+                 << m_reader.chunkCount() << "chunks";
+        m_cacheFileCurrent = true;
+        return true;
+    }
+
     switch(version) {
     case 2:
         dataStreamVersion = CacheDataStream::Qt_4_3;
@@ -386,6 +535,27 @@ bool Cache::prepareToLoadCachedItems()
     return true;
 }
 
+QFuture<CachedTrackChunk> Cache::loadCachedItemsInParallel()
+{
+    QList<int> chunks;
+    for(int i = 0; i < m_reader.chunkCount(); ++i)
+        chunks << i;
+
+    return QtConcurrent::mapped(chunks, CacheChunkDecoder(&m_reader));
+}
+
+void Cache::finishLoadingCachedItems()
+{
+    m_reader.close();
+}
+
+QList<CacheJournal::Entry> Cache::takeJournalEntries()
+{
+    QList<CacheJournal::Entry> entries = m_journalEntries;
+    m_journalEntries.clear();
+    return entries;
+}
+
 FileHandle Cache::loadNextCachedItem()
 {
     if(!m_loadFile.isOpen() || !m_loadDataStream.device()) {
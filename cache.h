@@ -21,6 +21,9 @@
 #include <QtCore/QDataStream>
 #include <QtCore/QFile>
 #include <QtCore/QBuffer>
+#include <QtCore/QFuture>
+
+#include "cachefile.h"
 
 class Playlist;
 class PlaylistCollection;
@@ -60,13 +63,62 @@ public:
 
     static bool cacheFileExists();
 
+    static QString cacheFileName();
+    static QString journalFileName();
+    static QString folderManifestFileName();
+
+    /**
+     * Writes \a tracks as the new cache file \a fileName.  Does not touch
+     * any other state, so it may be called from a worker thread.
+     */
+    static bool writeCacheFile(const QString &fileName, const CachedTrackList &tracks);
+
     bool prepareToLoadCachedItems();
+
+    /**
+     * Returns true if the cache prepared by prepareToLoadCachedItems() is in
+     * the current format, which must be loaded through
+     * loadCachedItemsInParallel() rather than loadNextCachedItem().
+     */
+    bool canLoadCachedItemsInParallel() const { return m_reader.isOpen(); }
+
+    /**
+     * Decodes all of the cache chunks on the global thread pool.  There is one
+     * result per chunk, holding the tracks from it that are unchanged on disk
+     * and the files that have to be read again.  Call
+     * finishLoadingCachedItems() once the returned future has finished.
+     */
+    QFuture<CachedTrackChunk> loadCachedItemsInParallel();
+    void finishLoadingCachedItems();
+
+    /**
+     * Reads the next item from an older, QDataStream based cache.
+     */
     FileHandle loadNextCachedItem();
 
+    /**
+     * The journal of changes since the cache file was written.  It is opened
+     * by prepareToLoadCachedItems(), which also reads the entries that
+     * takeJournalEntries() returns.
+     */
+    CacheJournal *journal() { return &m_journal; }
+    QList<CacheJournal::Entry> takeJournalEntries();
+
+    /**
+     * Returns true if the cache file is in the current format, either because
+     * it was loaded that way or because it has been written since.  If not,
+     * the whole collection has to be written out at some point.
+     */
+    bool isCacheFileCurrent() const { return m_cacheFileCurrent; }
+    void setCacheFileCurrent(bool current) { m_cacheFileCurrent = current; }
+
     /**
      * QDataStream version for serialized list of playlists
      * 1, 2: Who knows?
-     * 3: Current.
+     * 3: Normal playlists list their files by path.
+     * 4: Normal playlists also list the CollectionListItem ids.
+     * 5: Current, normal playlists also keep the time of their m3u file, see
+     *    Playlist::diskFileLastModified().
      */
     static const int playlistListCacheVersion;
 
@@ -74,6 +126,10 @@ public:
      * QDataStream version for serialized list of playlist items in a playlist
      * 1: Original cache version
      * 2: KDE 4.0.1+, explicitly sets QDataStream encoding.
+     * 3 and later: Memory mapped, fixed record layout, see CacheFile.  The
+     *    current version is CacheFile::formatVersion, whose documentation
+     *    has what changed in each of them.  Versions 1 and 2 are still read
+     *    so that existing caches are migrated on next save.
      */
     static const int playlistItemsCacheVersion;
 
@@ -85,6 +141,11 @@ private:
     QFile m_loadFile;
     QBuffer m_loadFileBuffer;
     CacheDataStream m_loadDataStream;
+
+    CacheFileReader m_reader;
+    CacheJournal m_journal;
+    QList<CacheJournal::Entry> m_journalEntries;
+    bool m_cacheFileCurrent;
 };
 
 #endif
@@ -0,0 +1,961 @@
+/**
+ * Copyright (C) 2002-2004 Scott Wheeler <wheeler@kde.org>
+ * Copyright (C) 2008, 2013 Michael Pyne <mpyne@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cachefile.h"
+
+#include <kdebug.h>
+
+#include <QtCore/QDataStream>
+#include <QtCore/QtEndian>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Offsets of the header fields.
+
+static const int headerVersion        = 0;  // qint32, big-endian
+static const int headerHeaderSize     = 4;
+static const int headerRecordSize     = 8;
+static const int headerRecordCount    = 12;
+static const int headerChunkCount     = 16;
+static const int headerIndexEntrySize = 20;
+static const int headerIndex          = 24; // quint64
+static const int headerChecksum       = 32; // CRC32C of the above and the index
+
+// Offsets of the chunk index fields.
+
+static const int indexOffset      = 0;  // quint64, from the start of the file
+static const int indexLength      = 8;  // bytes
+static const int indexRecordCount = 12;
+static const int indexChecksum    = 16; // CRC32C of the chunk
+static const int indexValueCount  = 20; // entries in the value table
+
+// Offsets of the record fields.  Every string is an (offset, length) pair of
+// quint32s, except for the shared values, which are a quint32 index into the
+// value table of the chunk followed by four unused bytes.
+
+static const int recordPath     = 0;
+static const int recordTitle    = 8;
+static const int recordArtist   = 16; // shared value
+static const int recordAlbum    = 24; // shared value
+static const int recordGenre    = 32; // shared value
+static const int recordComment  = 40; // shared value
+static const int recordTrack    = 48;
+static const int recordYear     = 52;
+static const int recordSeconds  = 56;
+static const int recordBitrate  = 60;
+static const int recordModified = 64; // qint64, msecs since epoch or -1
+static const int recordFileSize = 72; // qint64, -1 if unknown
+static const int recordInode    = 80; // quint64, 0 if unknown
+static const int recordId       = 88; // quint32, 0 if none
+static const int recordFlags    = 92; // quint32, see below
+static const int recordArtHash  = 96; // quint32, if flagEmbeddedArt is set
+static const int recordDevice   = 100; // quint64, along with the inode
+
+// Bits of the record flags.  Files written before the flags were added have
+// zeros there.
+
+static const quint32 flagEstimatedProperties = 0x1;
+static const quint32 flagEmbeddedArtKnown    = 0x2;
+static const quint32 flagEmbeddedArt         = 0x4;
+
+static quint32 trackFlags(const CachedTrack &track)
+{
+    quint32 flags = 0;
+
+    if(track.estimatedProperties)
+        flags |= flagEstimatedProperties;
+    if(track.embeddedArtKnown)
+        flags |= flagEmbeddedArtKnown;
+    if(track.hasEmbeddedArt)
+        flags |= flagEmbeddedArt;
+
+    return flags;
+}
+
+static void setTrackFlags(CachedTrack &track, quint32 flags)
+{
+    track.estimatedProperties = flags & flagEstimatedProperties;
+    track.embeddedArtKnown = flags & flagEmbeddedArtKnown;
+    track.hasEmbeddedArt = flags & flagEmbeddedArt;
+}
+
+/**
+ * Lookup tables for a CRC32C (Castagnoli) that handles eight bytes per step,
+ * "slicing-by-8".  Filled in once when the program is loaded, so they are
+ * ready before any worker thread uses them.
+ */
+struct Crc32cTable
+{
+    Crc32cTable()
+    {
+        for(quint32 i = 0; i < 256; ++i) {
+            quint32 crc = i;
+            for(int bit = 0; bit < 8; ++bit)
+                crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            t[0][i] = crc;
+        }
+
+        for(int i = 0; i < 256; ++i) {
+            for(int slice = 1; slice < 8; ++slice)
+                t[slice][i] = (t[slice - 1][i] >> 8) ^ t[0][t[slice - 1][i] & 0xff];
+        }
+    }
+
+    quint32 t[8][256];
+};
+
+static const Crc32cTable crcTable;
+
+/**
+ * Returns the CRC32C of \a length bytes at \a data.  Pass a previous result
+ * as \a crc to continue a checksum over several pieces.
+ */
+static quint32 crc32c(const uchar *data, quint64 length, quint32 crc = 0)
+{
+    const quint32 (*t)[256] = crcTable.t;
+    crc = ~crc;
+
+    while(length >= 8) {
+        const quint32 low = qFromLittleEndian<quint32>(data) ^ crc;
+        const quint32 high = qFromLittleEndian<quint32>(data + 4);
+
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^
+              t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+              t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^
+              t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+
+        data += 8;
+        length -= 8;
+    }
+
+    while(length--)
+        crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+quint32 CacheFile::checksum(const char *data, quint64 length)
+{
+    return crc32c(reinterpret_cast<const uchar *>(data), length);
+}
+
+// A value table entry is a string (offset, length) pair.
+
+static const int valueEntrySize = 8;
+
+static bool readString(const uchar *field, const uchar *strings, quint32 stringsLength, QString &s)
+{
+    const quint32 offset = qFromLittleEndian<quint32>(field);
+    const quint32 length = qFromLittleEndian<quint32>(field + 4);
+
+    if(length == 0) {
+        s.clear();
+        return true;
+    }
+
+    if(offset > stringsLength || length > stringsLength - offset)
+        return false;
+
+    const uchar *src = strings + offset * 2;
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    s = QString(reinterpret_cast<const QChar *>(src), length);
+#else
+    s.resize(length);
+    QChar *dest = s.data();
+    for(quint32 i = 0; i < length; ++i)
+        dest[i] = QChar(qFromLittleEndian<quint16>(src + i * 2));
+#endif
+
+    return true;
+}
+
+static bool readValue(const uchar *field, const QVector<QString> &values, QString &s)
+{
+    const quint32 index = qFromLittleEndian<quint32>(field);
+
+    if(index >= quint32(values.size()))
+        return false;
+
+    s = values[index];
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// FileStat
+////////////////////////////////////////////////////////////////////////////////
+
+FileStat FileStat::read(const QString &path, bool followSymLinks) // static
+{
+    FileStat result;
+    struct stat st;
+
+    const QByteArray encodedPath = QFile::encodeName(path);
+    const int error = followSymLinks ? ::stat(encodedPath.constData(), &st)
+                                     : ::lstat(encodedPath.constData(), &st);
+    if(error != 0)
+        return result;
+
+    result.exists = true;
+    result.isFile = S_ISREG(st.st_mode);
+    result.isDir = S_ISDIR(st.st_mode);
+    result.isSymLink = S_ISLNK(st.st_mode);
+    result.size = st.st_size;
+    result.inode = st.st_ino;
+    result.device = st.st_dev;
+    result.lastModified = QDateTime::fromTime_t(st.st_mtime);
+
+    return result;
+}
+
+bool FileStat::matches(const CachedTrack &track) const
+{
+    return exists && isFile &&
+           track.modificationTime.isValid() &&
+           track.modificationTime >= lastModified &&
+           (track.size < 0 || track.size == size) &&
+           (track.inode == 0 || track.identity() == identity());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CacheFileWriter
+////////////////////////////////////////////////////////////////////////////////
+
+CacheFileWriter::CacheFileWriter() :
+    m_values(valueEntrySize, '\0'),
+    m_chunkCount(0),
+    m_count(0)
+{
+
+}
+
+void CacheFileWriter::addTrack(const CachedTrack &track)
+{
+    const int start = m_records.size();
+    m_records.resize(start + CacheFile::recordSize);
+
+    uchar *record = reinterpret_cast<uchar *>(m_records.data()) + start;
+    memset(record, 0, CacheFile::recordSize);
+
+    writeString(record + recordPath,    track.path);
+    writeString(record + recordTitle,   track.title);
+    writeValue(record + recordArtist,  track.artist);
+    writeValue(record + recordAlbum,   track.album);
+    writeValue(record + recordGenre,   track.genre);
+    writeValue(record + recordComment, track.comment);
+
+    qToLittleEndian<qint32>(track.track,   record + recordTrack);
+    qToLittleEndian<qint32>(track.year,    record + recordYear);
+    qToLittleEndian<qint32>(track.seconds, record + recordSeconds);
+    qToLittleEndian<qint32>(track.bitrate, record + recordBitrate);
+
+    const qint64 modified = track.modificationTime.isValid()
+        ? track.modificationTime.toMSecsSinceEpoch()
+        : qint64(-1);
+    qToLittleEndian<qint64>(modified, record + recordModified);
+    qToLittleEndian<qint64>(track.size, record + recordFileSize);
+    qToLittleEndian<quint64>(track.inode, record + recordInode);
+    qToLittleEndian<quint32>(track.id, record + recordId);
+
+    qToLittleEndian<quint32>(trackFlags(track), record + recordFlags);
+    qToLittleEndian<quint32>(track.embeddedArtHash, record + recordArtHash);
+    qToLittleEndian<quint64>(track.device, record + recordDevice);
+
+    ++m_count;
+
+    if(++m_chunkCount == CacheFile::chunkRecords)
+        finishChunk();
+}
+
+bool CacheFileWriter::write(QIODevice *device)
+{
+    finishChunk();
+
+    const quint32 chunkCount = m_chunks.count();
+    const quint64 chunksStart = CacheFile::headerSize + chunkCount * CacheFile::indexEntrySize;
+
+    QByteArray index(chunkCount * CacheFile::indexEntrySize, '\0');
+    quint64 offset = chunksStart;
+
+    for(quint32 i = 0; i < chunkCount; ++i) {
+        uchar *entry = reinterpret_cast<uchar *>(index.data()) + i * CacheFile::indexEntrySize;
+
+        qToLittleEndian<quint64>(offset, entry + indexOffset);
+        qToLittleEndian<quint32>(m_chunks[i].size(), entry + indexLength);
+        qToLittleEndian<quint32>(m_chunkCounts[i], entry + indexRecordCount);
+        qToLittleEndian<quint32>(m_chunkChecksums[i], entry + indexChecksum);
+        qToLittleEndian<quint32>(m_chunkValueCounts[i], entry + indexValueCount);
+
+        offset += m_chunks[i].size();
+    }
+
+    QByteArray header(CacheFile::headerSize, '\0');
+    uchar *h = reinterpret_cast<uchar *>(header.data());
+
+    qToBigEndian<qint32>(CacheFile::formatVersion, h + headerVersion);
+    qToLittleEndian<quint32>(CacheFile::headerSize, h + headerHeaderSize);
+    qToLittleEndian<quint32>(CacheFile::recordSize, h + headerRecordSize);
+    qToLittleEndian<quint32>(m_count, h + headerRecordCount);
+    qToLittleEndian<quint32>(chunkCount, h + headerChunkCount);
+    qToLittleEndian<quint32>(CacheFile::indexEntrySize, h + headerIndexEntrySize);
+    qToLittleEndian<quint64>(CacheFile::headerSize, h + headerIndex);
+
+    const quint32 checksum = crc32c(h, headerChecksum);
+    qToLittleEndian<quint32>(
+        crc32c(reinterpret_cast<const uchar *>(index.constData()), index.size(), checksum),
+        h + headerChecksum);
+
+    if(device->write(header) != header.size() || device->write(index) != index.size())
+        return false;
+
+    foreach(const QByteArray &chunk, m_chunks) {
+        if(device->write(chunk) != chunk.size())
+            return false;
+    }
+
+    return true;
+}
+
+void CacheFileWriter::finishChunk()
+{
+    if(m_chunkCount == 0)
+        return;
+
+    m_records.append(m_values);
+    m_records.append(m_strings);
+    m_chunks.append(m_records);
+    m_chunkCounts.append(m_chunkCount);
+    m_chunkValueCounts.append(m_values.size() / valueEntrySize);
+    m_chunkChecksums.append(
+        crc32c(reinterpret_cast<const uchar *>(m_records.constData()), m_records.size()));
+
+    // Every value table starts out with just the empty string.
+
+    m_records.clear();
+    m_values.fill('\0', valueEntrySize);
+    m_valueIndex.clear();
+    m_strings.clear();
+    m_chunkCount = 0;
+}
+
+void CacheFileWriter::writeValue(uchar *field, const QString &s)
+{
+    quint32 index = 0;
+
+    if(!s.isEmpty()) {
+        QHash<QString, quint32>::ConstIterator it = m_valueIndex.constFind(s);
+
+        if(it != m_valueIndex.constEnd())
+            index = it.value();
+        else {
+            index = m_values.size() / valueEntrySize;
+            m_values.resize(m_values.size() + valueEntrySize);
+            writeString(reinterpret_cast<uchar *>(m_values.data()) + index * valueEntrySize, s);
+            m_valueIndex.insert(s, index);
+        }
+    }
+
+    qToLittleEndian<quint32>(index, field);
+}
+
+void CacheFileWriter::writeString(uchar *field, const QString &s)
+{
+    // Growing m_strings never moves the record that field points into.
+
+    qToLittleEndian<quint32>(s.isEmpty() ? 0 : m_strings.size() / 2, field);
+    qToLittleEndian<quint32>(s.length(), field + 4);
+
+    if(s.isEmpty())
+        return;
+
+    const int start = m_strings.size();
+    const int bytes = s.length() * 2;
+
+    m_strings.resize(start + bytes);
+    uchar *dest = reinterpret_cast<uchar *>(m_strings.data()) + start;
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    memcpy(dest, s.utf16(), bytes);
+#else
+    const ushort *src = s.utf16();
+    for(int i = 0; i < s.length(); ++i)
+        qToLittleEndian<quint16>(src[i], dest + i * 2);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CacheFileReader
+////////////////////////////////////////////////////////////////////////////////
+
+CacheFileReader::CacheFileReader() :
+    m_data(0),
+    m_size(0),
+    m_index(0),
+    m_indexEntrySize(0),
+    m_recordSize(0),
+    m_chunkCount(0),
+    m_count(0)
+{
+
+}
+
+CacheFileReader::~CacheFileReader()
+{
+    close();
+}
+
+bool CacheFileReader::open(const QString &fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if(!m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    m_size = m_file.size();
+    if(m_size < qint64(CacheFile::headerSize)) {
+        kError() << "Music cache is truncated.";
+        close();
+        return false;
+    }
+
+    m_data = m_file.map(0, m_size);
+
+    if(!m_data) {
+        // Some file systems can't be mapped, fall back to reading it all.
+        kWarning() << "Unable to map the music cache, reading it instead:" << m_file.errorString();
+        m_buffer = m_file.readAll();
+        if(m_buffer.size() != m_size) {
+            close();
+            return false;
+        }
+        m_data = reinterpret_cast<const uchar *>(m_buffer.constData());
+    }
+
+    const qint32 version = qFromBigEndian<qint32>(m_data + headerVersion);
+    const quint32 headerLength = qFromLittleEndian<quint32>(m_data + headerHeaderSize);
+
+    m_recordSize = qFromLittleEndian<quint32>(m_data + headerRecordSize);
+    m_count = qFromLittleEndian<quint32>(m_data + headerRecordCount);
+    m_chunkCount = qFromLittleEndian<quint32>(m_data + headerChunkCount);
+    m_indexEntrySize = qFromLittleEndian<quint32>(m_data + headerIndexEntrySize);
+
+    const quint64 index = qFromLittleEndian<quint64>(m_data + headerIndex);
+    const quint32 checksum = qFromLittleEndian<quint32>(m_data + headerChecksum);
+
+    if(version != CacheFile::formatVersion ||
+       headerLength < CacheFile::headerSize ||
+       m_recordSize < CacheFile::minimumRecordSize ||
+       m_indexEntrySize < CacheFile::indexEntrySize ||
+       m_count < 0 || m_chunkCount < 0 ||
+       index < headerLength ||
+       index + quint64(m_chunkCount) * m_indexEntrySize > quint64(m_size))
+    {
+        kError() << "Music cache header is invalid.";
+        close();
+        return false;
+    }
+
+    m_index = m_data + index;
+
+    // Only the header and the index are checked here.  The chunks are checked
+    // as they are read, so that a damaged one doesn't cost the others.
+
+    const quint32 checksumExpected = crc32c(
+        m_index, quint64(m_chunkCount) * m_indexEntrySize, crc32c(m_data, headerChecksum));
+
+    if(checksum != checksumExpected) {
+        kError() << "Music cache checksum expected to get" << checksumExpected <<
+                    "actually was" << checksum;
+        close();
+        return false;
+    }
+
+    // Check every chunk against the file up front so that readChunk() only
+    // has to check the contents of the chunk.
+
+    const quint64 chunksStart = index + quint64(m_chunkCount) * m_indexEntrySize;
+    quint64 records = 0;
+
+    for(int i = 0; i < m_chunkCount; ++i) {
+        const uchar *entry = m_index + i * m_indexEntrySize;
+        const quint64 offset = qFromLittleEndian<quint64>(entry + indexOffset);
+        const quint32 length = qFromLittleEndian<quint32>(entry + indexLength);
+        const quint32 count = qFromLittleEndian<quint32>(entry + indexRecordCount);
+        const quint32 values = qFromLittleEndian<quint32>(entry + indexValueCount);
+        const quint64 tableBytes = quint64(count) * m_recordSize + quint64(values) * valueEntrySize;
+
+        if(offset < chunksStart ||
+           offset + length > quint64(m_size) ||
+           values == 0 ||
+           tableBytes > length ||
+           ((length - tableBytes) & 1) != 0)
+        {
+            kError() << "Music cache chunk" << i << "is invalid.";
+            close();
+            return false;
+        }
+
+        records += count;
+    }
+
+    if(records != quint64(m_count)) {
+        kError() << "Music cache chunks hold" << records << "tracks instead of" << m_count;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void CacheFileReader::close()
+{
+    if(m_data && m_buffer.isEmpty())
+        m_file.unmap(const_cast<uchar *>(m_data));
+
+    m_file.close();
+    m_buffer.clear();
+
+    m_data = 0;
+    m_size = 0;
+    m_index = 0;
+    m_indexEntrySize = 0;
+    m_recordSize = 0;
+    m_chunkCount = 0;
+    m_count = 0;
+}
+
+bool CacheFileReader::readChunk(int chunk, CachedTrackChunk &result) const
+{
+    if(!m_data || chunk < 0 || chunk >= m_chunkCount)
+        return false;
+
+    const uchar *entry = m_index + chunk * m_indexEntrySize;
+    const quint32 length = qFromLittleEndian<quint32>(entry + indexLength);
+    const quint32 count = qFromLittleEndian<quint32>(entry + indexRecordCount);
+    const quint32 checksum = qFromLittleEndian<quint32>(entry + indexChecksum);
+    const quint32 valueCount = qFromLittleEndian<quint32>(entry + indexValueCount);
+
+    const uchar *records = m_data + qFromLittleEndian<quint64>(entry + indexOffset);
+    const uchar *values = records + quint64(count) * m_recordSize;
+    const uchar *strings = values + quint64(valueCount) * valueEntrySize;
+    const quint32 stringsLength = (records + length - strings) / 2;
+
+    if(crc32c(records, length) != checksum) {
+        kError() << "Music cache chunk" << chunk << "is damaged, salvaging file names.";
+
+        // The record layout itself can still be trusted, as it was checked in
+        // open(), so try every path.  Whatever survived the damage looks like
+        // an absolute path; anything else is dropped, and those files turn up
+        // again on the next folder scan.  The ids are kept along with the
+        // paths, so that the playlists still find the tracks by id.  A
+        // damaged id at worst clashes with another one, and the collection
+        // hands out a new one then.
+
+        for(quint32 i = 0; i < count; ++i) {
+            const uchar *record = records + quint64(i) * m_recordSize;
+            CachedTrack track;
+
+            if(readString(record + recordPath, strings, stringsLength, track.path) &&
+               track.path.startsWith('/') && !track.path.contains(QChar(0)))
+            {
+                track.id = qFromLittleEndian<quint32>(record + recordId);
+                result.damagedTracks.append(track);
+            }
+        }
+
+        return false;
+    }
+
+    // Decode every shared value once.  The tracks then get implicitly shared
+    // copies, without having to look anything up.
+
+    QVector<QString> shared(valueCount);
+
+    for(quint32 i = 0; i < valueCount; ++i) {
+        if(!readString(values + i * valueEntrySize, strings, stringsLength, shared[i])) {
+            kError() << "Music cache chunk" << chunk << "has invalid values.";
+            return false;
+        }
+    }
+
+    result.tracks.reserve(result.tracks.size() + count);
+
+    for(quint32 i = 0; i < count; ++i) {
+        const uchar *record = records + quint64(i) * m_recordSize;
+        CachedTrack track;
+
+        if(!readString(record + recordPath,  strings, stringsLength, track.path)  ||
+           !readString(record + recordTitle, strings, stringsLength, track.title) ||
+           !readValue(record + recordArtist,  shared, track.artist) ||
+           !readValue(record + recordAlbum,   shared, track.album)  ||
+           !readValue(record + recordGenre,   shared, track.genre)  ||
+           !readValue(record + recordComment, shared, track.comment))
+        {
+            // The checksum matched, so this was written that way.  Don't try
+            // to make sense of the rest.
+
+            kError() << "Music cache chunk" << chunk << "has invalid strings.";
+            result.tracks.clear();
+            return false;
+        }
+
+        track.track   = qFromLittleEndian<qint32>(record + recordTrack);
+        track.year    = qFromLittleEndian<qint32>(record + recordYear);
+        track.seconds = qFromLittleEndian<qint32>(record + recordSeconds);
+        track.bitrate = qFromLittleEndian<qint32>(record + recordBitrate);
+
+        const qint64 modified = qFromLittleEndian<qint64>(record + recordModified);
+        if(modified >= 0)
+            track.modificationTime = QDateTime::fromMSecsSinceEpoch(modified);
+
+        track.size  = qFromLittleEndian<qint64>(record + recordFileSize);
+        track.inode = qFromLittleEndian<quint64>(record + recordInode);
+        track.id    = qFromLittleEndian<quint32>(record + recordId);
+
+        setTrackFlags(track, qFromLittleEndian<quint32>(record + recordFlags));
+
+        if(m_recordSize >= recordArtHash + 4)
+            track.embeddedArtHash = qFromLittleEndian<quint32>(record + recordArtHash);
+        else
+            track.embeddedArtKnown = track.hasEmbeddedArt = false;
+
+        // An inode without its device doesn't tell which file it is.
+
+        if(m_recordSize >= recordDevice + 8)
+            track.device = qFromLittleEndian<quint64>(record + recordDevice);
+        else
+            track.inode = 0;
+
+        result.tracks.append(track);
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CacheJournal
+////////////////////////////////////////////////////////////////////////////////
+
+static const char journalMagic[] = { 'J', 'u', 'K', 'J' };
+static const int journalHeaderSize = 8;
+static const int journalEntryOverhead = 7; // operation, length and checksum
+
+static QByteArray encodeTrack(const CachedTrack &track)
+{
+    QByteArray payload;
+    QDataStream s(&payload, QIODevice::WriteOnly);
+    s.setVersion(QDataStream::Qt_4_3);
+
+    s << track.path
+      << track.title
+      << track.artist
+      << track.album
+      << track.genre
+      << track.comment
+      << qint32(track.track)
+      << qint32(track.year)
+      << qint32(track.seconds)
+      << qint32(track.bitrate)
+      << track.modificationTime
+      << qint64(track.size)
+      << quint64(track.inode)
+      << quint32(track.id)
+      << trackFlags(track)
+      << quint32(track.embeddedArtHash)
+      << quint64(track.device);
+
+    return payload;
+}
+
+static void decodeTrack(const QByteArray &payload, CachedTrack &track)
+{
+    QDataStream s(payload);
+    s.setVersion(QDataStream::Qt_4_3);
+
+    qint32 trackNumber = 0, year = 0, seconds = 0, bitrate = 0;
+
+    s >> track.path
+      >> track.title
+      >> track.artist
+      >> track.album
+      >> track.genre
+      >> track.comment
+      >> trackNumber
+      >> year
+      >> seconds
+      >> bitrate
+      >> track.modificationTime;
+
+    track.track = trackNumber;
+    track.year = year;
+    track.seconds = seconds;
+    track.bitrate = bitrate;
+
+    // Added later on, without changing the journal version.
+
+    if(!s.atEnd()) {
+        qint64 size;
+        quint64 inode;
+        s >> size >> inode;
+
+        if(s.status() == QDataStream::Ok) {
+            track.size = size;
+            track.inode = inode;
+        }
+    }
+
+    if(!s.atEnd()) {
+        quint32 id;
+        s >> id;
+
+        if(s.status() == QDataStream::Ok)
+            track.id = id;
+    }
+
+    if(!s.atEnd()) {
+        quint32 flags;
+        s >> flags;
+
+        if(s.status() == QDataStream::Ok)
+            setTrackFlags(track, flags);
+    }
+
+    if(!s.atEnd()) {
+        quint32 hash;
+        s >> hash;
+
+        if(s.status() == QDataStream::Ok)
+            track.embeddedArtHash = hash;
+    }
+
+    // As in the cache file, the inode is no good without its device.
+
+    quint64 device = 0;
+
+    if(!s.atEnd())
+        s >> device;
+
+    if(s.status() == QDataStream::Ok && device != 0)
+        track.device = device;
+    else
+        track.inode = 0;
+}
+
+CacheJournal::CacheJournal()
+{
+
+}
+
+bool CacheJournal::open(const QString &fileName, QList<Entry> *entries)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if(!m_file.open(QIODevice::ReadWrite)) {
+        kError() << "Unable to open the cache journal:" << m_file.errorString();
+        return false;
+    }
+
+    const QByteArray data = m_file.readAll();
+    const uchar *d = reinterpret_cast<const uchar *>(data.constData());
+
+    if(data.size() < journalHeaderSize ||
+       memcmp(d, journalMagic, sizeof(journalMagic)) != 0 ||
+       qFromLittleEndian<quint32>(d + 4) != version)
+    {
+        if(!data.isEmpty())
+            kWarning() << "Discarding unreadable cache journal.";
+
+        return writeHeader();
+    }
+
+    int end = journalHeaderSize;
+
+    while(end + journalEntryOverhead <= data.size()) {
+        const uchar *entry = d + end;
+        const quint8 operation = entry[0];
+        const quint32 length = qFromLittleEndian<quint32>(entry + 1);
+
+        if(length > quint32(data.size() - end - journalEntryOverhead))
+            break;
+
+        const quint16 checksum = qFromLittleEndian<quint16>(entry + 5 + length);
+
+        if(checksum != qChecksum(reinterpret_cast<const char *>(entry), 5 + length) ||
+           operation < Add || operation > Remove)
+        {
+            break;
+        }
+
+        if(entries) {
+            Entry e;
+            e.operation = Operation(operation);
+            decodeTrack(data.mid(end + 5, length), e.track);
+            entries->append(e);
+        }
+
+        end += journalEntryOverhead + length;
+    }
+
+    if(end < data.size()) {
+        kWarning() << "Cutting off" << data.size() - end << "bytes of incomplete cache journal.";
+
+        if(!m_file.resize(end)) {
+            kError() << "Unable to repair the cache journal:" << m_file.errorString();
+            close();
+            return false;
+        }
+    }
+
+    return m_file.seek(end);
+}
+
+void CacheJournal::close()
+{
+    if(m_file.isOpen())
+        flush();
+
+    m_file.close();
+    m_pending.clear();
+}
+
+void CacheJournal::append(Operation operation, const CachedTrack &track)
+{
+    if(!m_file.isOpen())
+        return;
+
+    QByteArray payload;
+
+    if(operation == Remove) {
+        CachedTrack removed;
+        removed.path = track.path;
+        payload = encodeTrack(removed);
+    }
+    else
+        payload = encodeTrack(track);
+
+    const int start = m_pending.size();
+    m_pending.resize(start + 5 + payload.size() + 2);
+
+    uchar *entry = reinterpret_cast<uchar *>(m_pending.data()) + start;
+    entry[0] = quint8(operation);
+    qToLittleEndian<quint32>(payload.size(), entry + 1);
+    memcpy(entry + 5, payload.constData(), payload.size());
+    qToLittleEndian<quint16>(
+        qChecksum(reinterpret_cast<const char *>(entry), 5 + payload.size()),
+        entry + 5 + payload.size());
+}
+
+bool CacheJournal::flush()
+{
+    if(!m_file.isOpen())
+        return false;
+
+    if(m_pending.isEmpty())
+        return true;
+
+    if(m_file.write(m_pending) != m_pending.size() || !m_file.flush()) {
+        kError() << "Unable to write the cache journal:" << m_file.errorString();
+        return false;
+    }
+
+    m_pending.clear();
+    return true;
+}
+
+qint64 CacheJournal::size() const
+{
+    return m_file.size() + m_pending.size();
+}
+
+bool CacheJournal::discardBefore(qint64 offset)
+{
+    if(!flush())
+        return false;
+
+    const QString fileName = m_file.fileName();
+
+    if(!m_file.seek(qMax<qint64>(offset, journalHeaderSize)))
+        return false;
+
+    const QByteArray remaining = m_file.readAll();
+
+    // Write the shortened journal next to the current one and move it into
+    // place, so that a crash leaves either of them intact.
+
+    QFile shortened(fileName + QLatin1String(".new"));
+    if(!shortened.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QByteArray header(journalHeaderSize, '\0');
+    memcpy(header.data(), journalMagic, sizeof(journalMagic));
+    qToLittleEndian<quint32>(version, reinterpret_cast<uchar *>(header.data()) + 4);
+
+    if(shortened.write(header) != header.size() ||
+       shortened.write(remaining) != remaining.size() ||
+       !shortened.flush())
+    {
+        kError() << "Unable to write the cache journal:" << shortened.errorString();
+        shortened.remove();
+        return false;
+    }
+
+    shortened.close();
+    m_file.close();
+
+    if(::rename(QFile::encodeName(shortened.fileName()).constData(),
+                QFile::encodeName(fileName).constData()) != 0)
+    {
+        kError() << "Unable to replace the cache journal.";
+        shortened.remove();
+    }
+
+    return open(fileName);
+}
+
+QHash<QString, CacheJournal::Entry> CacheJournal::replay(const QList<Entry> &entries) // static
+{
+    QHash<QString, Entry> result;
+
+    foreach(const Entry &entry, entries)
+        result.insert(entry.track.path, entry);
+
+    return result;
+}
+
+bool CacheJournal::writeHeader()
+{
+    QByteArray header(journalHeaderSize, '\0');
+    memcpy(header.data(), journalMagic, sizeof(journalMagic));
+    qToLittleEndian<quint32>(version, reinterpret_cast<uchar *>(header.data()) + 4);
+
+    if(!m_file.resize(0) || !m_file.seek(0) ||
+       m_file.write(header) != header.size() || !m_file.flush())
+    {
+        kError() << "Unable to write the cache journal:" << m_file.errorString();
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+// vim: set et sw=4 tw=0 sta:
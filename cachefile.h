@@ -0,0 +1,414 @@
+/**
+ * Copyright (C) 2002-2004 Scott Wheeler <wheeler@kde.org>
+ * Copyright (C) 2008, 2013 Michael Pyne <mpyne@kde.org>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_CACHEFILE_H
+#define JUK_CACHEFILE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+/**
+ * The on-disk layout of the collection cache.
+ *
+ * The first four bytes are the cache version as a big-endian qint32, exactly
+ * like the older QDataStream based caches, so that Cache can tell the formats
+ * apart.  Everything after that is little-endian so that it can be used in
+ * place from a memory mapping on the common architectures:
+ *
+ * \code
+ * header       (headerSize bytes)
+ * chunk index  (chunkCount entries of indexEntrySize bytes)
+ * chunks       (each one is its records, its value table and its strings)
+ * \endcode
+ *
+ * The tracks are split into chunks of up to chunkRecords records.  A chunk has
+ * its own string table, so every chunk can be decoded on its own, and on any
+ * thread, using nothing but its index entry.
+ *
+ * Every chunk is protected by its own CRC32C, kept in its index entry, and
+ * one more CRC32C covers the header and the index.  A damaged chunk only
+ * costs the tracks in it, which are read from their files again.
+ *
+ * Each track record has a fixed size and refers to its strings by an
+ * (offset, length) pair into the string table of its chunk, counted in UTF-16
+ * code units.  recordSize is stored in the header so that fields can be
+ * appended to the record later without breaking older files.
+ *
+ * Artist, album, genre and comment mostly repeat from one track to the next,
+ * so those are stored once per chunk in its value table, and the records
+ * refer to them by their index there.  The first value is always the empty
+ * string.
+ */
+namespace CacheFile
+{
+    /**
+     * Continues the numbering of the QDataStream cache versions:
+     *
+     * 3: Memory mapped, fixed record layout with one string table.
+     * 4: Chunks with a string table each, listed in a chunk index.
+     * 5: A CRC32C for every chunk in the index, and one over the header and
+     *    index, instead of a checksum of the whole file.
+     * 6: The records keep the size and inode of the file along with its
+     *    modification time, see FileStat::matches().
+     * 7: Artist, album, genre and comment are kept once per chunk in a value
+     *    table.
+     * 8: The records keep the CollectionListItem id, which the playlists
+     *    refer to.
+     *
+     * The cache journal, and the record flags, art hash and device that came
+     * later, were added without changing the version; shorter records are
+     * still read.
+     */
+    const qint32 formatVersion = 8;
+
+    /**
+     * The first version using this layout.  Versions from here up to
+     * formatVersion were never released and are simply discarded.
+     */
+    const qint32 firstMappedVersion = 3;
+
+    const quint32 headerSize = 64;
+    const quint32 indexEntrySize = 24;
+    const quint32 recordSize = 108;
+
+    /**
+     * The size of the records before the embedded art was added to them.
+     * Records down to this size are still read, with the art unknown.
+     */
+    const quint32 minimumRecordSize = 96;
+
+    /**
+     * Number of tracks per chunk.  Large enough that handing a chunk to a
+     * worker thread is worth it, small enough to keep all of the cores busy.
+     */
+    const int chunkRecords = 2048;
+
+    /**
+     * Returns the CRC32C of \a length bytes at \a data, the same checksum that
+     * protects the cache, for anything else that is to be told apart by its
+     * contents.
+     */
+    quint32 checksum(const char *data, quint64 length);
+}
+
+/**
+ * Tells files apart by their device and inode, which is the same however the
+ * file is reached, e.g. through a symlink, and is much cheaper to compare and
+ * hash than a canonical path.  A null identity is unknown, and never equal to
+ * that of a file.
+ */
+struct FileIdentity
+{
+    FileIdentity() : device(0), inode(0) {}
+    FileIdentity(quint64 d, quint64 i) : device(d), inode(i) {}
+
+    bool isNull() const { return inode == 0; }
+
+    bool operator==(const FileIdentity &other) const
+    {
+        return inode == other.inode && device == other.device;
+    }
+
+    bool operator!=(const FileIdentity &other) const { return !operator==(other); }
+
+    quint64 device;
+    quint64 inode;
+};
+
+inline uint qHash(const FileIdentity &identity)
+{
+    return qHash(identity.inode) ^ qHash(identity.device);
+}
+
+/**
+ * A plain copy of everything the cache knows about a single track.  This does
+ * not depend on FileHandle or Tag so that it can be produced and consumed
+ * anywhere.
+ */
+struct CachedTrack
+{
+    CachedTrack() : track(0), year(0), seconds(0), bitrate(0), size(-1), inode(0), device(0),
+        id(0), estimatedProperties(false), embeddedArtKnown(false), hasEmbeddedArt(false),
+        embeddedArtHash(0) {}
+
+    QString path;
+    QString title;
+    QString artist;
+    QString album;
+    QString genre;
+    QString comment;
+    int track;
+    int year;
+    int seconds;
+    int bitrate;
+    QDateTime modificationTime;
+    qint64 size;    ///< -1 if unknown
+    quint64 inode;  ///< 0 if unknown
+    quint64 device; ///< Only meaningful along with the inode.
+
+    FileIdentity identity() const { return FileIdentity(device, inode); }
+
+    /**
+     * The CollectionListItem::id() of the track, which the playlists file
+     * refers to.  0 if it has none yet.
+     */
+    quint32 id;
+
+    /**
+     * True if seconds and bitrate are estimates from a fast read, which are
+     * to be replaced by exact values later.
+     */
+    bool estimatedProperties;
+
+    /**
+     * Whether the file has a cover picture in its tags, and the checksum of
+     * that picture.  Unknown for tracks cached before this was kept.
+     */
+    bool embeddedArtKnown;
+    bool hasEmbeddedArt;
+    quint32 embeddedArtHash;
+};
+
+typedef QVector<CachedTrack> CachedTrackList;
+
+/**
+ * The parts of the status of a file that tell whether it changed since it was
+ * cached, and which file it is, all from a single stat().  Can be used from
+ * any thread.
+ */
+struct FileStat
+{
+    FileStat() : exists(false), isFile(false), isDir(false), isSymLink(false),
+        size(-1), inode(0), device(0) {}
+
+    /**
+     * Follows \a path if it is a symlink, unless \a followSymLinks is false,
+     * in which case isSymLink tells whether it is one.
+     */
+    static FileStat read(const QString &path, bool followSymLinks = true);
+
+    /**
+     * Returns true if \a track is still up to date with the file.  A size or
+     * inode that was not cached is not compared.
+     */
+    bool matches(const CachedTrack &track) const;
+
+    FileIdentity identity() const { return FileIdentity(device, inode); }
+
+    bool exists;
+    bool isFile;
+    bool isDir;
+    bool isSymLink;
+    qint64 size;
+    quint64 inode;
+    quint64 device;
+    QDateTime lastModified;
+};
+
+/**
+ * The result of decoding one chunk of the cache.
+ */
+struct CachedTrackChunk
+{
+    CachedTrackList tracks;
+
+    /**
+     * The tracks of a damaged chunk, as far as their paths could still be
+     * made out.  Only the path and id are set, so these have to be read from
+     * disk again.
+     */
+    CachedTrackList damagedTracks;
+
+    /**
+     * Tracks whose files were modified since they were cached, also to be
+     * read again.  What the cache has is shown until then.  Only filled in
+     * by the cache loader.
+     */
+    CachedTrackList changedTracks;
+
+    /**
+     * Cached files that don't exist any more.  Only filled in by the cache
+     * loader.
+     */
+    QStringList missingFiles;
+};
+
+/**
+ * Serializes CachedTracks into the chunked layout described in CacheFile.
+ */
+class CacheFileWriter
+{
+public:
+    CacheFileWriter();
+
+    void addTrack(const CachedTrack &track);
+    int count() const { return m_count; }
+
+    /**
+     * Writes the complete cache to \a device, which should be a freshly
+     * opened KSaveFile or similar.
+     */
+    bool write(QIODevice *device);
+
+private:
+    void finishChunk();
+    void writeString(uchar *field, const QString &s);
+    void writeValue(uchar *field, const QString &s);
+
+    QList<QByteArray> m_chunks;
+    QList<int> m_chunkCounts;
+    QList<int> m_chunkValueCounts;
+    QList<quint32> m_chunkChecksums;
+
+    // The chunk currently being filled.
+    QByteArray m_records;
+    QByteArray m_values;
+    QHash<QString, quint32> m_valueIndex;
+    QByteArray m_strings;
+    int m_chunkCount;
+
+    int m_count;
+};
+
+/**
+ * Memory maps a cache file written by CacheFileWriter and decodes it a chunk
+ * at a time.  Nothing is decoded up front besides the header and the chunk
+ * index.
+ *
+ * Once open() has returned, readChunk() only reads from the mapping and may be
+ * called from several threads at once.
+ */
+class CacheFileReader
+{
+public:
+    CacheFileReader();
+    ~CacheFileReader();
+
+    /**
+     * Maps \a fileName and validates the header and chunk index.  Returns
+     * false if the file could not be opened or is not a valid cache of the
+     * current version.  The chunks themselves are only checked as they are
+     * read.
+     */
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const { return m_data != 0; }
+
+    int count() const { return m_count; }
+    int chunkCount() const { return m_chunkCount; }
+
+    /**
+     * Decodes every record of chunk \a chunk into \a result.  Returns false
+     * if the chunk is damaged, in which case no tracks are returned, only the
+     * file names that could be salvaged.
+     */
+    bool readChunk(int chunk, CachedTrackChunk &result) const;
+
+private:
+    QFile m_file;
+    QByteArray m_buffer; ///< Used only if the file could not be mapped.
+    const uchar *m_data;
+    qint64 m_size;
+    const uchar *m_index;
+    quint32 m_indexEntrySize;
+    quint32 m_recordSize;
+    int m_chunkCount;
+    int m_count;
+};
+
+/**
+ * An append-only log of the changes made to the collection since the cache
+ * file was last written, so that those don't require rewriting the whole
+ * cache.  The layout is:
+ *
+ * \code
+ * header   "JuKJ" followed by the journal version as a little-endian quint32
+ * entries  quint8 operation, quint32 length, payload, quint16 checksum
+ * \endcode
+ *
+ * The payload is a CachedTrack in QDataStream format, of which only the path
+ * is used for Remove.  The checksum covers everything else in the entry.
+ *
+ * Replaying the journal over the cache file is idempotent: the last entry
+ * for a file wins.  So the journal only has to be cut down after a new cache
+ * file has been safely written, and it does not matter if that never happens.
+ */
+class CacheJournal
+{
+public:
+    enum Operation { Add = 1, Modify = 2, Remove = 3 };
+
+    struct Entry
+    {
+        Operation operation;
+        CachedTrack track;
+    };
+
+    static const quint32 version = 1;
+
+    CacheJournal();
+
+    /**
+     * Opens \a fileName for appending, creating it if needed.  The existing
+     * entries are returned in \a entries, in the order they were written.
+     * Anything after the last complete entry, such as an entry that was
+     * being written during a crash, is cut off.
+     */
+    bool open(const QString &fileName, QList<Entry> *entries = 0);
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+
+    /**
+     * Queues an entry.  Nothing is written until flush() is called.
+     */
+    void append(Operation operation, const CachedTrack &track);
+    bool flush();
+
+    /**
+     * Returns the size of the journal in bytes, including entries that
+     * haven't been flushed yet.
+     */
+    qint64 size() const;
+
+    /**
+     * Drops the entries before \a offset, a value previously returned by
+     * size(), once they are contained in a newly written cache file.
+     */
+    bool discardBefore(qint64 offset);
+
+    /**
+     * Returns the final entry for every file in \a entries, which are in the
+     * order they were written, as open() returns them.
+     */
+    static QHash<QString, Entry> replay(const QList<Entry> &entries);
+
+private:
+    bool writeHeader();
+
+    QFile m_file;
+    QByteArray m_pending;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
@@ -27,7 +27,6 @@
 #include <ksavefile.h>
 #include <kstandarddirs.h>
 #include <ktoolbarpopupaction.h>
-#include <kdirwatch.h>
 
 #include <QStringBuilder>
 #include <QList>
@@ -38,17 +37,402 @@
 #include <QTime>
 #include <QClipboard>
 #include <QFileInfo>
+#include <QDirIterator>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
 
 #include "playlistcollection.h"
 #include "splashscreen.h"
-#include "stringshare.h"
+#include "stringpool.h"
 #include "cache.h"
+#include "cachefile.h"
+#include "folderwatcher.h"
+#include "scanpipeline.h"
 #include "actioncollection.h"
 #include "tag.h"
 #include "viewmode.h"
+#include "workscheduler.h"
 
 using ActionCollection::action;
 
+////////////////////////////////////////////////////////////////////////////////
+// scheduled jobs
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Creates the items from the cache, either from an older cache one item at a
+ * time, or from the chunks of the current cache as the worker threads finish
+ * decoding them.  Files that changed since they were cached get their items
+ * from the cache, and the files of damaged chunks get empty ones under the
+ * same ids.  Both are then read again on the thread pool like any other
+ * changed file, see CollectionList::readNextChangedFiles().  Files that are
+ * gone are journaled as removed.  The cache journal is applied on
+ * top: tracks that it changed or removed are skipped while loading the cache,
+ * and the final state of every journaled track is loaded afterwards.
+ *
+ * Only the chunks of the current cache are checked against the disk while
+ * they are decoded.  Everything else is left to CollectionList::slotCheckCache().
+ */
+class CachedItemsLoader : public WorkJob
+{
+public:
+    enum Source { NoCache, OlderCache, ChunkedCache };
+
+    CachedItemsLoader(CollectionList *list, Source source,
+                      const QList<CacheJournal::Entry> &journal) :
+        m_list(list),
+        m_source(source),
+        m_nextTrack(0),
+        m_decodingFinished(false),
+        m_journal(CacheJournal::replay(journal))
+    {
+        m_nextJournalEntry = m_journal.constBegin();
+    }
+
+    void addChunk(const CachedTrackChunk &chunk)
+    {
+        m_chunks.append(chunk.tracks);
+        m_rereadTracks += chunk.damagedTracks;
+        m_rereadTracks += chunk.changedTracks;
+        m_missingFiles += chunk.missingFiles;
+    }
+
+    void setDecodingFinished() { m_decodingFinished = true; }
+
+    virtual Status runUnit()
+    {
+        if(m_source == OlderCache) {
+            const FileHandle file = Cache::instance()->loadNextCachedItem();
+
+            if(!file.isNull()) {
+                if(!m_journal.contains(file.absFilePath())) {
+                    m_list->addCachedItem(file);
+                    m_list->m_unverifiedFiles.append(file.absFilePath());
+                }
+                return MoreWork;
+            }
+
+            m_source = NoCache;
+        }
+        else if(m_source == ChunkedCache) {
+            while(!m_chunks.isEmpty() && m_nextTrack >= m_chunks.first().count()) {
+                m_chunks.removeFirst();
+                m_nextTrack = 0;
+            }
+
+            if(!m_chunks.isEmpty()) {
+                const CachedTrack &track = m_chunks.first().at(m_nextTrack++);
+                if(!m_journal.contains(track.path))
+                    m_list->addCachedItem(FileHandle(track), track.id);
+                return MoreWork;
+            }
+
+            if(!m_rereadTracks.isEmpty()) {
+                const CachedTrack track = m_rereadTracks.takeFirst();
+                if(!m_journal.contains(track.path)) {
+                    m_list->addCachedItem(FileHandle(track), track.id);
+                    m_list->m_changedFiles.append(track.path);
+                    m_list->readNextChangedFiles();
+                }
+                return MoreWork;
+            }
+
+            // The cache only stops listing these once the removal is
+            // journaled; otherwise every start would look for them again.
+
+            if(!m_missingFiles.isEmpty()) {
+                const QString path = m_missingFiles.takeFirst();
+                if(!m_journal.contains(path))
+                    m_list->journalChange(path, CacheJournal::Remove);
+                return MoreWork;
+            }
+
+            if(!m_decodingFinished)
+                return Waiting;
+
+            m_source = NoCache;
+        }
+
+        if(m_nextJournalEntry == m_journal.constEnd())
+            return Done;
+
+        const CacheJournal::Entry &entry = *m_nextJournalEntry;
+        ++m_nextJournalEntry;
+
+        if(entry.operation != CacheJournal::Remove) {
+            m_list->addCachedItem(FileHandle(entry.track), entry.track.id);
+            m_list->m_unverifiedFiles.append(entry.track.path);
+        }
+
+        return MoreWork;
+    }
+
+    virtual void done() { m_list->completedLoadingCachedItems(); }
+
+private:
+    CollectionList *m_list;
+    Source m_source;
+    QList<CachedTrackList> m_chunks;
+    CachedTrackList m_rereadTracks;
+    QStringList m_missingFiles;
+    int m_nextTrack;
+    bool m_decodingFinished;
+    QHash<QString, CacheJournal::Entry> m_journal;
+    QHash<QString, CacheJournal::Entry>::ConstIterator m_nextJournalEntry;
+};
+
+/**
+ * What CacheVerifier found out about a batch of files.
+ */
+struct CacheCheckResult
+{
+    QStringList missingFiles;
+    QStringList changedFiles;
+};
+
+/**
+ * Checks a batch of files against their fingerprints on a worker thread.
+ */
+struct CacheVerifier
+{
+    typedef CacheCheckResult result_type;
+
+    CacheCheckResult operator()(const CachedTrackList &tracks) const
+    {
+        CacheCheckResult result;
+
+        foreach(const CachedTrack &track, tracks) {
+            const FileStat stat = FileStat::read(track.path);
+
+            if(!stat.exists || !stat.isFile)
+                result.missingFiles.append(track.path);
+            else if(!stat.matches(track))
+                result.changedFiles.append(track.path);
+        }
+
+        return result;
+    }
+};
+
+static void debugStringPool(const char *name, const StringPool::Statistics &pool)
+{
+    kDebug() << "The" << name << "pool has" << pool.strings << "strings,"
+             << qRound(pool.hitRate() * 100) << "% of lookups hit, saving"
+             << pool.bytesSaved << "bytes";
+}
+
+/**
+ * Reads \a files with exact audio properties on a worker thread.  That means
+ * reading through each of them, so the thread steps back for everything else
+ * meanwhile.
+ */
+static CachedTrackList measureProperties(const QStringList &files)
+{
+    QThread::currentThread()->setPriority(QThread::IdlePriority);
+
+    const TrackReader reader;
+    CachedTrackList tracks;
+
+    foreach(const QString &file, files) {
+        const CachedTrack track = reader(file);
+        if(!track.path.isEmpty())
+            tracks.append(track);
+    }
+
+    QThread::currentThread()->setPriority(QThread::NormalPriority);
+
+    return tracks;
+}
+
+/**
+ * The GUI end of a ScanPipeline: adds the tracks read below the music folders
+ * to the collection, one per unit, and imports the playlists found there once
+ * the pipeline is done.  Folders added while a scan is running get a scan of
+ * their own afterwards.
+ */
+class FolderScanJob : public WorkJob
+{
+public:
+    FolderScanJob(CollectionList *list) : m_list(list), m_full(false), m_pipeline(0), m_next(0) {}
+    virtual ~FolderScanJob() { delete m_pipeline; }
+
+    void addFolders(const QStringList &folders, bool full)
+    {
+        m_pending += folders;
+        m_full = m_full || full;
+    }
+
+    /**
+     * Stops the scan.  The tracks that were read already stay in the
+     * collection, but the folder manifest isn't touched, so the next scan
+     * goes through the folders again.
+     */
+    void cancel()
+    {
+        delete m_pipeline;
+        m_pipeline = 0;
+
+        m_pending.clear();
+        m_tracks.clear();
+        m_next = 0;
+    }
+
+    /**
+     * The progress of the scan, including the folders that were scanned
+     * before the current ones.
+     */
+    ScanStatus status() const
+    {
+        ScanStatus status = m_finished;
+
+        if(m_pipeline)
+            status.add(m_pipeline->status());
+
+        status.queuedTracks += m_tracks.count() - m_next;
+        return status;
+    }
+
+    virtual Status runUnit()
+    {
+        if(m_next < m_tracks.count()) {
+            m_list->createItem(FileHandle(m_tracks[m_next++]), 0, false);
+            return MoreWork;
+        }
+
+        if(m_pipeline) {
+            m_tracks.clear();
+            m_next = 0;
+
+            if(m_pipeline->takeTracks(m_tracks, batchSize) > 0) {
+                emit m_list->signalFolderScanProgress(m_pipeline->filesRead(),
+                                                      m_pipeline->filesFound());
+                return MoreWork;
+            }
+
+            // CollectionList::slotFolderScanReady() wakes the job up again.
+
+            if(!m_pipeline->isFinished())
+                return Waiting;
+
+            FileHandleList files;
+            foreach(const QString &file, m_pipeline->takePlaylistFiles())
+                m_list->addFileEntry(file, files, true);
+
+            m_list->m_folderManifest.update(m_scanned, m_pipeline->manifest());
+            m_list->m_folderManifestDirty = true;
+
+            m_finished.add(m_pipeline->status());
+
+            delete m_pipeline;
+            m_pipeline = 0;
+        }
+
+        if(m_pending.isEmpty())
+            return Done;
+
+        // As in Playlist::addFile(), only import the playlists below the
+        // music folders if the user asked for that.
+
+        PlaylistCollection *collection = PlaylistCollection::instance();
+        FolderManifest &manifest = m_list->m_folderManifest;
+
+        // The folders recorded with the other setting may have playlists
+        // that were never looked at.
+
+        if(manifest.importPlaylists() != collection->importPlaylists()) {
+            manifest.clear();
+            manifest.setImportPlaylists(collection->importPlaylists());
+        }
+
+        m_scanned.clear();
+        foreach(const QString &folder, m_pending) {
+            const QString canonicalPath = QFileInfo(folder).canonicalFilePath();
+            if(!canonicalPath.isEmpty())
+                m_scanned.insert(canonicalPath);
+        }
+
+        m_pipeline = new ScanPipeline;
+        m_pipeline->setKnownFiles(QSet<QString>::fromList(m_list->itemPaths()));
+        m_pipeline->setExcludedFolders(collection->excludedFolderSet());
+        m_pipeline->setImportPlaylists(collection->importPlaylists());
+        m_pipeline->setFastProperties(collection->fastTagScan());
+
+        // An empty collection means that the cache was lost, in which case
+        // the manifest is no good either.  The walkers get a copy, as the
+        // manifest changes along with the collection.
+
+        if(!m_full && m_list->count() > 0) {
+            m_previousManifest = manifest;
+            m_pipeline->setPreviousManifest(&m_previousManifest);
+        }
+
+        m_full = false;
+
+        QObject::connect(m_pipeline, SIGNAL(signalTracksReady()),
+                         m_list, SLOT(slotFolderScanReady()));
+
+        m_pipeline->start(m_pending);
+        m_pending.clear();
+
+        return Waiting;
+    }
+
+    virtual void done() { m_list->completedFolderScan(); }
+
+private:
+    static const int batchSize = 256;
+
+    CollectionList *m_list;
+    QStringList m_pending;
+    bool m_full;
+    FolderSet m_scanned;
+    FolderManifest m_previousManifest;
+    ScanPipeline *m_pipeline;
+    ScanStatus m_finished;
+    CachedTrackList m_tracks;
+    int m_next;
+};
+
+/**
+ * Copies the current state of every item for a new cache file.  The copies
+ * share their strings with the items, so this is quick, but FileHandle and
+ * Tag can only be used from the GUI thread, which leaves writing the file
+ * itself to a worker thread.
+ */
+class CacheSnapshotJob : public WorkJob
+{
+public:
+    CacheSnapshotJob(CollectionList *list, const QStringList &files) :
+        m_list(list),
+        m_files(files),
+        m_next(0)
+    {
+        m_tracks.reserve(files.count());
+    }
+
+    virtual Status runUnit()
+    {
+        if(m_next >= m_files.count())
+            return Done;
+
+        const CollectionListItem *item = m_list->lookup(m_files[m_next++]);
+        if(item)
+            m_tracks.append(item->cachedTrack());
+
+        return MoreWork;
+    }
+
+    virtual void done() { m_list->completedCacheSnapshot(m_tracks); }
+
+private:
+    CollectionList *m_list;
+    QStringList m_files;
+    CachedTrackList m_tracks;
+    int m_next;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // static methods
 ////////////////////////////////////////////////////////////////////////////////
@@ -62,6 +446,26 @@ CollectionList *CollectionList::instance()
 
 static QTime stopwatch;
 
+// How long changes are collected before they are written to the journal, and
+// the size below which the journal is never compacted.
+
+static const int journalInterval = 2000;
+static const qint64 journalCompactionSize = 1024 * 1024;
+
+// The number of files handed to a worker thread at once by slotCheckCache().
+
+static const int cacheCheckBatchSize = 512;
+
+// The number of files measured at once by measureEstimatedTracks().  Each one
+// is read through, so this is kept small to keep the results coming.
+
+static const int measureBatchSize = 64;
+
+// The number of changed files handed to the worker threads at once by
+// slotFoldersChanged().  The rest waits for the batch before.
+
+static const int changedFilesBatchSize = 256;
+
 void CollectionList::startLoadingCachedItems()
 {
     if(!m_list)
@@ -70,49 +474,74 @@ void CollectionList::startLoadingCachedItems()
     kDebug() << "Starting to load cached items";
     stopwatch.start();
 
-    if(!Cache::instance()->prepareToLoadCachedItems()) {
+    Cache *cache = Cache::instance();
+
+    if(!cache->prepareToLoadCachedItems()) {
         kError() << "Unable to setup to load cache... perhaps it doesn't exist?";
 
-        completedLoadingCachedItems();
+        // The journal may still have something.
+
+        m_cachedItemsLoader = new CachedItemsLoader(this, CachedItemsLoader::NoCache,
+                                                    cache->takeJournalEntries());
+        WorkScheduler::instance()->schedule(m_cachedItemsLoader);
         return;
     }
 
-    kDebug() << "Kicked off first batch";
-    QTimer::singleShot(0, this, SLOT(loadNextBatchCachedItems()));
+    m_folderManifest.load(Cache::folderManifestFileName());
+
+    const bool parallel = cache->canLoadCachedItemsInParallel();
+    m_cachedItemsLoader = new CachedItemsLoader(this,
+        parallel ? CachedItemsLoader::ChunkedCache : CachedItemsLoader::OlderCache,
+        cache->takeJournalEntries());
+
+    if(parallel) {
+        kDebug() << "Decoding cache on" << QThreadPool::globalInstance()->maxThreadCount()
+                 << "threads";
+
+        m_cacheDecoder = new QFutureWatcher<CachedTrackChunk>(this);
+        connect(m_cacheDecoder, SIGNAL(resultReadyAt(int)), SLOT(slotCachedChunkDecoded(int)));
+        connect(m_cacheDecoder, SIGNAL(finished()), SLOT(slotCacheDecoded()));
+        m_cacheDecoder->setFuture(cache->loadCachedItemsInParallel());
+    }
+
+    WorkScheduler::instance()->schedule(m_cachedItemsLoader);
 }
 
-void CollectionList::loadNextBatchCachedItems()
+void CollectionList::slotCachedChunkDecoded(int index)
 {
-    Cache *cache = Cache::instance();
-    bool done = false;
+    const CachedTrackChunk chunk = m_cacheDecoder->resultAt(index);
 
-    for(int i = 0; i < 20; ++i) {
-        FileHandle cachedItem(cache->loadNextCachedItem());
+    // The cache file has to be written again without the damage.
 
-        if(cachedItem.isNull()) {
-            done = true;
-            break;
-        }
+    if(!chunk.damagedTracks.isEmpty())
+        Cache::instance()->setCacheFileCurrent(false);
 
-        // This may have already been created via a loaded playlist.
-        if(!m_itemsDict.contains(cachedItem.absFilePath())) {
-            CollectionListItem *newItem = new CollectionListItem(this, cachedItem);
-            setupItem(newItem);
-        }
-    }
-
-    SplashScreen::update();
+    m_cachedItemsLoader->addChunk(chunk);
+    WorkScheduler::instance()->schedule(m_cachedItemsLoader);
+}
 
-    if(!done) {
-        QTimer::singleShot(0, this, SLOT(loadNextBatchCachedItems()));
-    }
-    else {
-        completedLoadingCachedItems();
-    }
+void CollectionList::slotCacheDecoded()
+{
+    m_cachedItemsLoader->setDecodingFinished();
+    WorkScheduler::instance()->schedule(m_cachedItemsLoader);
 }
 
 void CollectionList::completedLoadingCachedItems()
 {
+    if(m_cacheDecoder) {
+        Cache::instance()->finishLoadingCachedItems();
+        m_cacheDecoder->deleteLater();
+        m_cacheDecoder = 0;
+    }
+
+    delete m_cachedItemsLoader;
+    m_cachedItemsLoader = 0;
+
+    // An older cache still has to be converted.
+
+    if(!Cache::instance()->isCacheFileCurrent())
+        m_journalTimer->start();
+
     // The CollectionList is created with sorting disabled for speed.  Re-enable
     // it here, and perform the sort.
     KConfigGroup config(KGlobal::config(), "Playlists");
@@ -130,6 +559,8 @@ void CollectionList::completedLoadingCachedItems()
 
     kDebug() << "Finished loading cached items, took" << stopwatch.elapsed() << "ms";
     kDebug() << m_itemsDict.size() << "items are in the CollectionList";
+    debugStringPool("tag value", StringPool::instance()->statistics());
+    debugStringPool("sort key", m_trackTable.sortKeyStatistics());
 
     emit cachedItemsLoaded();
 }
@@ -158,10 +589,10 @@ CollectionListItem *CollectionList::createItem(const FileHandle &file, Q3ListVie
     // It's probably possible to optimize the line below away, but, well, right
     // now it's more important to not load duplicate items.
 
-    if(m_itemsDict.contains(file.absFilePath()))
+    if(m_itemsDict.contains(file.trackPath()))
         return 0;
 
-    CollectionListItem *item = new CollectionListItem(this, file);
+    CollectionListItem *item = new CollectionListItem(this, file, 0);
 
     if(!item->isValid()) {
         kError() << "CollectionList::createItem() -- A valid tag was not created for \""
@@ -201,90 +632,162 @@ void CollectionList::setupTreeViewEntries(ViewMode *viewMode) const
         treeViewMode->addItems(m_columnTags[column]->keys(), column);
 }
 
-void CollectionList::slotNewItems(const KFileItemList &items)
+bool CollectionList::getPolicy(Playlist::Policy p) const {
+    switch(p) {
+    case PolicyCanModifyContent: return true;
+    case PolicyCanRename:        return false;
+    case PolicyCanDelete:        return false;
+    case PolicyCanReload:        return true;
+    case PolicyPromptToSave:     return false;
+    default:                     return false;
+    }
+}
+
+void CollectionList::saveItemsToCache()
 {
-    QStringList files;
+    kDebug() << "Saving collection list to cache";
+
+    Cache *cache = Cache::instance();
 
-    for(KFileItemList::ConstIterator it = items.constBegin(); it != items.constEnd(); ++it)
-        files.append((*it).url().path());
+    m_journalTimer->stop();
+    slotWriteJournal();
+    m_journalEnabled = false;
 
-    addFiles(files);
-    update();
+    // Let a background write that's already underway finish.
+
+    delete m_cacheSnapshot;
+    m_cacheSnapshot = 0;
+
+    if(m_cacheWriter) {
+        m_cacheWriter->waitForFinished();
+        slotCacheWritten();
+    }
+
+    // The journal has everything else, unless the cache file is still in an
+    // older format.
+
+    if(cache->isCacheFileCurrent())
+        return;
+
+    CachedTrackList tracks;
+    tracks.reserve(m_itemsDict.count());
+
+    foreach(const CollectionListItem *item, m_itemsDict)
+        tracks.append(item->cachedTrack());
+
+    const qint64 journalSize = cache->journal()->size();
+
+    if(Cache::writeCacheFile(Cache::cacheFileName(), tracks)) {
+        cache->setCacheFileCurrent(true);
+        cache->journal()->discardBefore(journalSize);
+    }
 }
 
-void CollectionList::slotRefreshItems(const QList<QPair<KFileItem, KFileItem> > &items)
+void CollectionList::journalChange(const QString &file, CacheJournal::Operation operation)
 {
-    for(int i = 0; i < items.count(); ++i) {
-        const KFileItem fileItem = items[i].second;
-        CollectionListItem *item = lookup(fileItem.url().path());
+    if(!m_journalEnabled)
+        return;
+
+    // A new item that changes before the journal is written is still new.
 
-        if(item) {
-            item->refreshFromDisk();
+    if(operation == CacheJournal::Modify && m_journalPending.contains(file))
+        return;
 
-            // If the item is no longer on disk, remove it from the collection.
+    m_journalPending.insert(file, operation);
 
-            if(item->file().fileInfo().exists())
-                item->repaint();
-            else
-                delete item;
-        }
+    // The next folder scan has to look at the folder again to add the file
+    // back, as the scan before did.
+
+    if(operation == CacheJournal::Remove) {
+        m_folderManifest.invalidate(file.left(file.lastIndexOf('/')));
+        m_folderManifestDirty = true;
     }
 
-    update();
+    if(!m_journalTimer->isActive())
+        m_journalTimer->start();
 }
 
-void CollectionList::slotDeleteItem(const KFileItem &item)
+void CollectionList::slotFolderScanReady()
 {
-    delete lookup(item.url().path());
+    if(m_folderScan)
+        WorkScheduler::instance()->schedule(m_folderScan);
 }
 
-bool CollectionList::getPolicy(Playlist::Policy p) const {
-    switch(p) {
-    case PolicyCanModifyContent: return true;
-    case PolicyCanRename:        return false;
-    case PolicyCanDelete:        return false;
-    case PolicyCanReload:        return true;
-    case PolicyPromptToSave:     return false;
-    default:                     return false;
+void CollectionList::measureEstimatedTracks()
+{
+    if(m_propertiesMeasurer) {
+        m_measureAgain = true;
+        return;
     }
+
+    m_estimatedFiles.clear();
+
+    for(QHash<TrackPath, CollectionListItem *>::ConstIterator it = m_itemsDict.constBegin();
+        it != m_itemsDict.constEnd(); ++it)
+    {
+        if(it.value()->file().tag()->hasEstimatedProperties())
+            m_estimatedFiles.append(it.key().toString());
+    }
+
+    if(m_estimatedFiles.isEmpty())
+        return;
+
+    kDebug() << "Measuring the length of" << m_estimatedFiles.count() << "tracks";
+    measureNextProperties();
 }
 
-void CollectionList::saveItemsToCache() const
+void CollectionList::scanFolders(const QStringList &folders, bool full)
 {
-    kDebug() << "Saving collection list to cache";
+    if(!m_folderScan) {
+        m_folderScan = new FolderScanJob(this);
+        m_folderScanTime.start();
+    }
+
+    m_folderScan->addFolders(folders, full);
+    WorkScheduler::instance()->schedule(m_folderScan);
+}
 
-    QString cacheFileName =
-        KGlobal::dirs()->saveLocation("appdata") % QLatin1String("cache");
+ScanStatus CollectionList::folderScanStatus() const
+{
+    if(!m_folderScan)
+        return ScanStatus();
+
+    ScanStatus status = m_folderScan->status();
+    status.running = true;
+    status.elapsed = m_folderScanTime.elapsed();
 
-    KSaveFile f(cacheFileName);
+    return status;
+}
 
-    if(!f.open(QIODevice::WriteOnly)) {
-        kError() << "Error saving cache:" << f.errorString();
+void CollectionList::cancelFolderScan()
+{
+    if(!m_folderScan)
         return;
-    }
 
-    QByteArray data;
-    QDataStream s(&data, QIODevice::WriteOnly);
-    s.setVersion(QDataStream::Qt_4_3);
+    kDebug() << "Cancelling the folder scan after" << m_folderScanTime.elapsed() << "ms";
 
-    QHash<QString, CollectionListItem *>::const_iterator it;
-    for(it = m_itemsDict.begin(); it != m_itemsDict.end(); ++it) {
-        s << it.key();
-        s << (*it)->file();
-    }
+    // The job finishes on its next unit.
 
-    QDataStream fs(&f);
+    m_folderScan->cancel();
+    WorkScheduler::instance()->schedule(m_folderScan);
+}
 
-    qint32 checksum = qChecksum(data.data(), data.size());
+void CollectionList::setWatchingFolders(bool watch)
+{
+    m_folderWatcher->setEnabled(watch);
+}
 
-    fs << qint32(Cache::playlistItemsCacheVersion)
-       << checksum
-       << data;
+void CollectionList::updateWatchedFolders()
+{
+    const PlaylistCollection *collection = PlaylistCollection::instance();
+    QStringList folders;
 
-    f.close();
+    foreach(const QString &folder, m_folderManifest.folders()) {
+        if(collection->isManagedFolder(folder))
+            folders.append(folder);
+    }
 
-    if(!f.finalize())
-        kError() << "Error saving cache:" << f.errorString();
+    m_folderWatcher->setFolders(folders);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -312,32 +815,297 @@ void CollectionList::clear()
 
 void CollectionList::slotCheckCache()
 {
-    PlaylistItemList invalidItems;
-    kDebug() << "Starting to check cached items for consistency";
+    if(m_cacheVerifier)
+        return;
+
+    kDebug() << "Starting to check" << m_unverifiedFiles.count()
+             << "cached items for consistency";
     stopwatch.start();
 
-    int i = 0;
-    foreach(CollectionListItem *item, m_itemsDict) {
-        if(!item->checkCurrent())
-            invalidItems.append(item);
-        if(++i == (m_itemsDict.size() / 2))
-            kDebug() << "Checkpoint";
+    // Everything from the current cache file was already checked while it
+    // was decoded, and items that were read from disk since are current
+    // anyway.  Copy the fingerprints of the rest so that the worker threads
+    // don't have to touch any FileHandles.
+
+    QList<CachedTrackList> batches;
+    CachedTrackList batch;
+
+    foreach(const QString &file, m_unverifiedFiles) {
+        CollectionListItem *item = lookup(file);
+        if(!item)
+            continue;
+
+        batch.append(item->file().fingerprint());
+
+        if(batch.count() == cacheCheckBatchSize) {
+            batches.append(batch);
+            batch.clear();
+        }
+    }
+
+    if(!batch.isEmpty())
+        batches.append(batch);
+
+    m_unverifiedFiles.clear();
+
+    m_cacheVerifier = new QFutureWatcher<CacheCheckResult>(this);
+    connect(m_cacheVerifier, SIGNAL(finished()), SLOT(slotCacheVerified()));
+    m_cacheVerifier->setFuture(QtConcurrent::mapped(batches, CacheVerifier()));
+}
+
+void CollectionList::slotCacheVerified()
+{
+    const QList<CacheCheckResult> results = m_cacheVerifier->future().results();
+
+    m_cacheVerifier->deleteLater();
+    m_cacheVerifier = 0;
+
+    // Remove all of the missing items at once, which is a lot cheaper than
+    // one at a time.
+
+    PlaylistItemList missingItems;
+    QStringList changedFiles;
+
+    foreach(const CacheCheckResult &result, results) {
+        foreach(const QString &file, result.missingFiles) {
+            CollectionListItem *item = lookup(file);
+            if(item)
+                missingItems.append(item);
+        }
+
+        changedFiles += result.changedFiles;
+    }
+
+    kDebug() << missingItems.count() << "cached items are missing," << changedFiles.count()
+             << "changed";
+
+    clearItems(missingItems);
+
+    // The changed files are read on the thread pool like those that the
+    // folder watcher reports.
+
+    const QSet<QString> pendingFiles = m_changedFiles.toSet();
+
+    foreach(const QString &file, changedFiles) {
+        if(!pendingFiles.contains(file))
+            m_changedFiles.append(file);
     }
 
-    clearItems(invalidItems);
+    readNextChangedFiles();
 
     kDebug() << "Finished consistency check, took" << stopwatch.elapsed() << "ms";
+
+    // Pick up whatever a previous session didn't get to.
+
+    measureEstimatedTracks();
+}
+
+void CollectionList::slotPropertiesMeasured()
+{
+    const CachedTrackList tracks = m_propertiesMeasurer->result();
+
+    m_propertiesMeasurer->deleteLater();
+    m_propertiesMeasurer = 0;
+
+    foreach(const CachedTrack &track, tracks) {
+        CollectionListItem *item = lookup(track.path);
+        if(!item)
+            continue;
+
+        // A file that was edited or reread meanwhile has what it needs.
+
+        const FileHandle file = item->file();
+
+        if(!file.tag()->hasEstimatedProperties() ||
+           file.lastModified() != track.modificationTime)
+        {
+            continue;
+        }
+
+        file.tag()->setAudioProperties(track.seconds, track.bitrate);
+        item->refresh();
+    }
+
+    if(m_estimatedFiles.isEmpty() && m_measureAgain) {
+        m_measureAgain = false;
+        measureEstimatedTracks();
+    }
+    else
+        measureNextProperties();
+}
+
+void CollectionList::slotFoldersChanged(const QStringList &changedFiles,
+                                        const QStringList &removedPaths,
+                                        const QStringList &changedFolders)
+{
+    kDebug() << changedFiles.count() << "files changed," << removedPaths.count()
+             << "paths removed," << changedFolders.count() << "folders changed";
+
+    // Remove everything that went away at once, which is a lot cheaper than
+    // one at a time.  A file that is back by now was just replaced.
+
+    PlaylistItemList missingItems;
+    QStringList removedFiles;
+    FolderSet removedFolders;
+
+    foreach(const QString &path, removedPaths) {
+        if(lookup(path))
+            removedFiles.append(path);
+        else
+            removedFolders.insert(path);
+    }
+
+    // Only a removed folder needs a look at every item, and then that covers
+    // the removed files as well.
+
+    if(removedFolders.isEmpty()) {
+        foreach(const QString &file, removedFiles) {
+            if(!QFileInfo(file).exists())
+                missingItems.append(lookup(file));
+        }
+    }
+    else {
+        foreach(const QString &file, removedFiles)
+            removedFolders.insert(file);
+
+        for(QHash<TrackPath, CollectionListItem *>::ConstIterator it = m_itemsDict.constBegin();
+            it != m_itemsDict.constEnd(); ++it)
+        {
+            const QString path = it.key().toString();
+
+            if(removedFolders.contains(path) && !QFileInfo(path).exists())
+                missingItems.append(it.value());
+        }
+    }
+
+    clearItems(missingItems);
+
+    // Files that aren't in the collection yet are new, and the folder scan
+    // below finds those.
+
+    foreach(const QString &file, changedFiles) {
+        if(lookup(file) && !m_changedFiles.contains(file))
+            m_changedFiles.append(file);
+    }
+
+    readNextChangedFiles();
+
+    const PlaylistCollection *collection = PlaylistCollection::instance();
+    QStringList folders;
+
+    foreach(const QString &folder, changedFolders) {
+        const QString canonicalPath = QFileInfo(folder).canonicalFilePath();
+
+        if(!canonicalPath.isEmpty() && collection->isManagedFolder(canonicalPath))
+            folders.append(canonicalPath);
+    }
+
+    if(!folders.isEmpty())
+        scanFolders(folders);
+}
+
+void CollectionList::slotChangedFilesRead()
+{
+    const QList<CachedTrack> tracks = m_changedReader->future().results();
+
+    m_changedReader->deleteLater();
+    m_changedReader = 0;
+
+    bool estimated = false;
+
+    foreach(const CachedTrack &track, tracks) {
+        CollectionListItem *item = lookup(track.path);
+        if(!item)
+            continue;
+
+        FileHandle file = item->file();
+        file.refresh(track);
+        item->refresh();
+
+        estimated = estimated || track.estimatedProperties;
+    }
+
+    if(estimated)
+        measureEstimatedTracks();
+
+    readNextChangedFiles();
 }
 
 void CollectionList::slotRemoveItem(const QString &file)
 {
-    delete m_itemsDict[file];
+    delete lookup(file);
 }
 
 void CollectionList::slotRefreshItem(const QString &file)
 {
-    if(m_itemsDict[file])
-        m_itemsDict[file]->refresh();
+    CollectionListItem *item = lookup(file);
+
+    if(item)
+        item->refresh();
+}
+
+void CollectionList::slotWriteJournal()
+{
+    Cache *cache = Cache::instance();
+    CacheJournal *journal = cache->journal();
+
+    for(QHash<QString, CacheJournal::Operation>::ConstIterator it = m_journalPending.constBegin();
+        it != m_journalPending.constEnd(); ++it)
+    {
+        const CollectionListItem *item = lookup(it.key());
+
+        if(it.value() == CacheJournal::Remove || !item) {
+            CachedTrack track;
+            track.path = it.key();
+            journal->append(CacheJournal::Remove, track);
+        }
+        else
+            journal->append(it.value(), item->cachedTrack());
+    }
+
+    m_journalPending.clear();
+    journal->flush();
+
+    // Only once the items it vouches for are in the journal.
+
+    if(m_folderManifestDirty) {
+        m_folderManifest.save(Cache::folderManifestFileName());
+        m_folderManifestDirty = false;
+    }
+
+    if(!m_journalEnabled || m_cacheSnapshot || m_cacheWriter)
+        return;
+
+    // Fold the journal into the cache file once it has grown to a fair part
+    // of it, so that replaying it stays cheap.
+
+    const qint64 cacheSize = QFileInfo(Cache::cacheFileName()).size();
+
+    if(!cache->isCacheFileCurrent() ||
+       journal->size() > qMax(journalCompactionSize, cacheSize / 4))
+    {
+        kDebug() << "Compacting the cache journal," << journal->size() << "bytes";
+
+        m_compactionOffset = journal->size();
+        m_cacheSnapshot = new CacheSnapshotJob(this, itemPaths());
+        WorkScheduler::instance()->schedule(m_cacheSnapshot);
+    }
+}
+
+void CollectionList::slotCacheWritten()
+{
+    const bool written = m_cacheWriter->result();
+
+    m_cacheWriter->deleteLater();
+    m_cacheWriter = 0;
+
+    if(!written)
+        return;
+
+    // Anything journaled since the snapshot was started stays.
+
+    Cache::instance()->setCacheFileCurrent(true);
+    Cache::instance()->journal()->discardBefore(m_compactionOffset);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -346,8 +1114,30 @@ void CollectionList::slotRefreshItem(const QString &file)
 
 CollectionList::CollectionList(PlaylistCollection *collection) :
     Playlist(collection, true),
-    m_columnTags(15, 0)
+    m_columnTags(15, 0),
+    m_cacheDecoder(0),
+    m_cachedItemsLoader(0),
+    m_cacheVerifier(0),
+    m_folderScan(0),
+    m_propertiesMeasurer(0),
+    m_measureAgain(false),
+    m_folderManifestDirty(false),
+    m_folderWatcher(new FolderWatcher(this)),
+    m_changedReader(0),
+    m_cacheSnapshot(0),
+    m_cacheWriter(0),
+    m_compactionOffset(0),
+    m_journalEnabled(true),
+    m_nextId(1)
 {
+    m_journalTimer = new QTimer(this);
+    m_journalTimer->setSingleShot(true);
+    m_journalTimer->setInterval(journalInterval);
+    connect(m_journalTimer, SIGNAL(timeout()), SLOT(slotWriteJournal()));
+
+    connect(m_folderWatcher, SIGNAL(signalChanged(QStringList,QStringList,QStringList)),
+            SLOT(slotFoldersChanged(QStringList,QStringList,QStringList)));
+
     QAction *spaction = ActionCollection::actions()->addAction("showPlaying");
     spaction->setText(i18n("Show Playing"));
     connect(spaction, SIGNAL(triggered(bool)), SLOT(slotShowPlaying()));
@@ -373,6 +1163,38 @@ CollectionList::~CollectionList()
     config.writeEntry("CollectionListSortColumn", sortColumn());
     config.writeEntry("CollectionListSortAscending", sortOrder() == Qt::AscendingOrder);
 
+    // Removing the items below is not a change to the collection.
+
+    m_journalEnabled = false;
+
+    // Don't pull the cache out from under the worker threads.
+
+    if(m_cacheDecoder) {
+        m_cacheDecoder->cancel();
+        m_cacheDecoder->waitForFinished();
+        Cache::instance()->finishLoadingCachedItems();
+    }
+
+    if(m_cacheVerifier) {
+        m_cacheVerifier->cancel();
+        m_cacheVerifier->waitForFinished();
+    }
+
+    if(m_propertiesMeasurer)
+        m_propertiesMeasurer->waitForFinished();
+
+    if(m_changedReader) {
+        m_changedReader->cancel();
+        m_changedReader->waitForFinished();
+    }
+
+    delete m_cachedItemsLoader;
+    delete m_folderScan;
+    delete m_cacheSnapshot;
+
+    if(m_cacheWriter)
+        m_cacheWriter->waitForFinished();
+
     // The CollectionListItems will try to remove themselves from the
     // m_columnTags member, so we must make sure they're gone before we
     // are.
@@ -447,7 +1269,19 @@ QStringList CollectionList::uniqueSet(UniqueSetType t) const
 
 CollectionListItem *CollectionList::lookup(const QString &file) const
 {
-    return m_itemsDict.value(file, 0);
+    // find() doesn't add the folder of a path that no track is in.
+
+    return m_itemsDict.value(TrackPath::find(file), 0);
+}
+
+CollectionListItem *CollectionList::lookupById(quint32 id) const
+{
+    return m_itemsById.value(id, 0);
+}
+
+CollectionListItem *CollectionList::lookupByIdentity(const FileIdentity &identity) const
+{
+    return identity.isNull() ? 0 : m_itemsByIdentity.value(identity, 0);
 }
 
 void CollectionList::removeStringFromDict(const QString &value, int column)
@@ -470,14 +1304,144 @@ void CollectionList::removeStringFromDict(const QString &value, int column)
     }
 }
 
-void CollectionList::addWatched(const QString &file)
+void CollectionList::addToDict(const QString &file, CollectionListItem *item)
+{
+    m_itemsDict.insert(TrackPath(file), item);
+    journalChange(file, CacheJournal::Add);
+}
+
+void CollectionList::removeFromDict(const QString &file)
+{
+    m_itemsDict.remove(TrackPath::find(file));
+    journalChange(file, CacheJournal::Remove);
+}
+
+QStringList CollectionList::itemPaths() const
+{
+    QStringList paths;
+    paths.reserve(m_itemsDict.count());
+
+    for(QHash<TrackPath, CollectionListItem *>::ConstIterator it = m_itemsDict.constBegin();
+        it != m_itemsDict.constEnd(); ++it)
+    {
+        paths.append(it.key().toString());
+    }
+
+    return paths;
+}
+
+quint32 CollectionList::addToIdDict(CollectionListItem *item, quint32 id)
+{
+    // Ids are never reused within a session, and one that is already taken
+    // means that the cache and the journal disagree, so don't trust it.
+
+    if(id == 0 || m_itemsById.contains(id))
+        id = m_nextId;
+
+    m_nextId = qMax(m_nextId, id + 1);
+    m_itemsById.insert(id, item);
+
+    return id;
+}
+
+void CollectionList::removeFromIdDict(quint32 id)
+{
+    m_itemsById.remove(id);
+}
+
+void CollectionList::updateIdentityDict(CollectionListItem *item,
+                                        const FileIdentity &oldIdentity,
+                                        const FileIdentity &newIdentity)
+{
+    // Another item may have taken over the old identity, e.g. a hard link to
+    // the same file.
+
+    if(!oldIdentity.isNull() && m_itemsByIdentity.value(oldIdentity) == item)
+        m_itemsByIdentity.remove(oldIdentity);
+
+    if(!newIdentity.isNull())
+        m_itemsByIdentity.insert(newIdentity, item);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// private methods
+////////////////////////////////////////////////////////////////////////////////
+
+void CollectionList::addCachedItem(const FileHandle &file, quint32 id)
+{
+    // This may have already been created via a loaded playlist.
+    if(!m_itemsDict.contains(file.trackPath())) {
+
+        // The cache already knows about it.
+        const bool journalEnabled = m_journalEnabled;
+        m_journalEnabled = false;
+
+        CollectionListItem *newItem = new CollectionListItem(this, file, id);
+        setupItem(newItem);
+
+        m_journalEnabled = journalEnabled;
+    }
+}
+
+void CollectionList::completedCacheSnapshot(const CachedTrackList &tracks)
 {
-    m_dirWatch->addFile(file);
+    delete m_cacheSnapshot;
+    m_cacheSnapshot = 0;
+
+    m_cacheWriter = new QFutureWatcher<bool>(this);
+    connect(m_cacheWriter, SIGNAL(finished()), SLOT(slotCacheWritten()));
+    m_cacheWriter->setFuture(QtConcurrent::run(&Cache::writeCacheFile,
+                                               Cache::cacheFileName(), tracks));
+}
+
+void CollectionList::measureNextProperties()
+{
+    if(m_estimatedFiles.isEmpty())
+        return;
+
+    const QStringList batch = m_estimatedFiles.mid(0, measureBatchSize);
+    m_estimatedFiles = m_estimatedFiles.mid(batch.count());
+
+    m_propertiesMeasurer = new QFutureWatcher<CachedTrackList>(this);
+    connect(m_propertiesMeasurer, SIGNAL(finished()), SLOT(slotPropertiesMeasured()));
+    m_propertiesMeasurer->setFuture(QtConcurrent::run(&measureProperties, batch));
+}
+
+void CollectionList::readNextChangedFiles()
+{
+    if(m_changedReader || m_changedFiles.isEmpty())
+        return;
+
+    const QStringList batch = m_changedFiles.mid(0, changedFilesBatchSize);
+    m_changedFiles = m_changedFiles.mid(batch.count());
+
+    const TrackReader reader(PlaylistCollection::instance()->fastTagScan());
+
+    m_changedReader = new QFutureWatcher<CachedTrack>(this);
+    connect(m_changedReader, SIGNAL(finished()), SLOT(slotChangedFilesRead()));
+    m_changedReader->setFuture(QtConcurrent::mapped(batch, reader));
 }
 
-void CollectionList::removeWatched(const QString &file)
+void CollectionList::completedFolderScan()
 {
-    m_dirWatch->removeFile(file);
+    delete m_folderScan;
+    m_folderScan = 0;
+
+    slotWeightDirty();
+    dataChanged();
+
+    kDebug() << "Folder scan complete, took" << m_folderScanTime.elapsed() << "ms";
+    debugStringPool("tag value", StringPool::instance()->statistics());
+    debugStringPool("sort key", m_trackTable.sortKeyStatistics());
+
+    if(m_folderManifestDirty && !m_journalTimer->isActive())
+        m_journalTimer->start();
+
+    updateWatchedFolders();
+
+    measureEstimatedTracks();
+
+    emit signalFolderScanFinished();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -486,39 +1450,42 @@ void CollectionList::removeWatched(const QString &file)
 
 void CollectionListItem::refresh()
 {
-    int columns = lastColumn() + 1;
+    CollectionList::instance()->journalChange(file().absFilePath(), CacheJournal::Modify);
 
-    data()->metadata.resize(columns);
-    data()->cachedWidths.resize(columns);
+    const FileIdentity identity = file().identity();
 
-    for(int id = 0; id < columns; id++) {
-        if(id != TrackNumberColumn && id != LengthColumn) {
-            // All columns other than track num and length need local-encoded data for sorting
+    if(identity != m_identity) {
+        CollectionList::instance()->updateIdentityDict(this, m_identity, identity);
+        m_identity = identity;
+    }
 
-            QString toLower = text(id).toLower();
+    TrackTable &table = CollectionList::instance()->m_trackTable;
 
-            // For some columns, we may be able to share some strings
+    const QString oldArtist = table.text(m_row, ArtistColumn);
+    const QString oldAlbum = table.text(m_row, AlbumColumn);
+    const QString oldGenre = table.text(m_row, GenreColumn);
 
-            if((id == ArtistColumn) || (id == AlbumColumn) ||
-               (id == GenreColumn)  || (id == YearColumn)  ||
-               (id == CommentColumn))
-            {
-                toLower = StringShare::tryShare(toLower);
+    table.update(m_row, file());
 
-                if(id != YearColumn && id != CommentColumn && data()->metadata[id] != toLower) {
-                    CollectionList::instance()->removeStringFromDict(data()->metadata[id], id);
-                    CollectionList::instance()->addStringToDict(text(id), id);
-                }
-            }
+    updateStringDict(oldArtist, ArtistColumn);
+    updateStringDict(oldAlbum, AlbumColumn);
+    updateStringDict(oldGenre, GenreColumn);
 
-            data()->metadata[id] = toLower;
+    int columns = lastColumn() + 1;
+
+    for(int id = 0; id < columns; id++) {
+        if(id != TrackNumberColumn && id != LengthColumn) {
+            // All columns other than track num and length are sorted by
+            // their collation key, which is made once here.
+
+            table.setSortKey(m_row, id, TrackTable::collationKey(text(id)));
         }
 
         int newWidth = width(listView()->fontMetrics(), listView(), id);
-        if(newWidth != data()->cachedWidths[id])
+        if(newWidth != table.width(m_row, id))
             playlist()->slotWeightDirty(id);
 
-        data()->cachedWidths[id] = newWidth;
+        table.setWidth(m_row, id, newWidth);
     }
 
     if(listView()->isVisible())
@@ -569,10 +1536,12 @@ void CollectionListItem::repaint() const
 // CollectionListItem protected methods
 ////////////////////////////////////////////////////////////////////////////////
 
-CollectionListItem::CollectionListItem(CollectionList *parent, const FileHandle &file) :
+CollectionListItem::CollectionListItem(CollectionList *parent, const FileHandle &file, quint32 id) :
     PlaylistItem(parent),
     m_shuttingDown(false)
 {
+    m_id = parent->addToIdDict(this, id);
+    m_row = parent->m_trackTable.insert(this);
     parent->addToDict(file.absFilePath(), this);
 
     data()->fileHandle = file;
@@ -597,13 +1566,27 @@ CollectionListItem::~CollectionListItem()
 
     CollectionList *l = CollectionList::instance();
     if(l) {
+        l->m_trackTable.remove(m_row);
+
         l->removeFromDict(file().absFilePath());
+        l->removeFromIdDict(m_id);
+        l->updateIdentityDict(this, m_identity, FileIdentity());
         l->removeStringFromDict(file().tag()->album(), AlbumColumn);
         l->removeStringFromDict(file().tag()->artist(), ArtistColumn);
         l->removeStringFromDict(file().tag()->genre(), GenreColumn);
     }
 }
 
+void CollectionListItem::updateStringDict(const QString &oldValue, int column)
+{
+    const QString value = CollectionList::instance()->m_trackTable.text(m_row, column);
+
+    if(value != oldValue) {
+        CollectionList::instance()->removeStringFromDict(oldValue, column);
+        CollectionList::instance()->addStringToDict(value, column);
+    }
+}
+
 void CollectionListItem::addChildItem(PlaylistItem *child)
 {
     m_children.append(child);
@@ -615,6 +1598,13 @@ void CollectionListItem::removeChildItem(PlaylistItem *child)
         m_children.removeAll(child);
 }
 
+CachedTrack CollectionListItem::cachedTrack() const
+{
+    CachedTrack track = file().cachedTrack();
+    track.id = m_id;
+    return track;
+}
+
 bool CollectionListItem::checkCurrent()
 {
     if(!file().fileInfo().exists() || !file().fileInfo().isFile())
@@ -19,14 +19,24 @@
 
 #include <QHash>
 #include <QVector>
+#include <QFutureWatcher>
+#include <QTime>
 
 #include "playlist.h"
 #include "playlistitem.h"
+#include "cachefile.h"
+#include "foldermanifest.h"
+#include "tracktable.h"
+#include "trackpath.h"
 
 class ViewMode;
-class KFileItem;
-class KFileItemList;
-class KDirWatch;
+class FolderWatcher;
+class CachedItemsLoader;
+class FolderScanJob;
+class CacheSnapshotJob;
+struct CacheCheckResult;
+struct ScanStatus;
+class QTimer;
 
 /**
  * This type is for mapping QString track attributes like the album, artist
@@ -69,13 +79,40 @@ public:
     void repaint() const;
     PlaylistItemList children() const { return m_children; }
 
+    /**
+     * A number that identifies the item for as long as it is in the
+     * collection, even across sessions, as it is stored in the cache.
+     */
+    quint32 id() const { return m_id; }
+
+    /**
+     * The row of the item in CollectionList::trackTable().
+     */
+    TrackTable::Row row() const { return m_row; }
+
+    /**
+     * @return the information that is stored in the collection cache for
+     * this item.
+     */
+    CachedTrack cachedTrack() const;
+
 protected:
-    CollectionListItem(CollectionList *parent, const FileHandle &file);
+    /**
+     * Creates the item with the given id, as read from the cache, or with a
+     * new one if \a id is 0.
+     */
+    CollectionListItem(CollectionList *parent, const FileHandle &file, quint32 id);
     virtual ~CollectionListItem();
 
     void addChildItem(PlaylistItem *child);
     void removeChildItem(PlaylistItem *child);
 
+    /**
+     * Moves the item's count in the CollectionList's \a column dictionary
+     * from \a oldValue to its current value.
+     */
+    void updateStringDict(const QString &oldValue, int column);
+
     /**
      * Returns true if the item is now up to date (even if this required a refresh) or
      * false if the item is invalid.
@@ -86,12 +123,18 @@ protected:
 
 private:
     bool m_shuttingDown;
+    quint32 m_id;
+    TrackTable::Row m_row;
+    FileIdentity m_identity; ///< As registered with the CollectionList.
     PlaylistItemList m_children;
 };
 
 class CollectionList : public Playlist
 {
     friend class CollectionListItem;
+    friend class CachedItemsLoader;
+    friend class FolderScanJob;
+    friend class CacheSnapshotJob;
 
     Q_OBJECT
 
@@ -114,6 +157,23 @@ public:
 
     CollectionListItem *lookup(const QString &file) const;
 
+    /**
+     * Returns the item with the given CollectionListItem::id(), or 0.
+     */
+    CollectionListItem *lookupById(quint32 id) const;
+
+    /**
+     * Returns the item for the file with the given FileHandle::identity(),
+     * whatever path it was reached by, or 0.  Only items whose identity is
+     * known can be found this way.
+     */
+    CollectionListItem *lookupByIdentity(const FileIdentity &identity) const;
+
+    /**
+     * The tag columns, sort keys and widths of every item, see TrackTable.
+     */
+    const TrackTable &trackTable() const { return m_trackTable; }
+
     virtual CollectionListItem *createItem(const FileHandle &file,
                                      Q3ListViewItem * = 0,
                                      bool = false);
@@ -126,7 +186,53 @@ public:
 
     virtual bool getPolicy(Policy p) const;
 
-    void saveItemsToCache() const;
+    /**
+     * Brings the cache up to date on shutdown.  Usually that only means
+     * writing the last changes to the journal.
+     */
+    void saveItemsToCache();
+
+    /**
+     * Adds everything below \a folders to the collection in the background.
+     * signalFolderScanFinished() is emitted once all of them have been
+     * scanned, including any folders added while the scan was running.
+     *
+     * Folders that haven't changed since the last scan aren't listed again,
+     * see FolderManifest, unless \a full is set.
+     */
+    void scanFolders(const QStringList &folders, bool full = false);
+
+    /**
+     * The progress of the folder scan started by scanFolders(), or a status
+     * that isn't running if there is none.
+     */
+    ScanStatus folderScanStatus() const;
+
+    /**
+     * Stops the folder scan, if there is one.  signalFolderScanFinished() is
+     * emitted as usual.
+     */
+    void cancelFolderScan();
+
+    /**
+     * Replaces the estimated lengths of the tracks read with
+     * PlaylistCollection::fastTagScan() by exact ones, a few files at a time
+     * on an idle priority thread.  Tracks that are added while this runs are
+     * picked up afterwards.
+     */
+    void measureEstimatedTracks();
+
+    /**
+     * Turns watching the music folders for changes on or off.  Changes that
+     * happen while it is off are only picked up by the next folder scan.
+     */
+    void setWatchingFolders(bool watch);
+
+    /**
+     * Watches every folder the last folder scans went through, as far as it
+     * is still below the music folders and not excluded.
+     */
+    void updateWatchedFolders();
 
 public slots:
     virtual void paste();
@@ -136,10 +242,6 @@ public slots:
     void slotRemoveItem(const QString &file);
     void slotRefreshItem(const QString &file);
 
-    void slotNewItems(const KFileItemList &items);
-    void slotRefreshItems(const QList<QPair<KFileItem, KFileItem> > &items);
-    void slotDeleteItem(const KFileItem &item);
-
 protected:
     CollectionList(PlaylistCollection *collection);
     virtual ~CollectionList();
@@ -149,8 +251,33 @@ protected:
 
     // These methods are used by CollectionListItem, which is a friend class.
 
-    void addToDict(const QString &file, CollectionListItem *item) { m_itemsDict.insert(file, item); }
-    void removeFromDict(const QString &file) { m_itemsDict.remove(file); }
+    void addToDict(const QString &file, CollectionListItem *item);
+    void removeFromDict(const QString &file);
+
+    /**
+     * The paths of all of the items, spelled out.
+     */
+    QStringList itemPaths() const;
+
+    /**
+     * Registers \a item under \a id, or under a new id if that is 0 or
+     * already taken.  Returns the id that was used.
+     */
+    quint32 addToIdDict(CollectionListItem *item, quint32 id);
+    void removeFromIdDict(quint32 id);
+
+    /**
+     * Moves \a item from \a oldIdentity to \a newIdentity, either of which
+     * may be null.
+     */
+    void updateIdentityDict(CollectionListItem *item, const FileIdentity &oldIdentity,
+                            const FileIdentity &newIdentity);
+
+    /**
+     * Queues a change to \a file for the cache journal.  Changes are
+     * collected for a moment and then written in one go.
+     */
+    void journalChange(const QString &file, CacheJournal::Operation operation);
 
     // These methods are also used by CollectionListItem, to manage the
     // strings used in generating the unique sets and tree view mode playlists.
@@ -181,10 +308,10 @@ protected:
      */
     void removeStringFromDict(const QString &value, int column);
 
-    void addWatched(const QString &file);
-    void removeWatched(const QString &file);
-
-    virtual bool hasItem(const QString &file) const { return m_itemsDict.contains(file); }
+    /**
+     * Every CollectionListItem is in the collection.
+     */
+    virtual bool hasItem(const CollectionListItem *item) const { return item != 0; }
 
 signals:
     void signalCollectionChanged();
@@ -204,6 +331,14 @@ signals:
     // and invalid track detection to proceed.
     void cachedItemsLoaded();
 
+    /**
+     * Emitted as a folder scan progresses, with the number of files read so
+     * far and the number of new files found so far.
+     */
+    void signalFolderScanProgress(int read, int found);
+
+    void signalFolderScanFinished();
+
 public slots:
     /**
      * Loads the CollectionListItems from the Cache.  Should be called after program
@@ -212,10 +347,45 @@ public slots:
     void startLoadingCachedItems();
 
     /**
-     * Loads a few items at a time. Intended to be single-shotted into the event
-     * loop so that loading the music doesn't freeze the GUI.
+     * Hands one chunk of the cache to the item loader as soon as a worker
+     * thread has decoded it.
      */
-    void loadNextBatchCachedItems();
+    void slotCachedChunkDecoded(int index);
+    void slotCacheDecoded();
+
+    /**
+     * Wakes the folder scan up when its ScanPipeline has tracks for it.
+     */
+    void slotFolderScanReady();
+
+    /**
+     * Writes the queued changes to the cache journal, and starts compacting
+     * the journal into the cache file once it has grown large enough.
+     */
+    void slotWriteJournal();
+    void slotCacheWritten();
+
+    /**
+     * Applies the results of the consistency check started by
+     * slotCheckCache().
+     */
+    void slotCacheVerified();
+
+    /**
+     * Applies a batch of exact lengths from measureEstimatedTracks() and
+     * starts on the next one.
+     */
+    void slotPropertiesMeasured();
+
+    /**
+     * Applies a batch of changes reported by the FolderWatcher: removes the
+     * items that are gone, rereads the changed files on worker threads and
+     * scans the changed folders for new files.
+     */
+    void slotFoldersChanged(const QStringList &changedFiles,
+                            const QStringList &removedPaths,
+                            const QStringList &changedFolders);
+    void slotChangedFilesRead();
 
     /**
      * Teardown from cache loading (e.g. splash screen, sorting, etc.). Should
@@ -224,6 +394,14 @@ public slots:
     void completedLoadingCachedItems();
 
 private:
+    // These are used by the scheduled jobs, which are friend classes.
+
+    void addCachedItem(const FileHandle &file, quint32 id = 0);
+    void completedCacheSnapshot(const CachedTrackList &tracks);
+    void completedFolderScan();
+    void measureNextProperties();
+    void readNextChangedFiles();
+
     /**
      * Just the size of the above enum to keep from hard coding it in several
      * locations.
@@ -231,9 +409,44 @@ private:
     static const int m_uniqueSetCount = 3;
 
     static CollectionList *m_list;
-    QHash<QString, CollectionListItem *> m_itemsDict;
-    KDirWatch *m_dirWatch;
+    QHash<TrackPath, CollectionListItem *> m_itemsDict;
     TagCountDicts m_columnTags;
+    QFutureWatcher<CachedTrackChunk> *m_cacheDecoder;
+    CachedItemsLoader *m_cachedItemsLoader;
+    QFutureWatcher<CacheCheckResult> *m_cacheVerifier;
+
+    /**
+     * Items loaded without being checked against the disk, which
+     * slotCheckCache() still has to do.
+     */
+    QStringList m_unverifiedFiles;
+
+    FolderScanJob *m_folderScan;
+    QTime m_folderScanTime;
+
+    QFutureWatcher<CachedTrackList> *m_propertiesMeasurer;
+    QStringList m_estimatedFiles; ///< Still to be measured.
+    bool m_measureAgain;          ///< Tracks were added while measuring.
+
+    FolderManifest m_folderManifest;
+    bool m_folderManifestDirty;
+
+    FolderWatcher *m_folderWatcher;
+    QFutureWatcher<CachedTrack> *m_changedReader;
+    QStringList m_changedFiles; ///< Still to be read.
+
+    QHash<QString, CacheJournal::Operation> m_journalPending;
+    QTimer *m_journalTimer;
+    CacheSnapshotJob *m_cacheSnapshot;
+    QFutureWatcher<bool> *m_cacheWriter;
+    qint64 m_compactionOffset;
+    bool m_journalEnabled;
+
+    QHash<quint32, CollectionListItem *> m_itemsById;
+    QHash<FileIdentity, CollectionListItem *> m_itemsByIdentity;
+    quint32 m_nextId;
+
+    TrackTable m_trackTable;
 };
 
 #endif
@@ -35,18 +35,9 @@
 #include <QDesktopWidget>
 #include <QImage>
 #include <QScopedPointer>
+#include <QCache>
 
-#include <taglib/mpegfile.h>
-#include <taglib/tstring.h>
-#include <taglib/id3v2tag.h>
-#include <taglib/attachedpictureframe.h>
-
-#ifdef TAGLIB_WITH_MP4
-#include <taglib/mp4coverart.h>
-#include <taglib/mp4file.h>
-#include <taglib/mp4tag.h>
-#include <taglib/mp4item.h>
-#endif
+#include <tfile.h>
 
 #include "mediafiles.h"
 #include "collectionlist.h"
@@ -54,6 +45,10 @@
 #include "playlistitem.h"
 #include "tag.h"
 
+// The number of thumbnails of embedded covers kept decoded.
+
+static const int thumbnailCacheSize = 100;
+
 struct CoverPopup : public QWidget
 {
     CoverPopup(const QPixmap &image, const QPoint &p) :
@@ -257,10 +252,7 @@ QPixmap CoverInfo::pixmap(CoverSize size) const
 
         if (cover.isNull()) {
             // If we get here, see if there is an embedded cover.
-            cover = embeddedAlbumArt();
-            if(!cover.isNull() && size == Thumbnail) {
-                cover = scaleCoverToThumbnail(cover);
-            }
+            cover = size == Thumbnail ? embeddedThumbnail() : embeddedAlbumArt();
         }
     }
 
@@ -300,118 +292,20 @@ QString CoverInfo::localPathToCover(const QString &fallbackFileName) const
 
 bool CoverInfo::hasEmbeddedAlbumArt() const
 {
-    QScopedPointer<TagLib::File> fileTag(
-            MediaFiles::fileFactoryByType(m_file.absFilePath()));
+    Tag *tag = m_file.tag();
 
-    if (TagLib::MPEG::File *mpegFile =
-            dynamic_cast<TagLib::MPEG::File *>(fileTag.data()))
-    {
-        TagLib::ID3v2::Tag *id3tag = mpegFile->ID3v2Tag(false);
+    // Known since the file was read, unless it came from an older cache.
 
-        if (!id3tag) {
-            kError() << m_file.absFilePath() << "seems to have invalid ID3 tag";
-            return false;
-        }
+    if(!tag->isEmbeddedArtKnown()) {
+        QScopedPointer<TagLib::File> fileTag(
+                MediaFiles::fileFactoryByType(m_file.absFilePath()));
 
-        // Look for attached picture frames.
-        TagLib::ID3v2::FrameList frames = id3tag->frameListMap()["APIC"];
-        return !frames.isEmpty();
+        tag->setEmbeddedArt(fileTag ? MediaFiles::embeddedArt(fileTag.data()) : QByteArray());
     }
-#ifdef TAGLIB_WITH_MP4
-    else if(TagLib::MP4::File *mp4File =
-            dynamic_cast<TagLib::MP4::File *>(fileTag.data()))
-    {
-        TagLib::MP4::Tag *tag = mp4File->tag();
-        if (tag) {
-            TagLib::MP4::ItemListMap &items = tag->itemListMap();
-            return items.contains("covr");
-        }
-    }
-#endif
 
-    return false;
+    return tag->hasEmbeddedArt();
 }
 
-static QImage embeddedMPEGAlbumArt(TagLib::ID3v2::Tag *id3tag)
-{
-    if(!id3tag)
-        return QImage();
-
-    // Look for attached picture frames.
-    TagLib::ID3v2::FrameList frames = id3tag->frameListMap()["APIC"];
-
-    if(frames.isEmpty())
-        return QImage();
-
-    // According to the spec attached picture frames have different types.
-    // So we should look for the corresponding picture depending on what
-    // type of image (i.e. front cover, file info) we want.  If only 1
-    // frame, just return that (scaled if necessary).
-
-    TagLib::ID3v2::AttachedPictureFrame *selectedFrame = 0;
-
-    if(frames.size() != 1) {
-        TagLib::ID3v2::FrameList::Iterator it = frames.begin();
-        for(; it != frames.end(); ++it) {
-
-            // This must be dynamic_cast<>, TagLib will return UnknownFrame in APIC for
-            // encrypted frames.
-            TagLib::ID3v2::AttachedPictureFrame *frame =
-                dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(*it);
-
-            // Both thumbnail and full size should use FrontCover, as
-            // FileIcon may be too small even for thumbnail.
-            if(frame && frame->type() != TagLib::ID3v2::AttachedPictureFrame::FrontCover)
-                continue;
-
-            selectedFrame = frame;
-            break;
-        }
-    }
-
-    // If we get here we failed to pick a picture, or there was only one,
-    // so just use the first picture.
-
-    if(!selectedFrame)
-        selectedFrame = dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(frames.front());
-
-    if(!selectedFrame) // Could occur for encrypted picture frames.
-        return QImage();
-
-    TagLib::ByteVector picture = selectedFrame->picture();
-    return QImage::fromData(
-            reinterpret_cast<const uchar *>(picture.data()),
-            picture.size());
-}
-
-#ifdef TAGLIB_WITH_MP4
-static QImage embeddedMP4AlbumArt(TagLib::MP4::Tag *tag)
-{
-    TagLib::MP4::ItemListMap &items = tag->itemListMap();
-
-    if(!items.contains("covr"))
-        return QImage();
-
-    TagLib::MP4::CoverArtList covers = items["covr"].toCoverArtList();
-    TagLib::MP4::CoverArtList::ConstIterator end = covers.end();
-
-    for(TagLib::MP4::CoverArtList::ConstIterator it = covers.begin(); it != end; ++it) {
-        TagLib::MP4::CoverArt cover = *it;
-        TagLib::ByteVector coverData = cover.data();
-
-        QImage result = QImage::fromData(
-                reinterpret_cast<const uchar *>(coverData.data()),
-                coverData.size());
-
-        if(!result.isNull())
-            return result;
-    }
-
-    // No appropriate image found
-    return QImage();
-}
-#endif
-
 void CoverInfo::popup() const
 {
     QPixmap image = pixmap(FullSize);
@@ -447,24 +341,39 @@ QImage CoverInfo::embeddedAlbumArt() const
     QScopedPointer<TagLib::File> fileTag(
             MediaFiles::fileFactoryByType(m_file.absFilePath()));
 
-    if (TagLib::MPEG::File *mpegFile =
-            dynamic_cast<TagLib::MPEG::File *>(fileTag.data()))
-    {
-        TagLib::ID3v2::Tag *id3tag = mpegFile->ID3v2Tag(false);
-        return embeddedMPEGAlbumArt(id3tag);
-    }
-#ifdef TAGLIB_WITH_MP4
-    else if(TagLib::MP4::File *mp4File =
-            dynamic_cast<TagLib::MP4::File *>(fileTag.data()))
-    {
-        TagLib::MP4::Tag *tag = mp4File->tag();
-        if (tag) {
-            return embeddedMP4AlbumArt(tag);
-        }
+    if(!fileTag)
+        return QImage();
+
+    const QByteArray picture = MediaFiles::embeddedArt(fileTag.data());
+    return QImage::fromData(picture);
+}
+
+QImage CoverInfo::embeddedThumbnail() const
+{
+    // The tracks of an album usually carry the same picture, which is only
+    // decoded and scaled once by going by its checksum.
+
+    static QCache<quint32, QImage> thumbnails(thumbnailCacheSize);
+
+    const Tag *tag = m_file.tag();
+    const bool known = tag->isEmbeddedArtKnown() && tag->hasEmbeddedArt();
+
+    if(known) {
+        if(const QImage *thumbnail = thumbnails.object(tag->embeddedArtHash()))
+            return *thumbnail;
     }
-#endif
 
-    return QImage();
+    QImage thumbnail = embeddedAlbumArt();
+
+    if(thumbnail.isNull())
+        return thumbnail;
+
+    thumbnail = scaleCoverToThumbnail(thumbnail);
+
+    if(known)
+        thumbnails.insert(tag->embeddedArtHash(), new QImage(thumbnail));
+
+    return thumbnail;
 }
 
 QImage CoverInfo::scaleCoverToThumbnail(const QImage &image) const
@@ -82,6 +82,7 @@ private:
     // Not supported for all file types as we must build on top of TagLib
     // support.
     QImage embeddedAlbumArt() const;
+    QImage embeddedThumbnail() const;
 
     bool hasEmbeddedAlbumArt() const;
 
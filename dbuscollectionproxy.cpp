@@ -30,6 +30,7 @@
 #include "collectionlist.h"
 #include "coverinfo.h"
 #include "filehandle.h"
+#include "scanpipeline.h"
 
 DBusCollectionProxy::DBusCollectionProxy (QObject *parent, PlaylistCollection *collection) :
     QObject(parent), m_collection(collection)
@@ -155,4 +156,31 @@ QString DBusCollectionProxy::trackCover(const QString &track)
     return tempFile.fileName();
 }
 
+QVariantMap DBusCollectionProxy::scanStatus()
+{
+    const ScanStatus status = m_collection->folderScanStatus();
+    QVariantMap map;
+
+    map["running"]          = status.running;
+    map["walking"]          = status.walking;
+    map["foldersVisited"]   = status.foldersVisited;
+    map["filesFound"]       = status.filesFound;
+    map["filesRead"]        = status.filesRead;
+    map["readFailures"]     = status.readFailures;
+    map["bytesRead"]        = status.bytesRead;
+    map["queuedFiles"]      = status.queuedFiles;
+    map["queuedTracks"]     = status.queuedTracks;
+    map["elapsedSeconds"]   = status.elapsed / 1000.0;
+    map["filesPerSecond"]   = status.filesPerSecond();
+    map["bytesPerSecond"]   = status.bytesPerSecond();
+    map["remainingSeconds"] = status.remainingSeconds();
+
+    return map;
+}
+
+void DBusCollectionProxy::cancelScan()
+{
+    m_collection->cancelFolderScan();
+}
+
 // vim: set et sw=4 tw=0 sta:
@@ -19,6 +19,7 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QStringList> // Required for Q_CLASSINFO ?
+#include <QtCore/QVariant>
 
 class PlaylistCollection;
 
@@ -56,6 +57,20 @@ public slots: // Expose to D-Bus
      */
     QString trackCover(const QString &track);
 
+    /**
+     * Returns the progress of the background folder scan: whether one is
+     * running, the folders visited, the files found, read and failed, the
+     * bytes read, the queue lengths, the rates and the seconds left, or -1
+     * if that isn't known yet.
+     */
+    QVariantMap scanStatus();
+
+    /**
+     * Stops the background folder scan.  What was read so far stays in the
+     * collection.
+     */
+    void cancelScan();
+
 private:
     PlaylistCollection *m_collection;
     QString m_lastCover;
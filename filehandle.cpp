@@ -26,7 +26,9 @@
 #include "filehandleproperties.h"
 #include "tag.h"
 #include "cache.h"
+#include "cachefile.h"
 #include "coverinfo.h"
+#include "trackpath.h"
 
 AddProperty(Title, tag()->title())
 AddProperty(Artist, tag()->artist())
@@ -41,14 +43,34 @@ AddProperty(Path, absFilePath())
 AddNumberProperty(Size, fileInfo().size())
 AddProperty(Extension, fileInfo().suffix())
 
-static QString resolveSymLinks(const QFileInfo &file) // static
+static qint64 toSeconds(const QDateTime &time)
+{
+    return time.isValid() ? qint64(time.toTime_t()) : -1;
+}
+
+static QDateTime fromSeconds(qint64 seconds)
+{
+    return seconds >= 0 ? QDateTime::fromTime_t(uint(seconds)) : QDateTime();
+}
+
+static QString resolveSymLinks(const QString &path, bool exists) // static
 {
     char real[PATH_MAX];
 
-    if(file.exists() && realpath(QFile::encodeName(file.absoluteFilePath()).data(), real))
+    if(exists && realpath(QFile::encodeName(path).data(), real))
         return QFile::decodeName(real);
     else
-        return file.filePath();
+        return path;
+}
+
+static Tag *readTag(const QString &path)
+{
+    // The FileHandle has the path already, the Tag only needs it to read the
+    // file.
+
+    Tag *tag = new Tag(path);
+    tag->setFileName(QString());
+    return tag;
 }
 
 /**
@@ -71,7 +93,12 @@ class FileHandle::FileHandlePrivate : public RefCounter
 public:
     FileHandlePrivate() :
         tag(0),
-        coverInfo(0) {}
+        coverInfo(0),
+        modificationTime(-1),
+        lastModified(-1),
+        size(-1),
+        inode(0),
+        device(0) {}
 
     ~FileHandlePrivate()
     {
@@ -79,12 +106,18 @@ public:
         delete coverInfo;
     }
 
+    // There is one of these for every track, so the path is the only string,
+    // split into the shared folder and the file name, and the times are kept
+    // in seconds.  The Tag doesn't have a copy of the path, see readTag().
+
     mutable Tag *tag;
     mutable CoverInfo *coverInfo;
-    mutable QString absFilePath;
-    QFileInfo fileInfo;
-    QDateTime modificationTime;
-    QDateTime lastModified;
+    TrackPath path;
+    qint64 modificationTime; ///< When the tag was read, -1 if unknown.
+    qint64 lastModified;     ///< Of the file on disk, -1 until it is needed.
+    qint64 size;    ///< As cached or read, -1 if unknown.
+    quint64 inode;  ///< Likewise, or 0.
+    quint64 device; ///< Along with the inode.
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -122,16 +155,40 @@ FileHandle::FileHandle(const QString &path) :
 
 FileHandle::FileHandle(const QString &path, CacheDataStream &s)
 {
+    // Whether the file still exists is checked later on, off of the GUI
+    // thread, by CollectionList::slotCheckCache().
+
     d = new FileHandlePrivate;
-    if(!QFile::exists(path)) {
-        kWarning() << "File" << path << "no longer exists!";
-        return;
-    }
-    d->fileInfo = QFileInfo(path);
-    d->absFilePath = path;
+    d->path = TrackPath(path);
     read(s);
 }
 
+FileHandle::FileHandle(const CachedTrack &track)
+{
+    // Either the cache loader has already checked the file, or
+    // CollectionList::slotCheckCache() will.
+
+    d = new FileHandlePrivate;
+    d->path = TrackPath(track.path);
+    d->tag = new Tag(QString(), true);
+    d->tag->read(track);
+    d->modificationTime = toSeconds(track.modificationTime);
+    d->size = track.size;
+    d->inode = track.inode;
+    d->device = track.device;
+}
+
+FileHandle::FileHandle(const QString &canonicalPath, const FileStat &stat)
+{
+    d = new FileHandlePrivate;
+    d->path = TrackPath(canonicalPath);
+    d->modificationTime = toSeconds(stat.lastModified);
+    d->lastModified = d->modificationTime;
+    d->size = stat.size;
+    d->inode = stat.inode;
+    d->device = stat.device;
+}
+
 FileHandle::~FileHandle()
 {
     if(d->deref())
@@ -140,9 +197,27 @@ FileHandle::~FileHandle()
 
 void FileHandle::refresh()
 {
-    d->fileInfo.refresh();
+    const FileStat stat = FileStat::read(absFilePath());
+
+    d->modificationTime = toSeconds(stat.lastModified);
+    d->lastModified = d->modificationTime;
+    d->size = stat.size;
+    d->inode = stat.inode;
+    d->device = stat.device;
+    delete d->tag;
+    d->tag = readTag(absFilePath());
+}
+
+void FileHandle::refresh(const CachedTrack &track)
+{
+    d->modificationTime = toSeconds(track.modificationTime);
+    d->lastModified = d->modificationTime;
+    d->size = track.size;
+    d->inode = track.inode;
+    d->device = track.device;
     delete d->tag;
-    d->tag = new Tag(d->absFilePath);
+    d->tag = new Tag(QString(), true);
+    d->tag->read(track);
 }
 
 void FileHandle::setFile(const QString &path)
@@ -152,7 +227,9 @@ void FileHandle::setFile(const QString &path)
         return;
     }
 
-    if(!QFile::exists(path)) {
+    const FileStat stat = FileStat::read(path);
+
+    if(!stat.exists) {
         kError() << "trying to set non-existent file: " << path << endl;
         return;
     }
@@ -160,20 +237,26 @@ void FileHandle::setFile(const QString &path)
     if(!d || isNull())
         setup(QFileInfo(path), path);
     else {
-        d->absFilePath = resolveSymLinks(path);
-        d->fileInfo.setFile(path);
-        d->tag->setFileName(d->absFilePath);
+        d->path = TrackPath(resolveSymLinks(path, true));
+        d->size = stat.size;
+        d->inode = stat.inode;
+        d->device = stat.device;
     }
 }
 
 Tag *FileHandle::tag() const
 {
     if(!d->tag)
-        d->tag = new Tag(d->absFilePath);
+        d->tag = readTag(absFilePath());
 
     return d->tag;
 }
 
+bool FileHandle::hasTag() const
+{
+    return d->tag != 0;
+}
+
 CoverInfo *FileHandle::coverInfo() const
 {
     if(!d->coverInfo)
@@ -184,14 +267,22 @@ CoverInfo *FileHandle::coverInfo() const
 
 QString FileHandle::absFilePath() const
 {
-    if(d->absFilePath.isEmpty())
-        d->absFilePath = resolveSymLinks(d->fileInfo.absoluteFilePath());
-    return d->absFilePath;
+    return d->path.toString();
+}
+
+QString FileHandle::fileName() const
+{
+    return d->path.fileName();
 }
 
-const QFileInfo &FileHandle::fileInfo() const
+TrackPath FileHandle::trackPath() const
 {
-    return d->fileInfo;
+    return d->path;
+}
+
+QFileInfo FileHandle::fileInfo() const
+{
+    return QFileInfo(absFilePath());
 }
 
 bool FileHandle::isNull() const
@@ -200,22 +291,27 @@ bool FileHandle::isNull() const
 }
 
 bool FileHandle::isWritable() const {
-    return !isNull() && d->fileInfo.isWritable();
+    return !isNull() && fileInfo().isWritable();
 }
 
 bool FileHandle::current() const
 {
-    return (d->modificationTime.isValid() &&
+    return (d->modificationTime >= 0 &&
             lastModified().isValid() &&
-            d->modificationTime >= lastModified());
+            d->modificationTime >= d->lastModified);
 }
 
-const QDateTime &FileHandle::lastModified() const
+QDateTime FileHandle::lastModified() const
 {
-    if(d->lastModified.isNull())
-        d->lastModified = d->fileInfo.lastModified();
+    if(d->lastModified < 0 && !isNull())
+        d->lastModified = toSeconds(FileStat::read(absFilePath()).lastModified);
 
-    return d->lastModified;
+    return fromSeconds(d->lastModified);
+}
+
+FileIdentity FileHandle::identity() const
+{
+    return FileIdentity(d->device, d->inode);
 }
 
 void FileHandle::read(CacheDataStream &s)
@@ -224,14 +320,58 @@ void FileHandle::read(CacheDataStream &s)
     case 1:
     default:
         if(!d->tag)
-            d->tag = new Tag(d->absFilePath, true);
+            d->tag = new Tag(QString(), true);
+
+        QDateTime modificationTime;
 
         s >> *(d->tag);
-        s >> d->modificationTime;
+        s >> modificationTime;
+
+        d->modificationTime = toSeconds(modificationTime);
         break;
     }
 }
 
+CachedTrack FileHandle::cachedTrack() const
+{
+    // The time is when the tag was read, not the file's time on disk, so
+    // that a file changed since still looks changed to the next session.
+    // Whatever of the fingerprint isn't known is left unknown rather than
+    // asked of the disk, as this is called for every track of a snapshot.
+
+    CachedTrack track = fingerprint();
+    const Tag *t = tag();
+
+    track.title   = t->title();
+    track.artist  = t->artist();
+    track.album   = t->album();
+    track.genre   = t->genre();
+    track.comment = t->comment();
+    track.track   = t->track();
+    track.year    = t->year();
+    track.seconds = t->seconds();
+    track.bitrate = t->bitrate();
+    track.estimatedProperties = t->hasEstimatedProperties();
+    track.embeddedArtKnown = t->isEmbeddedArtKnown();
+    track.hasEmbeddedArt = t->hasEmbeddedArt();
+    track.embeddedArtHash = t->embeddedArtHash();
+
+    return track;
+}
+
+CachedTrack FileHandle::fingerprint() const
+{
+    CachedTrack track;
+
+    track.path = absFilePath();
+    track.modificationTime = fromSeconds(d->modificationTime);
+    track.size   = d->size;
+    track.inode  = d->inode;
+    track.device = d->device;
+
+    return track;
+}
+
 FileHandle &FileHandle::operator=(const FileHandle &f)
 {
     if(&f == this)
@@ -283,11 +423,19 @@ void FileHandle::setup(const QFileInfo &info, const QString &path)
 
     QString fileName = path.isEmpty() ? info.absoluteFilePath() : path;
 
+    // A single stat() tells whether the file exists, when it was changed and
+    // which file it is.
+
+    const FileStat stat = FileStat::read(fileName);
+
     d = new FileHandlePrivate;
-    d->fileInfo = info;
-    d->absFilePath = resolveSymLinks(fileName);
-    d->modificationTime = info.lastModified();
-    if(!info.exists())
+    d->path = TrackPath(resolveSymLinks(fileName, stat.exists));
+    d->modificationTime = toSeconds(stat.lastModified);
+    d->lastModified = d->modificationTime;
+    d->size = stat.size;
+    d->inode = stat.inode;
+    d->device = stat.device;
+    if(!stat.exists)
         kWarning() << "File" << path << "no longer exists!";
 }
 
@@ -26,7 +26,11 @@ class QStringList;
 
 class CoverInfo;
 class Tag;
+class TrackPath;
 class CacheDataStream;
+struct CachedTrack;
+struct FileIdentity;
+struct FileStat;
 
 template<class T>
 class QList;
@@ -44,18 +48,60 @@ public:
     explicit FileHandle(const QFileInfo &info, const QString &path = QString());
     explicit FileHandle(const QString &path);
     FileHandle(const QString &path, CacheDataStream &s);
+    /**
+     * Creates a FileHandle from a cache record without touching the disk.
+     * The file is assumed to be unchanged.
+     */
+    explicit FileHandle(const CachedTrack &track);
+
+    /**
+     * Creates a FileHandle for a file that was already resolved to its
+     * \a canonicalPath and looked at with \a stat, without touching the disk
+     * again.
+     */
+    FileHandle(const QString &canonicalPath, const FileStat &stat);
     ~FileHandle();
 
     /**
      * Forces the FileHandle to reread its information from the disk.
      */
     void refresh();
+
+    /**
+     * Takes the information from \a track, which was just read from the
+     * disk for this file, e.g. by a worker thread.
+     */
+    void refresh(const CachedTrack &track);
+
     void setFile(const QString &path);
 
     Tag *tag() const;
+
+    /**
+     * @return true if the tag has already been read, so that tag() doesn't
+     * have to touch the disk.
+     */
+    bool hasTag() const;
+
     CoverInfo *coverInfo() const;
     QString absFilePath() const;
-    const QFileInfo &fileInfo() const;
+
+    /**
+     * @return the file name part of absFilePath(), which is kept apart from
+     * the folder and so doesn't have to be put together first.
+     */
+    QString fileName() const;
+
+    /**
+     * @return the path in the form CollectionList looks tracks up by.
+     */
+    TrackPath trackPath() const;
+
+    /**
+     * @return a QFileInfo for absFilePath().  It isn't kept around, since a
+     * QFileInfo for every track in the collection adds up.
+     */
+    QFileInfo fileInfo() const;
 
     bool isNull() const;
 
@@ -66,10 +112,31 @@ public:
     bool isWritable() const;
 
     bool current() const;
-    const QDateTime &lastModified() const;
+    QDateTime lastModified() const;
+
+    /**
+     * @return the device and inode of the file as they were when it was last
+     * read, or a null identity if they aren't known.  This never touches the
+     * disk.
+     */
+    FileIdentity identity() const;
 
     void read(CacheDataStream &s);
 
+    /**
+     * @return the information that is stored in the collection cache for
+     * this file: the tag and the fingerprint().  Never touches the disk,
+     * provided that the tag has been read.
+     */
+    CachedTrack cachedTrack() const;
+
+    /**
+     * @return just the path, modification time, size and identity as they were
+     * when the file was last read, to check it against the disk.  Never
+     * touches the disk.
+     */
+    CachedTrack fingerprint() const;
+
     FileHandle &operator=(const FileHandle &f);
     bool operator==(const FileHandle &f) const;
     bool operator!=(const FileHandle &f) const;
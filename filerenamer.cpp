@@ -53,7 +53,7 @@
 #include "filehandle.h"
 #include "exampleoptions.h"
 #include "playlistitem.h"
-#include "playlist.h" // processEvents()
+#include "workscheduler.h"
 #include "coverinfo.h"
 
 class ConfirmationDialog : public KDialog
@@ -912,7 +912,7 @@ void FileRenamer::rename(const PlaylistItemList &items)
         else
             errorFiles << i18n("%1 to %2", it.key(), it.value());
 
-        processEvents();
+        WorkScheduler::instance()->yieldIfNeeded();
     }
     KApplication::restoreOverrideCursor();
 
@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "foldermanifest.h"
+
+#include <kdebug.h>
+#include <ksavefile.h>
+
+#include <QtCore/QDataStream>
+#include <QtCore/QFile>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "folderset.h"
+
+static const qint32 manifestVersion = 1;
+
+////////////////////////////////////////////////////////////////////////////////
+// public methods
+////////////////////////////////////////////////////////////////////////////////
+
+FolderManifest::FolderManifest() :
+    m_importPlaylists(false)
+{
+
+}
+
+bool FolderManifest::load(const QString &fileName)
+{
+    m_folders.clear();
+
+    QFile f(fileName);
+    if(!f.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream s(&f);
+    s.setVersion(QDataStream::Qt_4_3);
+
+    qint32 version;
+    qint32 count;
+    s >> version;
+
+    if(version != manifestVersion)
+        return false;
+
+    s >> m_importPlaylists >> count;
+
+    for(qint32 i = 0; i < count && s.status() == QDataStream::Ok; ++i) {
+        QString folder;
+        Folder entry;
+
+        s >> folder >> entry.modified >> entry.subfolders;
+        m_folders.insert(folder, entry);
+    }
+
+    if(s.status() != QDataStream::Ok) {
+        kError() << "The folder manifest is damaged, scanning every folder.";
+        m_folders.clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool FolderManifest::save(const QString &fileName) const
+{
+    KSaveFile f(fileName);
+
+    if(!f.open(QIODevice::WriteOnly)) {
+        kError() << "Error saving the folder manifest:" << f.errorString();
+        return false;
+    }
+
+    QDataStream s(&f);
+    s.setVersion(QDataStream::Qt_4_3);
+
+    s << manifestVersion
+      << m_importPlaylists
+      << qint32(m_folders.count());
+
+    for(QHash<QString, Folder>::ConstIterator it = m_folders.constBegin();
+        it != m_folders.constEnd(); ++it)
+    {
+        s << it.key() << it.value().modified << it.value().subfolders;
+    }
+
+    if(!f.finalize()) {
+        kError() << "Error saving the folder manifest:" << f.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+const FolderManifest::Folder *FolderManifest::find(const QString &folder) const
+{
+    QHash<QString, Folder>::ConstIterator it = m_folders.constFind(folder);
+    return it != m_folders.constEnd() ? &it.value() : 0;
+}
+
+void FolderManifest::invalidate(const QString &folder)
+{
+    QHash<QString, Folder>::Iterator it = m_folders.find(folder);
+
+    if(it != m_folders.end())
+        it.value().modified = -1;
+}
+
+void FolderManifest::update(const FolderSet &roots, const FolderManifest &scan)
+{
+    QHash<QString, Folder>::Iterator it = m_folders.begin();
+
+    while(it != m_folders.end()) {
+        if(roots.contains(it.key()))
+            it = m_folders.erase(it);
+        else
+            ++it;
+    }
+
+    for(QHash<QString, Folder>::ConstIterator scanned = scan.m_folders.constBegin();
+        scanned != scan.m_folders.constEnd(); ++scanned)
+    {
+        m_folders.insert(scanned.key(), scanned.value());
+    }
+}
+
+qint64 FolderManifest::modificationTime(const QString &folder) // static
+{
+    struct stat st;
+
+    if(::stat(QFile::encodeName(folder).constData(), &st) != 0 || !S_ISDIR(st.st_mode))
+        return -1;
+
+    return st.st_mtime;
+}
+
+// vim: set et sw=4 tw=0 sta:
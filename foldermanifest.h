@@ -0,0 +1,110 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_FOLDERMANIFEST_H
+#define JUK_FOLDERMANIFEST_H
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+class FolderSet;
+
+/**
+ * What the last folder scan found in every folder it listed: the
+ * modification time of the folder and its subfolders.  A folder's
+ * modification time changes whenever an entry is added to it, removed from it
+ * or renamed in it, so as long as it is the same the next scan can take the
+ * subfolders from here instead of listing the folder again, and knows that
+ * there are no new files in it.
+ *
+ * A folder is only recorded once every file in it made it into the
+ * collection, and it has to be invalidated whenever one of its files is
+ * removed from the collection, so that the next scan adds it back.  An
+ * invalid folder is listed again by the next scan, but still known to be
+ * there, which is what FolderWatcher goes by.
+ *
+ * A const FolderManifest may be used from several threads at once.
+ */
+class FolderManifest
+{
+public:
+    struct Folder
+    {
+        Folder() : modified(-1) {}
+
+        qint64 modified; ///< Seconds since the epoch, -1 if invalid.
+        QStringList subfolders; ///< Canonical paths.
+    };
+
+    FolderManifest();
+
+    /**
+     * Replaces the contents with \a fileName.  Returns false, leaving the
+     * manifest empty, if it couldn't be read.
+     */
+    bool load(const QString &fileName);
+    bool save(const QString &fileName) const;
+
+    bool isEmpty() const { return m_folders.isEmpty(); }
+    void clear() { m_folders.clear(); }
+
+    /**
+     * Whether the playlist files were imported by the scan, see
+     * PlaylistCollection::importPlaylists().  A folder doesn't tell whether
+     * its playlists were imported if this differs from the current setting.
+     */
+    bool importPlaylists() const { return m_importPlaylists; }
+    void setImportPlaylists(bool import) { m_importPlaylists = import; }
+
+    /**
+     * Returns the entry for \a folder, or 0 if it isn't recorded.
+     */
+    const Folder *find(const QString &folder) const;
+
+    void insert(const QString &folder, const Folder &entry) { m_folders.insert(folder, entry); }
+    void remove(const QString &folder) { m_folders.remove(folder); }
+
+    /**
+     * Makes the next scan list \a folder again.
+     */
+    void invalidate(const QString &folder);
+
+    /**
+     * Every folder recorded, valid or not.
+     */
+    QStringList folders() const { return m_folders.keys(); }
+
+    /**
+     * Replaces everything recorded below \a roots with \a scan, the result
+     * of scanning them again.
+     */
+    void update(const FolderSet &roots, const FolderManifest &scan);
+
+    /**
+     * Returns the modification time of \a folder as it is kept in the
+     * manifest, or -1 if it doesn't exist.
+     */
+    static qint64 modificationTime(const QString &folder);
+
+private:
+    QHash<QString, Folder> m_folders;
+    bool m_importPlaylists;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
@@ -59,12 +59,24 @@ bool FolderPlaylist::getPolicy(Playlist::Policy p) const {
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// protected methods
+////////////////////////////////////////////////////////////////////////////////
+
+void FolderPlaylist::loadDeferredItems()
+{
+    slotReload();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // private slots
 ////////////////////////////////////////////////////////////////////////////////
 
 void FolderPlaylist::slotReload()
 {
+    if(!isMaterialized())
+        return;
+
     if(!m_folder.isEmpty())
         addFiles(QStringList(m_folder));
 
@@ -38,6 +38,13 @@ public:
 public slots:
     virtual void slotReload();
 
+protected:
+    /**
+     * A folder playlist restored from the cache only scans its folder once it
+     * is materialized.
+     */
+    virtual void loadDeferredItems();
+
 private:
     QString m_folder;
 };
@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "folderset.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// public methods
+////////////////////////////////////////////////////////////////////////////////
+
+FolderSet::FolderSet() :
+    m_nodes(1)
+{
+
+}
+
+FolderSet::FolderSet(const QStringList &folders) :
+    m_nodes(1)
+{
+    foreach(const QString &folder, folders)
+        insert(folder);
+}
+
+void FolderSet::insert(const QString &folder)
+{
+    int node = 0;
+
+    // Empty components, from a leading, doubled or trailing slash, are
+    // skipped, so "/music/" and "/music" are the same folder.
+
+    foreach(const QString &component, folder.split('/', QString::SkipEmptyParts)) {
+        const int child = m_nodes[node].children.value(component, -1);
+
+        if(child >= 0)
+            node = child;
+        else {
+            m_nodes.append(Node());
+            m_nodes[node].children.insert(component, m_nodes.count() - 1);
+            node = m_nodes.count() - 1;
+        }
+    }
+
+    m_nodes[node].terminal = true;
+}
+
+void FolderSet::clear()
+{
+    m_nodes.clear();
+    m_nodes.resize(1);
+}
+
+bool FolderSet::contains(const QString &path) const
+{
+    int node = 0;
+    int start = 0;
+    const int length = path.length();
+
+    while(!m_nodes[node].terminal) {
+        while(start < length && path[start] == '/')
+            ++start;
+
+        if(start >= length)
+            return false;
+
+        int end = path.indexOf('/', start);
+        if(end < 0)
+            end = length;
+
+        node = m_nodes[node].children.value(path.mid(start, end - start), -1);
+        if(node < 0)
+            return false;
+
+        start = end;
+    }
+
+    return true;
+}
+
+// vim: set et sw=4 tw=0 sta:
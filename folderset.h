@@ -0,0 +1,67 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_FOLDERSET_H
+#define JUK_FOLDERSET_H
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+/**
+ * A set of folders that answers whether a path is one of them or lies below
+ * one of them.  The folders are kept as a trie of their path components, so
+ * that a lookup costs one hash lookup per component of the path, however
+ * many folders there are.
+ *
+ * Unlike a QString::startsWith() test this works on whole components:
+ * /music/a covers /music/a/b but not /music/ab.  Paths are compared as they
+ * are, so both the folders and the paths looked up should be canonical.
+ *
+ * A const FolderSet may be used from several threads at once.
+ */
+class FolderSet
+{
+public:
+    FolderSet();
+    explicit FolderSet(const QStringList &folders);
+
+    void insert(const QString &folder);
+    void clear();
+
+    bool isEmpty() const { return m_nodes.count() == 1 && !m_nodes[0].terminal; }
+
+    /**
+     * Returns true if \a path is one of the folders or is below one of them.
+     */
+    bool contains(const QString &path) const;
+
+private:
+    struct Node
+    {
+        Node() : terminal(false) {}
+
+        QHash<QString, int> children;
+        bool terminal;
+    };
+
+    QVector<Node> m_nodes; ///< The root is the first node.
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,176 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "folderwatcher.h"
+
+#include <kdebug.h>
+#include <kdirwatch.h>
+
+#include <QtCore/QTimer>
+
+// How long it has to be quiet before the changes are reported, and how long
+// they may be held back at most.
+
+static const int settleDelay = 1000;
+static const int maximumDelay = 5000;
+
+////////////////////////////////////////////////////////////////////////////////
+// public methods
+////////////////////////////////////////////////////////////////////////////////
+
+FolderWatcher::FolderWatcher(QObject *parent) :
+    QObject(parent),
+    m_dirWatch(new KDirWatch(this)),
+    m_enabled(false),
+    m_settleTimer(new QTimer(this))
+{
+    m_dirWatch->stopScan();
+
+    m_settleTimer->setSingleShot(true);
+
+    connect(m_dirWatch, SIGNAL(dirty(QString)), SLOT(slotDirty(QString)));
+    connect(m_dirWatch, SIGNAL(created(QString)), SLOT(slotCreated(QString)));
+    connect(m_dirWatch, SIGNAL(deleted(QString)), SLOT(slotDeleted(QString)));
+    connect(m_settleTimer, SIGNAL(timeout()), SLOT(slotSettled()));
+}
+
+FolderWatcher::~FolderWatcher()
+{
+
+}
+
+void FolderWatcher::setFolders(const QStringList &folders)
+{
+    const QSet<QString> wanted = folders.toSet();
+
+    foreach(const QString &folder, m_folders) {
+        if(!wanted.contains(folder))
+            m_dirWatch->removeDir(folder);
+    }
+
+    // Watching the files of a folder through the folder itself, rather than
+    // each of them, doesn't cost another watch per file.
+
+    foreach(const QString &folder, wanted) {
+        if(!m_folders.contains(folder))
+            m_dirWatch->addDir(folder, KDirWatch::WatchFiles);
+    }
+
+    m_folders = wanted;
+
+    kDebug() << "Watching" << m_folders.count() << "folders";
+}
+
+void FolderWatcher::setEnabled(bool enabled)
+{
+    if(enabled == m_enabled)
+        return;
+
+    m_enabled = enabled;
+
+    if(enabled)
+        m_dirWatch->startScan();
+    else {
+        m_dirWatch->stopScan();
+        m_settleTimer->stop();
+        m_changedFiles.clear();
+        m_removedPaths.clear();
+        m_changedFolders.clear();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// private slots
+////////////////////////////////////////////////////////////////////////////////
+
+void FolderWatcher::slotDirty(const QString &path)
+{
+    if(m_folders.contains(path))
+        folderChanged(path);
+    else {
+        m_changedFiles.insert(path);
+        m_removedPaths.remove(path);
+    }
+
+    changeReported();
+}
+
+void FolderWatcher::slotCreated(const QString &path)
+{
+    // Either a new file or folder, which the folder it is in has to be looked
+    // at again for, or a file that was replaced by a new copy.
+
+    if(m_folders.contains(path))
+        folderChanged(path);
+    else {
+        m_changedFiles.insert(path);
+        m_removedPaths.remove(path);
+        folderChanged(path.left(path.lastIndexOf('/')));
+    }
+
+    changeReported();
+}
+
+void FolderWatcher::slotDeleted(const QString &path)
+{
+    m_removedPaths.insert(path);
+    m_changedFiles.remove(path);
+    m_changedFolders.remove(path);
+
+    changeReported();
+}
+
+void FolderWatcher::slotSettled()
+{
+    const QStringList changedFiles = m_changedFiles.toList();
+    const QStringList removedPaths = m_removedPaths.toList();
+    const QStringList changedFolders = m_changedFolders.toList();
+
+    m_changedFiles.clear();
+    m_removedPaths.clear();
+    m_changedFolders.clear();
+
+    emit signalChanged(changedFiles, removedPaths, changedFolders);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// private methods
+////////////////////////////////////////////////////////////////////////////////
+
+void FolderWatcher::folderChanged(const QString &path)
+{
+    if(!path.isEmpty()) {
+        m_changedFolders.insert(path);
+        m_removedPaths.remove(path);
+    }
+}
+
+void FolderWatcher::changeReported()
+{
+    if(!m_settleTimer->isActive())
+        m_firstChange.start();
+
+    // Wait for the next quiet moment, but not forever.
+
+    const int waited = m_firstChange.elapsed();
+
+    if(waited < maximumDelay)
+        m_settleTimer->start(qMin(settleDelay, maximumDelay - waited));
+}
+
+#include "folderwatcher.moc"
+
+// vim: set et sw=4 tw=0 sta:
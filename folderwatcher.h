@@ -0,0 +1,91 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_FOLDERWATCHER_H
+#define JUK_FOLDERWATCHER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QTime>
+
+class KDirWatch;
+class QTimer;
+
+/**
+ * Watches a set of folders, but none of the files in them individually, which
+ * keeps the number of inotify watches down to one per folder.
+ *
+ * The changes are collected until nothing happened for a moment, so that a
+ * burst of them, like copying an album or retagging one in another program,
+ * is reported once, with every path only once.  A steady stream of changes is
+ * still reported every few seconds.
+ */
+class FolderWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FolderWatcher(QObject *parent = 0);
+    virtual ~FolderWatcher();
+
+    /**
+     * Watches exactly \a folders from now on.  Only the folders that weren't
+     * watched before are added, so this is cheap for a mostly unchanged set.
+     */
+    void setFolders(const QStringList &folders);
+
+    /**
+     * Changes are neither watched for nor reported until this is set.
+     */
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return m_enabled; }
+
+signals:
+    /**
+     * \a changedFiles were written to or created, \a removedPaths are files
+     * or folders that were removed, and \a changedFolders gained or lost
+     * entries.  A file that was replaced shows up in both changedFiles and,
+     * as its folder, in changedFolders.
+     */
+    void signalChanged(const QStringList &changedFiles,
+                       const QStringList &removedPaths,
+                       const QStringList &changedFolders);
+
+private slots:
+    void slotDirty(const QString &path);
+    void slotCreated(const QString &path);
+    void slotDeleted(const QString &path);
+    void slotSettled();
+
+private:
+    void folderChanged(const QString &path);
+    void changeReported();
+
+    KDirWatch *m_dirWatch;
+    QSet<QString> m_folders;
+    bool m_enabled;
+
+    QTimer *m_settleTimer;
+    QTime m_firstChange;
+    QSet<QString> m_changedFiles;
+    QSet<QString> m_removedPaths;
+    QSet<QString> m_changedFolders;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
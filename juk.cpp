@@ -187,6 +187,11 @@ void JuK::setupLayout()
     statusBar()->addWidget(m_statusLabel, 1);
     m_player->setStatusLabel(m_statusLabel);
 
+    connect(CollectionList::instance(), SIGNAL(signalFolderScanProgress(int,int)),
+            this, SLOT(slotFolderScanProgress(int,int)));
+    connect(PlaylistCollection::instance()->object(), SIGNAL(signalAddFilesProgress(int,int)),
+            this, SLOT(slotAddFilesProgress(int,int)));
+
     // PlayerManager signals
     connect(m_player, SIGNAL(signalStart()), this, SLOT(slotPlayerStarted()));
     // PlayerManager will emit signal each time a new track starts
@@ -508,6 +513,18 @@ void JuK::slotClearOldCovers()
     }
 }
 
+void JuK::slotFolderScanProgress(int read, int found)
+{
+    // The message disappears on its own once the scan stops reporting.
+
+    statusBar()->showMessage(i18n("Reading new files: %1 of %2", read, found), 2000);
+}
+
+void JuK::slotAddFilesProgress(int added, int count)
+{
+    statusBar()->showMessage(i18n("Adding files: %1 of %2", added, count), 2000);
+}
+
 void JuK::keyPressEvent(QKeyEvent *e)
 {
     if (e->key() >= Qt::Key_Back && e->key() <= Qt::Key_MediaLast)
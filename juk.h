@@ -82,6 +82,8 @@ private slots:
     void slotCheckAlbumNextAction(bool albumRandomEnabled);
     void slotProcessArgs();
     void slotClearOldCovers();
+    void slotFolderScanProgress(int read, int found);
+    void slotAddFilesProgress(int added, int count);
     // handle PlayerManager signals
     void slotPlayerStarted();
     void slotPlayTrack(const FileHandle& file);
@@ -23,12 +23,16 @@
 #include <kio/netaccess.h>
 
 #include <QtGui/QWidget>
+#include <QtCore/QByteArray>
 #include <QtCore/QFile>
+#include <QtCore/QMutex>
 
 #include <taglib.h>
 #include <taglib_config.h>
 #include <tag.h>
 #include <mpegfile.h>
+#include <id3v2tag.h>
+#include <attachedpictureframe.h>
 #include <vorbisfile.h>
 #include <flacfile.h>
 #include <xiphcomment.h>
@@ -46,6 +50,8 @@
 
 #ifdef TAGLIB_WITH_MP4
 #include <mp4file.h>
+#include <mp4tag.h>
+#include <mp4coverart.h>
 #endif
 
 namespace MediaFiles {
@@ -92,6 +98,150 @@ namespace MediaFiles {
 
 #define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
 
+namespace MediaFiles {
+    struct SuffixFormat
+    {
+        const char *suffix;
+        Format format;
+    };
+
+    /**
+     * The suffixes that settle the format without asking for the mime type,
+     * in lower case.  An .ogg file may hold any of several codecs, so Ogg
+     * only tells that it is a media file.  Anything not listed here or in
+     * nonMediaSuffixes goes through KMimeType.
+     */
+    static const SuffixFormat suffixFormats[] = {
+        { "mp3",  MP3 },
+        { "flac", FLAC },
+        { "ogg",  Ogg },
+        { "oga",  Ogg },
+        { "mpc",  MPC },
+        { "mpp",  MPC },
+        { "mp+",  MPC },
+#ifdef TAGLIB_WITH_ASF
+        { "wma",  ASF },
+        { "asf",  ASF },
+#endif
+#ifdef TAGLIB_WITH_MP4
+        { "m4a",  MP4 },
+        { "m4b",  MP4 },
+#endif
+#if TAGLIB_HAS_OPUSFILE
+        { "opus", Opus },
+#endif
+        { "m3u",  Playlist }
+    };
+
+    /**
+     * The files that turn up next to the tracks of nearly every album, which
+     * are known not to be media files without asking for the mime type.
+     */
+    static const char *const nonMediaSuffixes[] = {
+        "jpg", "jpeg", "png", "gif", "bmp",
+        "txt", "nfo", "cue", "log", "toc", "lrc",
+        "sfv", "md5", "ffp", "accurip",
+        "pdf", "htm", "html", "xml", "url", "ini", "db"
+    };
+
+    /**
+     * Whether the suffix of \a fileName, which starts after \a dot, is
+     * \a suffix, ignoring case.
+     */
+    static bool hasSuffix(const QString &fileName, int dot, const char *suffix)
+    {
+        const int length = fileName.length() - dot - 1;
+
+        if(int(qstrlen(suffix)) != length)
+            return false;
+
+        int j = 0;
+        while(j < length && fileName[dot + 1 + j].toLower() == QLatin1Char(suffix[j]))
+            ++j;
+
+        return j == length;
+    }
+
+    /**
+     * Looks the suffix of \a fileName up in suffixFormats and
+     * nonMediaSuffixes, and sets \a known if it is in either.  Doesn't
+     * allocate and doesn't touch the disk, so it is cheap enough to call for
+     * every file of a folder scan.
+     */
+    static Format formatFromSuffix(const QString &fileName, bool *known)
+    {
+        *known = false;
+
+        const int dot = fileName.lastIndexOf('.');
+
+        if(dot < 0 || dot < fileName.lastIndexOf('/'))
+            return Unknown;
+
+        for(unsigned i = 0; i < ARRAY_SIZE(suffixFormats); ++i) {
+            if(hasSuffix(fileName, dot, suffixFormats[i].suffix)) {
+                *known = true;
+                return suffixFormats[i].format;
+            }
+        }
+
+        for(unsigned i = 0; i < ARRAY_SIZE(nonMediaSuffixes); ++i) {
+            if(hasSuffix(fileName, dot, nonMediaSuffixes[i])) {
+                *known = true;
+                return Unknown;
+            }
+        }
+
+        return Unknown;
+    }
+
+    /**
+     * KMimeType isn't documented to be thread-safe, and the folder scan asks
+     * from several threads at once, so the lookups made here take turns.
+     */
+    static QMutex mimeTypeMutex;
+
+    static Format formatFromMimeType(const QString &fileName)
+    {
+        QMutexLocker locker(&mimeTypeMutex);
+
+        KMimeType::Ptr result = KMimeType::findByPath(fileName);
+        if(!result->isValid())
+            return Unknown;
+
+        if(result->is(mp3Type))
+            return MP3;
+        if(result->is(flacType))
+            return FLAC;
+        if(result->is(vorbisType))
+            return Vorbis;
+#ifdef TAGLIB_WITH_ASF
+        if(result->is(asfType))
+            return ASF;
+#endif
+#ifdef TAGLIB_WITH_MP4
+        if(result->is(mp4Type) || result->is(mp4AudiobookType))
+            return MP4;
+#endif
+        if(result->is(mpcType))
+            return MPC;
+        if(result->is(oggflacType))
+            return OggFLAC;
+#if TAGLIB_HAS_OPUSFILE
+        if(result->is(oggopusType) ||
+           (result->is(oggType) && fileName.endsWith(QLatin1String(".opus"))))
+        {
+            return Opus;
+        }
+#endif
+        if(result->is(oggType))
+            return Ogg;
+        if(result->is(m3uType))
+            return Playlist;
+
+        return Unknown;
+    }
+}
+
 QStringList MediaFiles::openDialog(QWidget *parent)
 {
     KFileDialog *dialog = new KFileDialog(KUrl(), QString(), parent);
@@ -131,116 +281,199 @@ QString MediaFiles::savePlaylistDialog(const QString &playlistName, QWidget *par
     return fileName;
 }
 
-TagLib::File *MediaFiles::fileFactoryByType(const QString &fileName)
+MediaFiles::Format MediaFiles::formatOf(const QString &fileName)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    if(!result->isValid())
-        return 0;
+    bool known;
+    const Format format = formatFromSuffix(fileName, &known);
 
-    TagLib::File *file(0);
-    QByteArray encodedFileName(QFile::encodeName(fileName));
+    if(known && format != Ogg)
+        return format;
 
-    if(result->is(mp3Type))
-        file = new TagLib::MPEG::File(encodedFileName.constData());
-    else if(result->is(flacType))
-        file = new TagLib::FLAC::File(encodedFileName.constData());
-    else if(result->is(vorbisType))
-        file = new TagLib::Vorbis::File(encodedFileName.constData());
+    return formatFromMimeType(fileName);
+}
+
+TagLib::File *MediaFiles::fileFactoryByType(const QString &fileName)
+{
+    return fileFactoryByType(fileName, formatOf(fileName));
+}
+
+TagLib::File *MediaFiles::fileFactoryByType(const QString &fileName, Format format,
+                                            TagLib::AudioProperties::ReadStyle style)
+{
+    const QByteArray encodedFileName(QFile::encodeName(fileName));
+
+    switch(format) {
+    case MP3:
+        return new TagLib::MPEG::File(encodedFileName.constData(), true, style);
+    case FLAC:
+        return new TagLib::FLAC::File(encodedFileName.constData(), true, style);
+    case Vorbis:
+        return new TagLib::Vorbis::File(encodedFileName.constData(), true, style);
 #ifdef TAGLIB_WITH_ASF
-    else if(result->is(asfType))
-        file = new TagLib::ASF::File(encodedFileName.constData());
+    case ASF:
+        return new TagLib::ASF::File(encodedFileName.constData(), true, style);
 #endif
 #ifdef TAGLIB_WITH_MP4
-    else if(result->is(mp4Type) || result->is(mp4AudiobookType))
-        file = new TagLib::MP4::File(encodedFileName.constData());
+    case MP4:
+        return new TagLib::MP4::File(encodedFileName.constData(), true, style);
 #endif
-    else if(result->is(mpcType))
-        file = new TagLib::MPC::File(encodedFileName.constData());
-    else if(result->is(oggflacType))
-        file = new TagLib::Ogg::FLAC::File(encodedFileName.constData());
+    case MPC:
+        return new TagLib::MPC::File(encodedFileName.constData(), true, style);
+    case OggFLAC:
+        return new TagLib::Ogg::FLAC::File(encodedFileName.constData(), true, style);
 #if TAGLIB_HAS_OPUSFILE
-    else if(result->is(oggopusType) ||
-            (result->is(oggType) && fileName.endsWith(QLatin1String(".opus")))
-            )
-    {
-        file = new TagLib::Ogg::Opus::File(encodedFileName.constData());
-    }
+    case Opus:
+        return new TagLib::Ogg::Opus::File(encodedFileName.constData(), true, style);
 #endif
+    default:
+        return 0;
+    }
+}
+
+static QByteArray embeddedID3v2Art(TagLib::ID3v2::Tag *id3tag)
+{
+    if(!id3tag)
+        return QByteArray();
 
-    return file;
+    const TagLib::ID3v2::FrameList frames = id3tag->frameListMap()["APIC"];
+
+    if(frames.isEmpty())
+        return QByteArray();
+
+    // Attached pictures have different types.  The front cover is the one
+    // wanted for both the thumbnail and the full size cover, as a file icon
+    // is too small even for the thumbnail.  Failing that, or if there is
+    // only one picture, the first one is used.
+
+    TagLib::ID3v2::AttachedPictureFrame *selectedFrame = 0;
+
+    if(frames.size() != 1) {
+        for(TagLib::ID3v2::FrameList::ConstIterator it = frames.begin(); it != frames.end(); ++it) {
+
+            // This must be dynamic_cast<>, TagLib will return UnknownFrame in
+            // APIC for encrypted frames.
+            TagLib::ID3v2::AttachedPictureFrame *frame =
+                dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(*it);
+
+            if(frame && frame->type() == TagLib::ID3v2::AttachedPictureFrame::FrontCover) {
+                selectedFrame = frame;
+                break;
+            }
+        }
+    }
+
+    if(!selectedFrame)
+        selectedFrame = dynamic_cast<TagLib::ID3v2::AttachedPictureFrame *>(frames.front());
+
+    if(!selectedFrame) // Could occur for encrypted picture frames.
+        return QByteArray();
+
+    const TagLib::ByteVector picture = selectedFrame->picture();
+    return QByteArray(picture.data(), picture.size());
 }
 
-bool MediaFiles::isMediaFile(const QString &fileName)
+#ifdef TAGLIB_WITH_MP4
+static QByteArray embeddedMP4Art(TagLib::MP4::Tag *tag)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    if(!result->isValid())
-        return false;
+    if(!tag)
+        return QByteArray();
 
-    // Search through our table of media types for a match
-    for(unsigned i = 0; i < ARRAY_SIZE(mediaTypes); ++i) {
-        if(result->is(mediaTypes[i]))
-            return true;
+    TagLib::MP4::ItemListMap &items = tag->itemListMap();
+
+    if(!items.contains("covr"))
+        return QByteArray();
+
+    const TagLib::MP4::CoverArtList covers = items["covr"].toCoverArtList();
+
+    for(TagLib::MP4::CoverArtList::ConstIterator it = covers.begin(); it != covers.end(); ++it) {
+        const TagLib::ByteVector picture = (*it).data();
+
+        if(!picture.isEmpty())
+            return QByteArray(picture.data(), picture.size());
     }
 
-    return false;
+    return QByteArray();
+}
+#endif
+
+QByteArray MediaFiles::embeddedArt(TagLib::File *file)
+{
+    if(TagLib::MPEG::File *mpegFile = dynamic_cast<TagLib::MPEG::File *>(file))
+        return embeddedID3v2Art(mpegFile->ID3v2Tag(false));
+#ifdef TAGLIB_WITH_MP4
+    else if(TagLib::MP4::File *mp4File = dynamic_cast<TagLib::MP4::File *>(file))
+        return embeddedMP4Art(mp4File->tag());
+#endif
+
+    return QByteArray();
+}
+
+MediaFiles::Format MediaFiles::roughFormatOf(const QString &fileName)
+{
+    // An Ogg file is a media file whatever is inside, so the suffix is
+    // enough for those as well.
+
+    bool known;
+    const Format format = formatFromSuffix(fileName, &known);
+
+    return known ? format : formatFromMimeType(fileName);
+}
+
+bool MediaFiles::isMediaFile(const QString &fileName)
+{
+    const Format format = roughFormatOf(fileName);
+    return format != Unknown && format != Playlist;
 }
 
 bool MediaFiles::isPlaylistFile(const QString &fileName)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    return result->is(m3uType);
+    return roughFormatOf(fileName) == Playlist;
 }
 
 bool MediaFiles::isMP3(const QString &fileName)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    return result->is(mp3Type);
+    return formatOf(fileName) == MP3;
 }
 
 bool MediaFiles::isOgg(const QString &fileName)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    return result->is(oggType);
+    bool known;
+    const Format format = formatFromSuffix(fileName, &known) == Ogg ? Ogg : formatOf(fileName);
+    return format == Ogg || format == Vorbis || format == OggFLAC || format == Opus;
 }
 
 bool MediaFiles::isFLAC(const QString &fileName)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    return result->is(flacType);
+    return formatOf(fileName) == FLAC;
 }
 
 bool MediaFiles::isMPC(const QString &fileName)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    return result->is(mpcType);
+    return formatOf(fileName) == MPC;
 }
 
 bool MediaFiles::isVorbis(const QString &fileName)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    return result->is(vorbisType);
+    return formatOf(fileName) == Vorbis;
 }
 
 #ifdef TAGLIB_WITH_ASF
 bool MediaFiles::isASF(const QString &fileName)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    return result->is(asfType);
+    return formatOf(fileName) == ASF;
 }
 #endif
 
 #ifdef TAGLIB_WITH_MP4
 bool MediaFiles::isMP4(const QString &fileName)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    return result->is(mp4Type) || result->is(mp4AudiobookType);
+    return formatOf(fileName) == MP4;
 }
 #endif
 
 bool MediaFiles::isOggFLAC(const QString &fileName)
 {
-    KMimeType::Ptr result = KMimeType::findByPath(fileName);
-    return result->is(oggflacType);
+    return formatOf(fileName) == OggFLAC;
 }
 
 QStringList MediaFiles::mimeTypes()
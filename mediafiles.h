@@ -17,6 +17,7 @@
 #ifndef MEDIAFILES_H
 #define MEDIAFILES_H
 
+class QByteArray;
 class QWidget;
 class QString;
 class QStringList;
@@ -27,6 +28,7 @@ namespace TagLib {
 
 #include <kurl.h>
 #include <taglib_config.h>
+#include <audioproperties.h>
 
 /**
  * A namespace for file JuK's file related functions.  The goal is to hide
@@ -45,6 +47,33 @@ namespace MediaFiles
      */
     QString savePlaylistDialog(const QString &playlistName, QWidget *parent = 0);
 
+    /**
+     * The formats that JuK tells apart.  Ogg is an Ogg file that TagLib
+     * can't read, or whose codec hasn't been determined.
+     */
+    enum Format {
+        Unknown,
+        MP3,
+        FLAC,
+        Vorbis,
+        OggFLAC,
+        Opus,
+        Ogg,
+        MPC,
+        ASF,
+        MP4,
+        Playlist
+    };
+
+    /**
+     * Returns the format of fileName.  Most formats, and the usual files
+     * that aren't media files, are known from the suffix of the file alone;
+     * only other suffixes and Ogg files, which may hold several codecs, cost
+     * a mime type lookup.  Those lookups are serialized by a mutex, which is
+     * what lets the folder scan threads call this.
+     */
+    Format formatOf(const QString &fileName);
+
     /**
      * Returns a pointer to a new appropriate subclass of TagLib::File, or
      * a null pointer if there is no appropriate subclass for the given
@@ -52,6 +81,30 @@ namespace MediaFiles
      */
     TagLib::File *fileFactoryByType(const QString &fileName);
 
+    /**
+     * As above, for a file whose format has already been determined with
+     * formatOf().  \a style is how hard TagLib tries to get the length and
+     * bitrate right.
+     */
+    TagLib::File *fileFactoryByType(const QString &fileName, Format format,
+        TagLib::AudioProperties::ReadStyle style = TagLib::AudioProperties::Average);
+
+    /**
+     * Returns the picture embedded in the tags of \a file that JuK shows as
+     * its cover, still encoded, or a null array if there is none.  Only ID3v2
+     * and MP4 tags are looked at.  Only \a file is touched, so this may be
+     * used from whichever thread has it.
+     */
+    QByteArray embeddedArt(TagLib::File *file);
+
+    /**
+     * Like formatOf(), but an Ogg file is left at Ogg whatever its codec.
+     * That tells media files and playlists apart with at most one mime type
+     * lookup, where isMediaFile() and then isPlaylistFile() would make two
+     * for an unknown suffix.  Used by the folder scan threads.
+     */
+    Format roughFormatOf(const QString &fileName);
+
     /**
      * Returns true if fileName is a supported media file.
      */
@@ -69,7 +69,7 @@ void MusicBrainzLookup::error()
 
 void MusicBrainzLookup::message(const QString &s) const
 {
-    QString message = QString("%1 (%2)").arg(s).arg(m_file.fileInfo().fileName());
+    QString message = QString("%1 (%2)").arg(s).arg(m_file.fileName());
     JuK::JuKInstance()->statusBar()->showMessage(message, 3000);
 }
 
@@ -94,11 +94,11 @@ void MusicBrainzLookup::confirmation()
         QPair<FileHandle, KTRMResultList> item = queue.first();
         FileHandle file = item.first;
         KTRMResultList results = item.second;
-        TrackPickerDialog dialog(file.fileInfo().fileName(), results);
+        TrackPickerDialog dialog(file.fileName(), results);
 
         if(dialog.exec() == QDialog::Accepted && !dialog.result().isEmpty()) {
             KTRMResult result = dialog.result();
-            Tag *tag = TagTransactionManager::duplicateTag(file.tag());
+            Tag *tag = TagTransactionManager::duplicateTag(file);
 
             if(!result.title().isEmpty())
                 tag->setTitle(result.title());
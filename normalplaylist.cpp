@@ -63,8 +63,8 @@ bool NormalPlaylist::getPolicy(Playlist::Policy p) const {
 }
 
 #if 1
-void NormalPlaylist::read(QDataStream &s) {
-    Playlist::read(s);
+void NormalPlaylist::read(QDataStream &s, bool withIds) {
+    Playlist::read(s, withIds);
 }
 #else
 void NormalPlaylist::read(QDataStream &s) {
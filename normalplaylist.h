@@ -39,7 +39,7 @@ public:
 
     virtual int getType() const { return Playlist::Type::Normal; }
 
-    void read(QDataStream &s);
+    void read(QDataStream &s, bool withIds = false);
 
     virtual bool getPolicy(Policy p) const;
 };
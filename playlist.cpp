@@ -44,7 +44,6 @@
 
 #include <QCursor>
 #include <QDir>
-#include <QDirIterator>
 #include <QToolTip>
 #include <QFile>
 #include <QResizeEvent>
@@ -58,6 +57,8 @@
 #include <QDragEnterEvent>
 #include <QPixmap>
 #include <QStackedWidget>
+#include <QtConcurrentMap>
+#include <QFutureWatcher>
 #include <id3v1genres.h>
 
 #include <time.h>
@@ -81,6 +82,8 @@
 #include "coverdialog.h"
 #include "tagtransactionmanager.h"
 #include "cache.h"
+#include "scanpipeline.h"
+#include "workscheduler.h"
 
 /* ptr to the right-click menu for View|Show Columns and the header on the
  * table. This KMenu object is shared by all Playlist Widgets.
@@ -94,6 +97,324 @@ KActionMenu * Playlist::m_columnVisibleAction;
  */
 quint32 g_trackID = 0;
 
+/**
+ * Rereads the tags of a list of files a few at a time.  Only file names are
+ * kept, so it doesn't matter if items are removed in the meantime.
+ */
+class TagRefreshJob : public WorkJob
+{
+public:
+    TagRefreshJob(const QStringList &files) : m_files(files), m_next(0) {}
+
+    virtual Status runUnit()
+    {
+        if(m_next >= m_files.count())
+            return Done;
+
+        CollectionListItem *item = CollectionList::instance()->lookup(m_files[m_next++]);
+        if(!item)
+            return MoreWork;
+
+        item->refreshFromDisk();
+
+        if(!item->file().tag() || !item->file().fileInfo().exists()) {
+            kDebug() << "Error while trying to refresh the tag.  "
+                     << "This file has probably been removed.";
+            delete item;
+        }
+
+        return MoreWork;
+    }
+
+    virtual void done() { delete this; }
+
+private:
+    QStringList m_files;
+    int m_next;
+};
+
+/**
+ * What checking an m3u entry that the collection doesn't know by its path
+ * found out.  path is empty unless the entry is a readable media file.
+ */
+struct PlaylistEntryCheck
+{
+    QString path;
+    FileStat stat;
+};
+
+/**
+ * Checks the unknown entries of an m3u file on a worker thread.
+ */
+struct PlaylistEntryChecker
+{
+    typedef PlaylistEntryCheck result_type;
+
+    PlaylistEntryCheck operator()(const QString &file) const
+    {
+        PlaylistEntryCheck check;
+        check.stat = FileStat::read(file);
+
+        if(!check.stat.isFile || !MediaFiles::isMediaFile(file))
+            return check;
+
+        const QFileInfo fileInfo(file);
+
+        if(fileInfo.isReadable())
+            check.path = fileInfo.canonicalFilePath();
+
+        return check;
+    }
+};
+
+/**
+ * Creates the items for files added to a playlist, see
+ * Playlist::addFileHelper().  The tags of the files that haven't been read
+ * yet are read on the thread pool, and the items are created in order as the
+ * tags come in.  The item to insert after is guarded, so items may be removed
+ * in the meantime.
+ *
+ * The entries of an m3u file that the collection doesn't know are checked on
+ * the thread pool first, see setUncheckedEntries().
+ */
+class AddFilesJob : public WorkJob
+{
+public:
+    AddFilesJob(Playlist *playlist, const FileHandleList &files, PlaylistItem *after) :
+        m_playlist(playlist),
+        m_files(files),
+        m_after(after),
+        m_hasAfter(after != 0),
+        m_next(0),
+        m_nextCheck(0),
+        m_checking(false),
+        m_nextTrack(0),
+        m_fastProperties(false),
+        m_started(false),
+        m_focus(false),
+        m_distraction(false)
+    {
+    }
+
+    virtual ~AddFilesJob()
+    {
+        // Reads that have started finish on their own, they don't refer to
+        // the playlist.
+
+        m_checker.cancel();
+        m_reader.cancel();
+
+        if(m_distraction && !Playlist::m_shuttingDown)
+            m_playlist->m_collection->lowerDistraction();
+    }
+
+    /**
+     * \a entries are checked before any items are created.  The null files
+     * passed to the constructor stand for them, in the same order.
+     */
+    void setUncheckedEntries(const QStringList &entries)
+    {
+        m_unchecked = entries;
+    }
+
+    /**
+     * Creates the rest of the items right away.
+     */
+    void finish()
+    {
+        if(!m_started)
+            start();
+
+        m_checker.waitForFinished();
+
+        while(m_checking)
+            checkNextEntry();
+
+        m_reader.waitForFinished();
+
+        while(runUnit() == MoreWork)
+            ;
+    }
+
+    bool hadFocus() const { return m_focus; }
+
+    /**
+     * Whether tags were read with estimated audio properties.
+     */
+    bool readEstimated() const { return m_fastProperties && m_nextTrack > 0; }
+
+    virtual Status runUnit()
+    {
+        if(!m_started)
+            start();
+
+        if(m_checking)
+            return checkNextEntry();
+
+        if(m_next >= m_files.count())
+            return Done;
+
+        FileHandle file = m_files[m_next];
+
+        if(!file.hasTag()) {
+
+            // Playlist::slotAddFilesReady() wakes the job up again.
+
+            if(!m_reader.future().isResultReadyAt(m_nextTrack))
+                return Waiting;
+
+            const CachedTrack track = m_reader.future().resultAt(m_nextTrack++);
+
+            // A file that couldn't be read is left to tag() to complain about.
+
+            if(!track.path.isEmpty())
+                file = FileHandle(track);
+        }
+
+        ++m_next;
+
+        // If the item to insert after was removed, the rest go to the end.
+
+        if(m_hasAfter && !m_after)
+            m_after = static_cast<PlaylistItem *>(m_playlist->lastItem());
+
+        PlaylistItem *after = m_after;
+        PlaylistItem *item = m_playlist->createItem(file, after, false);
+
+        if(item)
+            m_after = item;
+
+        m_hasAfter = m_after != 0;
+
+        if(m_next % progressInterval == 0)
+            emit m_playlist->signalAddFilesProgress(m_next, m_files.count());
+
+        return MoreWork;
+    }
+
+    virtual void done() { m_playlist->completedAddingFiles(); }
+
+private:
+    void start()
+    {
+        m_started = true;
+
+        m_focus = m_playlist->hasFocus();
+
+        if(m_playlist->isVisible() && m_files.count() > 20) {
+            m_playlist->m_collection->raiseDistraction();
+            m_distraction = true;
+        }
+
+        if(m_unchecked.isEmpty()) {
+            startReading();
+            return;
+        }
+
+        m_checking = true;
+
+        QObject::connect(&m_checker, SIGNAL(resultsReadyAt(int,int)),
+                         m_playlist, SLOT(slotAddFilesReady()));
+        m_checker.setFuture(QtConcurrent::mapped(m_unchecked, PlaylistEntryChecker()));
+    }
+
+    /**
+     * Puts the file of the next entry in place, or drops the entry if it
+     * isn't a readable media file.  The files are read once all entries are
+     * checked.
+     */
+    Status checkNextEntry()
+    {
+        if(m_next >= m_files.count()) {
+            m_files = m_checkedFiles;
+            m_checkedFiles.clear();
+            m_next = 0;
+            m_checking = false;
+
+            startReading();
+            return MoreWork;
+        }
+
+        FileHandle file = m_files[m_next];
+
+        if(file.isNull()) {
+            if(!m_checker.future().isResultReadyAt(m_nextCheck))
+                return Waiting;
+
+            const PlaylistEntryCheck check = m_checker.future().resultAt(m_nextCheck++);
+
+            if(check.path.isEmpty()) {
+                ++m_next;
+                return MoreWork;
+            }
+
+            // The collection might still have the file under another path.
+
+            const CollectionListItem *item =
+                CollectionList::instance()->lookupByIdentity(check.stat.identity());
+
+            file = item ? item->file() : FileHandle(check.path, check.stat);
+        }
+
+        ++m_next;
+        m_checkedFiles.append(file);
+
+        return MoreWork;
+    }
+
+    void startReading()
+    {
+        QStringList unread;
+        foreach(const FileHandle &file, m_files) {
+            if(!file.hasTag())
+                unread.append(file.absFilePath());
+        }
+
+        m_fastProperties = m_playlist->m_collection->fastTagScan();
+
+        QObject::connect(&m_reader, SIGNAL(resultsReadyAt(int,int)),
+                         m_playlist, SLOT(slotAddFilesReady()));
+        m_reader.setFuture(QtConcurrent::mapped(unread, TrackReader(m_fastProperties)));
+    }
+
+    static const int progressInterval = 200;
+
+    Playlist *m_playlist;
+    FileHandleList m_files;
+    PlaylistItem::Pointer m_after;
+    bool m_hasAfter;
+    int m_next;
+    QStringList m_unchecked;
+    QFutureWatcher<PlaylistEntryCheck> m_checker;
+    int m_nextCheck;
+    FileHandleList m_checkedFiles;
+    bool m_checking;
+    QFutureWatcher<CachedTrack> m_reader;
+    int m_nextTrack;
+    bool m_fastProperties;
+    bool m_started;
+    bool m_focus;
+    bool m_distraction;
+};
+
+/**
+ * Resolves the collection ids of the entries of a restored playlist.
+ */
+class CollectionIdResolver : public PlaylistEntries::Resolver
+{
+public:
+    virtual QString path(quint32 id) const
+    {
+        const CollectionListItem *item = CollectionList::instance()->lookupById(id);
+        return item ? item->file().absFilePath() : QString();
+    }
+
+    virtual bool contains(quint32 id) const
+    {
+        return CollectionList::instance()->lookupById(id) != 0;
+    }
+};
+
 /* current column resize mode is manual or automatic */
 bool Playlist::manualResize()
 {
@@ -419,7 +740,8 @@ Playlist::Playlist(PlaylistCollection *collection, const QString &name,
     m_toolTip(0),
     m_bFileListChanged(false),
     m_bContentMutable(true),
-    m_blockDataChanged(false)
+    m_blockDataChanged(false),
+    m_itemsDeferred(false)
 {
     setup();
     collection->setupPlaylist(this, iconName);
@@ -444,7 +766,8 @@ Playlist::Playlist(PlaylistCollection *collection, const PlaylistItemList &items
     m_toolTip(0),
     m_bFileListChanged(false),
     m_bContentMutable(true),
-    m_blockDataChanged(false)
+    m_blockDataChanged(false),
+    m_itemsDeferred(false)
 {
     setup();
     collection->setupPlaylist(this, iconName);
@@ -470,7 +793,8 @@ Playlist::Playlist(PlaylistCollection *collection, const QFileInfo &playlistFile
     m_toolTip(0),
     m_bFileListChanged(false),
     m_bContentMutable(true),
-    m_blockDataChanged(false)
+    m_blockDataChanged(false),
+    m_itemsDeferred(false)
 {
     setup();
     loadTableFromFile(playlistFile);
@@ -494,7 +818,8 @@ Playlist::Playlist(PlaylistCollection *collection, bool delaySetup, int extraCol
     m_toolTip(0),
     m_bFileListChanged(false),
     m_bContentMutable(true),
-    m_blockDataChanged(false)
+    m_blockDataChanged(false),
+    m_itemsDeferred(false)
 {
     Q_UNUSED(extraColumns);
 
@@ -512,6 +837,8 @@ Playlist::~Playlist()
         ss->writeConfig();
     }
 
+    cancelAddingFiles();
+
     // clearItem() will take care of removing the items from the history,
     // so call clearItems() to make sure it happens.
 
@@ -617,7 +944,7 @@ void Playlist::playNextAlbum()
  */
 int Playlist::count() const
 {
-    return childCount();
+    return m_itemsDeferred ? m_deferredEntries.count(CollectionIdResolver()) : childCount();
 }
 
 /*
@@ -683,6 +1010,8 @@ bool Playlist::saveFile(const QString& fileName, bool bDialogOk)
         return false;
     }
 
+    finishAddingFiles();
+
     QFile file(fileName);
 
     // TODO: write to temp file first before corrupting the original
@@ -708,6 +1037,7 @@ bool Playlist::saveFile(const QString& fileName, bool bDialogOk)
 
     m_bFileListChanged = false;
     m_fileListLastModified = QFileInfo(file).lastModified();
+    m_diskFileLastModified = m_fileListLastModified;
 
     return true;
 }
@@ -716,6 +1046,16 @@ void Playlist::setFileListLastModified(const QDateTime& t) {
     m_fileListLastModified = t;
 }
 
+QDateTime Playlist::diskFileLastModified() const
+{
+    return m_bFileListChanged ? QDateTime() : m_diskFileLastModified;
+}
+
+void Playlist::setDiskFileLastModified(const QDateTime &t)
+{
+    m_diskFileLastModified = t;
+}
+
 void Playlist::setColumnSortEnabled(bool bEnable) {
     /* we use the underlying Q3ListView to store this decision. At some
      * point, we may need a class variable.
@@ -805,7 +1145,7 @@ bool Playlist::exportFile()
 
 void Playlist::updateDeletedItem(PlaylistItem *item)
 {
-    m_members.remove(item->file().absFilePath());
+    m_members.remove(item->collectionItem());
     m_search.clearItem(item);
 
     m_history.removeAll(item);
@@ -853,6 +1193,9 @@ PlaylistItem *Playlist::playingItem() // static
 
 QStringList Playlist::files() const
 {
+    if(m_itemsDeferred)
+        return m_deferredEntries.files(CollectionIdResolver());
+
     QStringList list;
 
     for(Q3ListViewItemIterator it(const_cast<Playlist *>(this)); it.current(); ++it)
@@ -861,6 +1204,21 @@ QStringList Playlist::files() const
     return list;
 }
 
+QVector<quint32> Playlist::collectionIds() const
+{
+    if(m_itemsDeferred)
+        return m_deferredEntries.ids(CollectionIdResolver());
+
+    QVector<quint32> ids;
+
+    for(Q3ListViewItemIterator it(const_cast<Playlist *>(this)); it.current(); ++it) {
+        CollectionListItem *item = static_cast<PlaylistItem *>(*it)->collectionItem();
+        ids.append(item ? item->id() : 0);
+    }
+
+    return ids;
+}
+
 PlaylistItemList Playlist::items()
 {
     return items(Q3ListViewItemIterator::IteratorFlag(0));
@@ -1058,20 +1416,11 @@ void Playlist::slotRefresh()
     if(l.isEmpty())
         l = visibleItems();
 
-    KApplication::setOverrideCursor(Qt::waitCursor);
-    foreach(PlaylistItem *item, l) {
-        item->refreshFromDisk();
-
-        if(!item->file().tag() || !item->file().fileInfo().exists()) {
-            kDebug() << "Error while trying to refresh the tag.  "
-                           << "This file has probably been removed."
-                           << endl;
-            delete item->collectionItem();
-        }
+    QStringList files;
+    foreach(const PlaylistItem *item, l)
+        files.append(item->file().absFilePath());
 
-        processEvents();
-    }
-    KApplication::restoreOverrideCursor();
+    WorkScheduler::instance()->schedule(new TagRefreshJob(files));
 }
 
 void Playlist::slotRenameFile()
@@ -1178,7 +1527,7 @@ void Playlist::slotGuessTagInfo(TagGuesser::Type type)
 
     foreach(PlaylistItem *item, items) {
         item->guessTagInfo(type);
-        processEvents();
+        WorkScheduler::instance()->yieldIfNeeded();
     }
 
     // MusicBrainz queries automatically commit at this point.  What would
@@ -1208,6 +1557,11 @@ void Playlist::slotReload()
         return;
     }
 
+    // Whatever was restored from the cache is replaced anyway.
+
+    m_itemsDeferred = false;
+    m_deferredEntries.clear();
+
     setContentMutable(true);
     clearItems(items());
     loadTableFromFile(fileInfo);
@@ -1607,7 +1961,7 @@ void Playlist::applySharedSettings()
     }
 }
 
-void Playlist::read(QDataStream &s)
+void Playlist::read(QDataStream &s, bool withIds)
 {
     s >> m_playlistName
       >> m_fileName;
@@ -1623,27 +1977,58 @@ void Playlist::read(QDataStream &s)
         setSorting(columns() + 1);
     }
 
-    QStringList files;
-    s >> files;
+    if(!m_deferredEntries.read(s, withIds, CollectionIdResolver()))
+        throw BICStreamException();
 
-    Q3ListViewItem *after = 0;
+    m_itemsDeferred = true;
+
+    // a playlist loaded from cache is marked dirty
+    m_bFileListChanged = true;
+
+    dataChanged();
+    m_collection->setupPlaylist(this, "audio-midi");
+}
+
+void Playlist::materialize()
+{
+    if(!m_itemsDeferred)
+        return;
+
+    m_itemsDeferred = false;
+    loadDeferredItems();
+}
+
+void Playlist::loadDeferredItems()
+{
+    const QVector<quint32> ids = m_deferredEntries.rawIds();
+    const QStringList files = m_deferredEntries.rawFiles();
+
+    m_deferredEntries.clear();
+
+    if(ids.isEmpty())
+        return;
+
+    const CollectionList *collection = CollectionList::instance();
+    PlaylistItem *after = 0;
 
     m_blockDataChanged = true;
 
-    foreach(const QString &file, files) {
-        if(file.isEmpty())
-            throw BICStreamException();
+    for(int i = 0; i < ids.count(); ++i) {
+        CollectionListItem *item = ids[i] ? collection->lookupById(ids[i]) : 0;
+        PlaylistItem *newItem = 0;
 
-        after = createItem(FileHandle(file), after, false);
-    }
+        if(item)
+            newItem = createItem(item, after);
+        else if(!files[i].isEmpty())
+            newItem = createItem(FileHandle(files[i]), after, false);
 
-    // a playlist loaded from cache is marked dirty
-    m_bFileListChanged = true;
+        if(newItem)
+            after = newItem;
+    }
 
     m_blockDataChanged = false;
 
     dataChanged();
-    m_collection->setupPlaylist(this, "audio-midi");
 }
 
 void Playlist::viewportPaintEvent(QPaintEvent *pe)
@@ -1715,6 +2100,8 @@ void Playlist::addFiles(const QStringList &files, PlaylistItem *after)
         return;
     }
 
+    materialize();
+
     if(!after)
         after = static_cast<PlaylistItem *>(lastItem());
 
@@ -1732,16 +2119,21 @@ void Playlist::addFiles(const QStringList &files, PlaylistItem *after)
         m_fileListLastModified = QDateTime::currentDateTime();
     }
 
-    addFileHelper(queue, &after, true);
+    addFileHelper(queue, after);
 
     m_blockDataChanged = false;
 
-    slotWeightDirty();
-    dataChanged();
-
     KApplication::restoreOverrideCursor();
 }
 
+void Playlist::finishAddingFiles()
+{
+    while(!m_addFilesJobs.isEmpty()) {
+        m_addFilesJobs.first()->finish();
+        completedAddingFiles();
+    }
+}
+
 void Playlist::refreshAlbums(const PlaylistItemList &items, coverKey id)
 {
     QList< QPair<QString, QString> > albums;
@@ -1992,18 +2384,20 @@ void Playlist::setDynamicListsFrozen(bool frozen)
 
 CollectionListItem *Playlist::collectionListItem(const FileHandle &file)
 {
+    CollectionListItem *item = CollectionList::instance()->lookup(file.absFilePath());
+
+    if(item)
+        return item;
+
+    // The collection follows the files it has, so only a new one has to be
+    // looked for.
+
     if(!QFile::exists(file.absFilePath())) {
         kError() << "File" << file.absFilePath() << "does not exist.";
         return 0;
     }
 
-    CollectionListItem *item = CollectionList::instance()->lookup(file.absFilePath());
-
-    if(!item) {
-        item = CollectionList::instance()->createItem(file);
-    }
-
-    return item;
+    return CollectionList::instance()->createItem(file);
 }
 
 /* make sure all columns have the correct visibility and width */
@@ -2149,36 +2543,36 @@ void Playlist::loadTableFromList(const QList<QString>& list)
         setSorting(columns() + 1);
     }
 
-    // clear table rows
+    // clear table rows, along with any that were still being added
+    cancelAddingFiles();
+
     if(this->childCount() > 0) {
         clearItems(items());
     }
 
-    PlaylistItem *after = 0;
-
-    m_disableColumnWidthUpdates = true;
-
-    m_blockDataChanged = true;
+    // Most entries are in the collection already, and those are taken from
+    // it without touching the disk.  The others are left for AddFilesJob to
+    // check on the thread pool, with a null file in their place.
 
-    foreach(const QString& itemName, list) {
+    const CollectionList *collection = CollectionList::instance();
+    FileHandleList files;
+    QStringList unknown;
 
-        QFileInfo item(itemName);
+    foreach(const QString &file, list) {
+        const CollectionListItem *item = collection->lookup(file);
 
-        if(item.exists() && item.isFile() && item.isReadable() &&
-           MediaFiles::isMediaFile(item.fileName()))
-        {
-            after = createItem(FileHandle(item, item.absoluteFilePath()), after, false);
+        if(item && !item->file().isNull())
+            files.append(item->file());
+        else {
+            files.append(FileHandle());
+            unknown.append(file);
         }
     }
 
-    m_blockDataChanged = false;
+    addFileHelper(files, 0, unknown);
 
     // this playlist content matches the disk file
     m_bFileListChanged = false;
-
-    dataChanged();
-
-    m_disableColumnWidthUpdates = false;
 }
 
 /* populate table using src, which must identify an .m3u file. Assume that
@@ -2197,6 +2591,7 @@ void Playlist::loadTableFromFile(const QFileInfo& src)
     setContentMutable(true);
 
     m_fileListLastModified = src.lastModified();
+    m_diskFileLastModified = m_fileListLastModified;
 
     loadTableFromList(list);
 }
@@ -2269,6 +2664,8 @@ int Playlist::leftMostVisibleColumn() const
 
 PlaylistItemList Playlist::items(Q3ListViewItemIterator::IteratorFlag flags)
 {
+    materialize();
+
     PlaylistItemList list;
 
     for(Q3ListViewItemIterator it(this, flags); it.current(); ++it)
@@ -2329,91 +2726,125 @@ void Playlist::addFile(const QString &file, FileHandleList &files, bool importPl
         return;
     }
 
-    if(hasItem(file) && !m_allowDuplicates)
+    const QString folder = addFileEntry(file, files, importPlaylists);
+    if(folder.isEmpty())
         return;
 
-    addFileHelper(files, after);
+    // The folder is listed with several threads, which helps a lot on network
+    // file systems.  The files come back sorted, as the order they are found
+    // in isn't fixed.
+
+    const QStringList folderFiles =
+        FolderWalker::listFiles(QStringList(folder), m_collection->excludedFolderSet());
 
+    foreach(const QString &folderFile, folderFiles) {
+        // We set importPlaylists to the value from the add directories
+        // dialog as we want to load all of the ones that the user has
+        // explicitly asked for, but not those that we find in toLower
+        // directories.
+
+        addFileEntry(folderFile, files, m_collection->importPlaylists());
+    }
+}
+
+QString Playlist::addFileEntry(const QString &file, FileHandleList &files, bool importPlaylists)
+{
     // Our biggest thing that we're fighting during startup is too many stats
     // of files.  Make sure that we don't do one here if it's not needed.
 
-    const CollectionListItem *item = CollectionList::instance()->lookup(file);
+    const CollectionList *collection = CollectionList::instance();
+    const CollectionListItem *item = collection->lookup(file);
 
     if(item && !item->file().isNull()) {
-        FileHandle cached(item->file());
-        cached.tag();
-        files.append(cached);
-        return;
+        if(!hasItem(item) || m_allowDuplicates)
+            files.append(item->file());
+        return QString();
     }
 
-    const QFileInfo fileInfo(QDir::cleanPath(file));
-    if(!fileInfo.exists())
-        return;
+    // A single stat() tells whether the file exists and which file it is, so
+    // a file that the collection has under another path, e.g. through a
+    // symlink, is found without resolving this one.
 
-    const QString canonicalPath = fileInfo.canonicalFilePath();
+    const QString path = QDir::cleanPath(file);
+    const FileStat stat = FileStat::read(path);
 
-    if(fileInfo.isFile() && fileInfo.isReadable()) {
-        if(MediaFiles::isMediaFile(file)) {
-            FileHandle f(fileInfo, canonicalPath);
-            f.tag();
-            files.append(f);
+    if(!stat.exists)
+        return QString();
+
+    if(stat.isFile) {
+        item = collection->lookupByIdentity(stat.identity());
+
+        if(item) {
+            if(!hasItem(item) || m_allowDuplicates)
+                files.append(item->file());
+            return QString();
         }
     }
 
+    const QFileInfo fileInfo(path);
+    const QString canonicalPath = fileInfo.canonicalFilePath();
+
+    if(stat.isFile && fileInfo.isReadable()) {
+        if(MediaFiles::isMediaFile(file))
+            files.append(FileHandle(canonicalPath, stat));
+    }
+
     if(importPlaylists && MediaFiles::isPlaylistFile(file)) {
         importRecentPlaylistFile(fileInfo);
-        return;
+        return QString();
     }
 
-    if(fileInfo.isDir()) {
-        foreach(const QString &directory, m_collection->excludedFolders()) {
-            if(canonicalPath.startsWith(directory))
-                return; // Exclude it
-        }
-
-        QDirIterator dirIterator(canonicalPath, QDir::AllEntries | QDir::NoDotAndDotDot);
+    if(stat.isDir) {
+        if(m_collection->isExcluded(canonicalPath))
+            return QString(); // Exclude it
 
-        while(dirIterator.hasNext()) {
-            // We set importPlaylists to the value from the add directories
-            // dialog as we want to load all of the ones that the user has
-            // explicitly asked for, but not those that we find in toLower
-            // directories.
-
-            addFile(dirIterator.next(), files,
-                    m_collection->importPlaylists(), after);
-        }
+        return canonicalPath;
     }
+
+    return QString();
 }
 
-void Playlist::addFileHelper(FileHandleList &files, PlaylistItem **after, bool ignoreTimer)
+void Playlist::addFileHelper(const FileHandleList &files, PlaylistItem *after,
+                             const QStringList &unchecked)
 {
-    static QTime time = QTime::currentTime();
+    if(files.isEmpty())
+        return;
 
-    // Process new items every 10 seconds, when we've loaded 1000 items, or when
-    // it's been requested in the API.
+    AddFilesJob *job = new AddFilesJob(this, files, after);
+    job->setUncheckedEntries(unchecked);
+    m_addFilesJobs.append(job);
 
-    if(ignoreTimer || time.elapsed() > 10000 ||
-       (files.count() >= 1000 && time.elapsed() > 1000))
-    {
-        time.restart();
+    if(m_addFilesJobs.count() == 1)
+        WorkScheduler::instance()->schedule(job);
+}
 
-        const bool focus = hasFocus();
-        const bool visible = isVisible() && files.count() > 20;
+void Playlist::completedAddingFiles()
+{
+    AddFilesJob *job = m_addFilesJobs.takeFirst();
+    const bool focus = job->hadFocus();
+    const bool readEstimated = job->readEstimated();
 
-        if(visible)
-            m_collection->raiseDistraction();
+    // Lowers the distraction, if the job put it up.
 
-        foreach(const FileHandle &fileHandle, files)
-            *after = createItem(fileHandle, *after, false);
+    delete job;
 
-        files.clear();
+    if(!m_addFilesJobs.isEmpty())
+        WorkScheduler::instance()->schedule(m_addFilesJobs.first());
 
-        if(visible)
-            m_collection->lowerDistraction();
+    if(readEstimated)
+        CollectionList::instance()->measureEstimatedTracks();
 
-        if(focus)
-            setFocus();
-    }
+    slotWeightDirty();
+    dataChanged();
+
+    if(focus)
+        setFocus();
+}
+
+void Playlist::cancelAddingFiles()
+{
+    qDeleteAll(m_addFilesJobs);
+    m_addFilesJobs.clear();
 }
 
 /**
@@ -2442,6 +2873,14 @@ void Playlist::importRecentPlaylistFile(const QFileInfo& fileInfo) {
             // clear the existing pl object and populate from m3u disk file
             pl->slotReload();
             return;
+        } else if(pl->m_diskFileLastModified.isValid() &&
+                  fileInfo.lastModified() == pl->m_diskFileLastModified)
+        {
+            // The file hasn't been touched since the cached entries were
+            // read from it or saved to it, so there is no need to read it
+            // again.
+
+            pl->m_bFileListChanged = false;
         } else {
             // compare disk file to cache so we correctly set modified flag
             QList<QString> disk_files;
@@ -2451,6 +2890,7 @@ void Playlist::importRecentPlaylistFile(const QFileInfo& fileInfo) {
                 // compare the two lists
                 if(disk_files == cached_files) {
                     pl->m_bFileListChanged = false;
+                    pl->m_diskFileLastModified = fileInfo.lastModified();
                 }
             }
         }
@@ -2753,7 +3193,7 @@ void Playlist::slotRenameTag()
 
 bool Playlist::editTag(PlaylistItem *item, const QString &text, int column)
 {
-    Tag *newTag = TagTransactionManager::duplicateTag(item->file().tag());
+    Tag *newTag = TagTransactionManager::duplicateTag(item->file());
 
     switch(column)
     {
@@ -2901,6 +3341,12 @@ void Playlist::slotInlineCompletionModeChanged(KGlobalSettings::Completion mode)
     SharedSettings::instance()->setInlineCompletionMode(mode);
 }
 
+void Playlist::slotAddFilesReady()
+{
+    if(!m_addFilesJobs.isEmpty())
+        WorkScheduler::instance()->schedule(m_addFilesJobs.first());
+}
+
 void Playlist::slotPlayCurrent()
 {
     Q3ListViewItemIterator it(this, Q3ListViewItemIterator::Selected);
@@ -2935,18 +3381,6 @@ QDataStream &operator>>(QDataStream &s, Playlist &p)
 }
 #endif
 
-bool processEvents()
-{
-    static QTime time = QTime::currentTime();
-
-    if(time.elapsed() > 100) {
-        time.restart();
-        kapp->processEvents();
-        return true;
-    }
-    return false;
-}
-
 #include "playlist.moc"
 
 // vim: set et sw=4 tw=0 sta:
@@ -34,6 +34,7 @@
 #include "tagguesser.h"
 #include "playlistinterface.h"
 #include "filehandle.h"
+#include "playlistentries.h"
 
 class KMenu;
 class KActionMenu;
@@ -49,6 +50,7 @@ class PlaylistItem;
 class PlaylistCollection;
 class PlaylistToolTip;
 class CollectionListItem;
+class AddFilesJob;
 
 typedef QList<PlaylistItem *> PlaylistItemList;
 
@@ -200,15 +202,37 @@ public:
     static PlaylistItem *playingItem();
 
     /**
-     * All of the (media) files in the list.
+     * All of the (media) files in the list.  For a playlist that hasn't been
+     * materialized yet these are the files it will have.
      */
     QStringList files() const;
 
+    /**
+     * The CollectionListItem::id() of every item, in the same order as
+     * files().
+     */
+    QVector<quint32> collectionIds() const;
+
     /**
      * Returns a list of all of the items in the playlist.
      */
     virtual PlaylistItemList items();
 
+    /**
+     * Playlists restored from the cache don't create their items until they
+     * are needed: when they are shown, when their items are asked for, or
+     * when items are added to them.  This creates them if that hasn't
+     * happened yet.
+     */
+    void materialize();
+    bool isMaterialized() const { return !m_itemsDeferred; }
+
+    /**
+     * Puts off creating the items of a restored playlist until materialize()
+     * is called.
+     */
+    void deferItems() { m_itemsDeferred = true; }
+
     /**
      * Returns a list of all of the \e visible items in the playlist.
      */
@@ -257,9 +281,18 @@ public:
      * Note that this should not be used in the case of adding *only* playlist
      * items since it has the overhead of checking to see if the file is a playlist
      * or directory first.
+     *
+     * The items are created from the event loop as the tags of new files are
+     * read, so they may not all be there yet when this returns.
      */
     virtual void addFiles(const QStringList &files, PlaylistItem *after = 0);
 
+    /**
+     * Creates the items that addFiles() hasn't gotten to yet right away,
+     * waiting for their tags to be read.  Used before the playlist is saved.
+     */
+    void finishAddingFiles();
+
     /**
      * Returns the file name associated with this playlist (an m3u file) or
      * an empty QString if no such file exists.
@@ -445,7 +478,13 @@ public:
      */
     void applySharedSettings();
 
-    void read(QDataStream &s);
+    /**
+     * Reads the playlist as written by operator<<().  If \a withIds is true
+     * that is followed by the collectionIds(), which are then used to find
+     * the items instead of their paths wherever they still agree.  The items
+     * are only created by materialize().
+     */
+    void read(QDataStream &s, bool withIds = false);
 
     static void setShuttingDown() { m_shuttingDown = true; }
 
@@ -565,6 +604,15 @@ public:
      */
     void setFileListLastModified(const QDateTime& t);
 
+    /**
+     * The lastModified() time of the m3u file as of when this playlist was
+     * last read from it or saved to it, or a null time if the playlist has
+     * changed since.  The Cache keeps it, so that importRecentPlaylistFile()
+     * can tell an untouched file without reading it.
+     */
+    QDateTime diskFileLastModified() const;
+    void setDiskFileLastModified(const QDateTime &t);
+
     /**
      * Specify whether the user is permitted to sort this playlist by column.
      * Typically called from a derived Playlist constructor after all columns
@@ -591,13 +639,21 @@ protected:
     virtual void contentsDragEnterEvent(QDragEnterEvent *e);
     virtual void showEvent(QShowEvent *e);
     virtual bool acceptDrag(QDropEvent *e) const;
+    /**
+     * Creates the items that were put off until materialize() was called.
+     */
+    virtual void loadDeferredItems();
+
     virtual void viewportPaintEvent(QPaintEvent *pe);
     virtual void viewportResizeEvent(QResizeEvent *re);
 
     virtual void insertItem(Q3ListViewItem *item);
     virtual void takeItem(Q3ListViewItem *item);
 
-    virtual bool hasItem(const QString &file) const { return m_members.contains(file); }
+    /**
+     * @return true if the playlist already has an item for \a item.
+     */
+    virtual bool hasItem(const CollectionListItem *item) const { return m_members.contains(item); }
 
     virtual int addColumn(const QString &label, int width = -1);
     using K3ListView::addColumn;
@@ -650,6 +706,21 @@ signals:
 
     void signalPlaylistItemsDropped(Playlist *p);
 
+    /**
+     * Emitted now and then while the items for files added with addFiles()
+     * are created.
+     */
+    void signalAddFilesProgress(int added, int count);
+
+protected:
+    /**
+     * Does the work of addFile() for \a file without descending into it.
+     * Media files are appended to \a files, without reading their tags yet.
+     * If \a file is a folder that should be scanned its canonical path is
+     * returned, otherwise an empty string.
+     */
+    QString addFileEntry(const QString &file, FileHandleList &files, bool importPlaylists);
+
 private:
     void setup();
 
@@ -705,8 +776,22 @@ private:
 
     void addFile(const QString &file, FileHandleList &files, bool importPlaylists,
                  PlaylistItem **after);
-    void addFileHelper(FileHandleList &files, PlaylistItem **after,
-                       bool ignoreTimer = false);
+
+    /**
+     * Creates the items for \a files after \a after from the event loop, once
+     * the jobs of earlier calls are done.  The null files in \a files stand
+     * for the paths in \a unchecked, which are checked first.  See
+     * AddFilesJob.
+     */
+    void addFileHelper(const FileHandleList &files, PlaylistItem *after,
+                       const QStringList &unchecked = QStringList());
+
+    void completedAddingFiles();
+
+    /**
+     * Drops the files that the items haven't been created for yet.
+     */
+    void cancelAddingFiles();
 
     void importRecentPlaylistFile(const QFileInfo& fileInfo);
 
@@ -826,15 +911,25 @@ private slots:
      */
     void slotInlineCompletionModeChanged(KGlobalSettings::Completion mode);
 
+    /**
+     * Wakes up the first of the AddFilesJobs when more tags have been read.
+     */
+    void slotAddFilesReady();
+
 public slots:
     void slotPlayCurrent();
 
 private:
     friend class PlaylistItem;
+    friend class AddFilesJob;
 
     PlaylistCollection *m_collection;
 
-    StringHash m_members;
+    /**
+     * The collection items that the items of the playlist belong to, which
+     * is the same for every path that leads to a file.
+     */
+    Hash<const CollectionListItem *> m_members;
 
     WebImageFetcher *m_fetcher;
 
@@ -913,6 +1008,12 @@ private:
      */
     QDateTime m_fileListLastModified;
 
+    /**
+     * The lastModified() time of the m3u file itself when the entries were
+     * last known to match it, see diskFileLastModified().
+     */
+    QDateTime m_diskFileLastModified;
+
     /** 
      * Flag to allow modification of track data. Does not protect the 
      * playlist's name.
@@ -922,12 +1023,22 @@ private:
     /** when true, do not issue dataChanged() calls */
     bool m_blockDataChanged;
 
+    /**
+     * The items of a playlist read from the cache that haven't been created
+     * yet, see materialize().
+     */
+    PlaylistEntries m_deferredEntries;
+    bool m_itemsDeferred;
+
+    /**
+     * Queued by addFileHelper(), only the first one runs.
+     */
+    QList<AddFilesJob *> m_addFilesJobs;
+
 };
 
 typedef QList<Playlist *> PlaylistList;
 
-bool processEvents();
-
 class FocusUpEvent : public QEvent
 {
 public:
@@ -947,7 +1058,7 @@ ItemType *Playlist::createItem(const FileHandle &file, Q3ListViewItem *after,
                                bool emitChanged)
 {
     CollectionListItem *item = collectionListItem(file);
-    if(item && (!m_members.insert(file.absFilePath()) || m_allowDuplicates)) {
+    if(item && (!m_members.insert(item) || m_allowDuplicates)) {
 
         ItemType *i = after ? new ItemType(item, this, after) : new ItemType(item, this);
         setupItem(i);
@@ -966,7 +1077,7 @@ ItemType *Playlist::createItem(SiblingType *sibling, ItemType *after)
 {
     m_disableColumnWidthUpdates = true;
 
-    if(!m_members.insert(sibling->file().absFilePath()) || m_allowDuplicates) {
+    if(!m_members.insert(sibling->collectionItem()) || m_allowDuplicates) {
         after = new ItemType(sibling->collectionItem(), this, after);
         setupItem(after);
     }
@@ -982,6 +1093,8 @@ void Playlist::createItems(const QList<SiblingType *> &siblings, ItemType *after
     if(siblings.isEmpty())
         return;
 
+    materialize();
+
     foreach(SiblingType *sibling, siblings)
         after = createItem(sibling, after);
 
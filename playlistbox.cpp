@@ -27,6 +27,7 @@
 #include <ktoggleaction.h>
 #include <kselectaction.h>
 #include <kconfiggroup.h>
+#include <kurl.h>
 
 #include <Q3Header>
 #include <QPainter>
@@ -225,11 +226,21 @@ void PlaylistBox::duplicate()
 void PlaylistBox::slotScanFolders()
 {
     kDebug() << "Starting folder scan";
-    QTime stopwatch; stopwatch.start();
+
+    connect(CollectionList::instance(), SIGNAL(signalFolderScanFinished()),
+            this, SLOT(slotFolderScanFinished()));
 
     PlaylistCollection::instance()->scanFolders();
+}
+
+void PlaylistBox::slotFolderScanFinished()
+{
+    // Only the startup scan has to be followed up on.
+
+    disconnect(CollectionList::instance(), SIGNAL(signalFolderScanFinished()),
+               this, SLOT(slotFolderScanFinished()));
 
-    kDebug() << "Folder scan complete, took" << stopwatch.elapsed() << "ms";
+    PlaylistCollection::instance()->scanFoldersFinished();
 
     // set the read/write state for each playlist based on m3u writability
     QList<Playlist*> list = this->getAllPlaylists();
@@ -92,6 +92,7 @@ public slots:
     // Called after files loaded to pickup any new files that might be present
     // in managed directories.
     void slotScanFolders();
+    void slotFolderScanFinished();
     void slotFreezePlaylists();
     void slotUnfreezePlaylists();
     void slotPlaylistDataChanged();
@@ -29,7 +29,6 @@
 #include <ktoggleaction.h>
 #include <kactionmenu.h>
 #include <kconfiggroup.h>
-#include <kfileitem.h>
 
 #include <config-juk.h>
 
@@ -52,6 +51,7 @@
 #include "upcomingplaylist.h"
 #include "directorylist.h"
 #include "mediafiles.h"
+#include "scanpipeline.h"
 #include "playlistbox.h"
 #include "playermanager.h"
 #include "tracksequencemanager.h"
@@ -93,6 +93,7 @@ PlaylistCollection::PlaylistCollection(PlayerManager *player, QStackedWidget *pl
     m_playerManager(player),
     m_playlistBox(playlistBox),
     m_importPlaylists(true),
+    m_fastTagScan(true),
     m_searchEnabled(true),
     m_playing(false),
     m_showMorePlaylist(0),
@@ -107,10 +108,6 @@ PlaylistCollection::PlaylistCollection(PlayerManager *player, QStackedWidget *pl
 
     m_actionHandler = new ActionHandler(this);
 
-    // KDirLister's auto error handling seems to crash JuK during startup in
-    // readConfig().
-
-    m_dirLister.setAutoErrorHandlingEnabled(false, playlistStack);
     readConfig();
 }
 
@@ -437,22 +434,22 @@ void PlaylistCollection::addFolder()
 
     if(result.status == QDialog::Accepted) {
 
-        m_dirLister.blockSignals(true);
-
         const bool reload = m_importPlaylists != result.addPlaylists;
 
         m_importPlaylists = result.addPlaylists;
         m_excludedFolderList = canonicalizeFolderPaths(result.excludedDirs);
 
-        foreach(const QString &dir, result.addedDirs) {
-            m_dirLister.openUrl(KUrl::fromPath(dir), KDirLister::Keep);
+        foreach(const QString &dir, result.addedDirs)
             m_folderList.append(dir);
-        }
 
-        foreach(const QString &dir, result.removedDirs) {
-            m_dirLister.stop(KUrl::fromPath(dir));
+        foreach(const QString &dir, result.removedDirs)
             m_folderList.removeAll(dir);
-        }
+
+        updateFolderSets();
+
+        // The added folders are watched once they have been scanned.
+
+        CollectionList::instance()->updateWatchedFolders();
 
         if(reload) {
             open(m_folderList);
@@ -462,8 +459,6 @@ void PlaylistCollection::addFolder()
         }
 
         saveConfig();
-
-        m_dirLister.blockSignals(false);
     }
 }
 
@@ -507,7 +502,7 @@ void PlaylistCollection::remove() {
 void PlaylistCollection::reload()
 {
     if(visiblePlaylist() == CollectionList::instance())
-        CollectionList::instance()->addFiles(m_folderList);
+        CollectionList::instance()->scanFolders(m_folderList, true);
     else
         visiblePlaylist()->slotReload();
 
@@ -577,14 +572,27 @@ PlaylistItemList PlaylistCollection::selectedItems()
 
 void PlaylistCollection::scanFolders()
 {
-    CollectionList::instance()->addFiles(m_folderList);
+    CollectionList::instance()->scanFolders(m_folderList);
+}
 
+void PlaylistCollection::scanFoldersFinished()
+{
     if(CollectionList::instance()->count() == 0)
         addFolder();
 
     enableDirWatch(true);
 }
 
+ScanStatus PlaylistCollection::folderScanStatus() const
+{
+    return CollectionList::instance()->folderScanStatus();
+}
+
+void PlaylistCollection::cancelFolderScan()
+{
+    CollectionList::instance()->cancelFolderScan();
+}
+
 /* called when track widget column is enabled/disabled by menu.
  * \p act is the menu item that changed its checkbox state.
  */
@@ -740,6 +748,7 @@ void PlaylistCollection::raise3(Playlist *playlist)
     // set default initial playlist in case user clicks play button
     TrackSequenceManager::instance()->setDefaultPlaylist(playlist);
 
+    playlist->materialize();
     playlist->applySharedSettings();
     playlist->setSearchEnabled(m_searchEnabled);
     m_playlistStack->setCurrentWidget(playlist);
@@ -807,6 +816,8 @@ void PlaylistCollection::setupPlaylist2(Playlist *playlist, const QString &)
     m_playlistStack->addWidget(playlist);
     QObject::connect(playlist, SIGNAL(selectionChanged()),
                      object(), SIGNAL(signalSelectedItemsChanged()));
+    QObject::connect(playlist, SIGNAL(signalAddFilesProgress(int,int)),
+                     object(), SIGNAL(signalAddFilesProgress(int,int)));
 }
 
 void PlaylistCollection::removePlaylist(Playlist *playlist) {
@@ -845,17 +856,7 @@ void PlaylistCollection::clearShowMore(bool raisePlaylist)
 
 void PlaylistCollection::enableDirWatch(bool enable)
 {
-    QObject *collection = CollectionList::instance();
-
-    m_dirLister.disconnect(object());
-    if(enable) {
-        QObject::connect(&m_dirLister, SIGNAL(newItems(KFileItemList)),
-                object(), SLOT(slotNewItems(KFileItemList)));
-        QObject::connect(&m_dirLister, SIGNAL(refreshItems(QList<QPair<KFileItem,KFileItem> >)),
-                collection, SLOT(slotRefreshItems(QList<QPair<KFileItem,KFileItem> >)));
-        QObject::connect(&m_dirLister, SIGNAL(deleteItem(KFileItem)),
-                collection, SLOT(slotDeleteItem(KFileItem)));
-    }
+    CollectionList::instance()->setWatchingFolders(enable);
 }
 
 QString PlaylistCollection::playlistNameDialog(const QString &caption,
@@ -924,12 +925,10 @@ void PlaylistCollection::dirChanged(const QString &path)
     if(canonicalPath.isEmpty())
         return;
 
-    foreach(const QString &excludedFolder, m_excludedFolderList) {
-        if(canonicalPath.startsWith(excludedFolder))
-            return;
-    }
+    if(m_excludedFolders.contains(canonicalPath))
+        return;
 
-    CollectionList::instance()->addFiles(QStringList(canonicalPath));
+    CollectionList::instance()->scanFolders(QStringList(canonicalPath));
 }
 
 Playlist *PlaylistCollection::playlistByName(const QString &name) const
@@ -955,25 +954,6 @@ Playlist *PlaylistCollection::findPlaylistByFilename(const QString &canonical) c
     return 0;
 }
 
-/**
- * Determine if any item in haystack is a prefix of needle.
- * The compare is case sensitive.
- * @param needle is a canonical dir name
- * @param haystack is a list of canonical dir names.
- * @return true if match is found
- */
-static bool isPrefixOf(const QString& needle, const QStringList& haystack)
-{
-    int needlelen = needle.size();
-    foreach(const QString& h, haystack) {
-        int hlen = h.size();
-        if(hlen <= needlelen && h == needle.left(hlen)) {
-            return true;
-        }
-    }
-    return false;
-}
-
 /* Return true if \p fname is a member of a managed folder.
  * \p fname is absolute, canonical file name of an m3u file.
  * The name comparison is case-sensitive.
@@ -983,45 +963,15 @@ bool PlaylistCollection::isManagedFile(const QString& fname) const
     if(fname.isEmpty()) {
         return false;
     }
-    QString targetDir = QFileInfo(fname).dir().canonicalPath();
-    if(!targetDir.endsWith('/')) {
-        targetDir += '/';
-    }
-    // include these dirs
-    if(isPrefixOf(targetDir, m_folderList)) {
-        // but exclude these dirs
-        if(isPrefixOf(targetDir, m_excludedFolderList)) {
-            return false;
-        }
-        return true;
-    }
-    return false;
+    const QString targetDir = QFileInfo(fname).dir().canonicalPath();
+
+    return isManagedFolder(targetDir);
 }
 
-void PlaylistCollection::newItems(const KFileItemList &list) const
+bool PlaylistCollection::isManagedFolder(const QString &folder) const
 {
-    // Make fast-path for the normal case
-    if(m_excludedFolderList.isEmpty()) {
-        CollectionList::instance()->slotNewItems(list);
-        return;
-    }
-
-    // Slow case: Directories to exclude from consideration
-
-    KFileItemList filteredList(list);
-
-    foreach(const QString &excludedFolder, m_excludedFolderList) {
-        QMutableListIterator<KFileItem> filteredListIterator(filteredList);
-
-        while(filteredListIterator.hasNext()) {
-            const KFileItem fileItem = filteredListIterator.next();
-
-            if(fileItem.url().path().startsWith(excludedFolder))
-                filteredListIterator.remove();
-        }
-    }
-
-    CollectionList::instance()->slotNewItems(filteredList);
+    // include these dirs, but exclude these dirs
+    return m_managedFolders.contains(folder) && !m_excludedFolders.contains(folder);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1033,19 +983,25 @@ void PlaylistCollection::readConfig()
     KConfigGroup config(KGlobal::config(), "Playlists");
 
     m_importPlaylists    = config.readEntry("ImportPlaylists", true);
+    m_fastTagScan        = config.readEntry("FastTagScan", true);
     m_folderList         = config.readEntry("DirectoryList", QStringList());
     m_excludedFolderList = canonicalizeFolderPaths(
             config.readEntry("ExcludeDirectoryList", QStringList()));
 
-    foreach(const QString &folder, m_folderList) {
-        m_dirLister.openUrl(folder, KDirLister::Keep);
-    }
+    updateFolderSets();
+}
+
+void PlaylistCollection::updateFolderSets()
+{
+    m_managedFolders = FolderSet(canonicalizeFolderPaths(m_folderList));
+    m_excludedFolders = FolderSet(m_excludedFolderList);
 }
 
 void PlaylistCollection::saveConfig()
 {
     KConfigGroup config(KGlobal::config(), "Playlists");
     config.writeEntry("ImportPlaylists", m_importPlaylists);
+    config.writeEntry("FastTagScan", m_fastTagScan);
     config.writeEntry("showUpcoming", action("showUpcoming")->isChecked());
     config.writePathEntry("DirectoryList", m_folderList);
     config.writePathEntry("ExcludeDirectoryList", m_excludedFolderList);
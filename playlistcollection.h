@@ -19,10 +19,10 @@
 
 #include "stringhash.h"
 #include "playlistinterface.h"
+#include "folderset.h"
 
 #include <kshortcut.h>
 #include <klocale.h>
-#include <kdirlister.h>
 
 #include <QPointer>
 
@@ -41,6 +41,7 @@ class PlaylistItem;
 class Playlist;
 class PlayerManager;
 class FileHandle;
+struct ScanStatus;
 
 template<class T>
 class QList;
@@ -114,7 +115,18 @@ public:
     virtual PlaylistItemList selectedItems();
 
     // virtual to allow our QWidget subclass to emit a signal after we're done
+    // The scan itself runs in the background, see
+    // CollectionList::signalFolderScanFinished().
     virtual void scanFolders();
+
+    // Follow-up of the initial folder scan: asks for a music folder if the
+    // collection is still empty and starts watching the folders.
+    void scanFoldersFinished();
+
+    // The progress of the background folder scan, and a way to stop one
+    // that is scanning the wrong folder.  See CollectionList::scanFolders().
+    ScanStatus folderScanStatus() const;
+    void cancelFolderScan();
     virtual void toggleColumnVisible(QAction *act);
 
     void createPlaylist();
@@ -139,8 +151,6 @@ public:
      */
     QObject *object() const;
 
-    void newItems(const KFileItemList &list) const;
-
     /**
      * This is the current playlist in all things relating to the player.  It
      * represents the playlist that either should be played from or is currently
@@ -176,6 +186,17 @@ public:
      */
     QStringList excludedFolders() const { return m_excludedFolderList; }
 
+    /**
+     * The same folders as excludedFolders(), ready to be checked against.
+     */
+    const FolderSet &excludedFolderSet() const { return m_excludedFolders; }
+
+    /**
+     * @return true if \a path is in or below one of the excluded folders.
+     * \a path should be canonical.
+     */
+    bool isExcluded(const QString &path) const { return m_excludedFolders.contains(path); }
+
     /**
      * This is used to put up a temporary widget over the top of the playlist
      * stack.  This is part of a trick to significantly speed up painting by
@@ -193,6 +214,12 @@ public:
 
     bool importPlaylists() const;
 
+    /**
+     * Whether new files are read with estimated audio properties, which are
+     * measured exactly later on.  See Tag::readTrack().
+     */
+    bool fastTagScan() const { return m_fastTagScan; }
+
     QString playlistNameDialog(const QString &caption = i18n("Create New Playlist"),
                                const QString &suggest = QString(),
                                bool forceUnique = true) const;
@@ -217,10 +244,22 @@ public:
      */
      bool isManagedFile(const QString& fname) const;
 
+    /**
+     * @return true if the canonical \a folder is one of the music folders or
+     * below one, and not excluded.
+     */
+    bool isManagedFolder(const QString &folder) const;
+
 private:
     void readConfig();
     void saveConfig();
 
+    /**
+     * Rebuilds m_managedFolders and m_excludedFolders after the folder lists
+     * changed.
+     */
+    void updateFolderSets();
+
     QStackedWidget   *m_playlistStack;
     HistoryPlaylist  *m_historyPlaylist;
     UpcomingPlaylist *m_upcomingPlaylist;
@@ -228,12 +267,14 @@ private:
     PlayerManager    *m_playerManager;
     PlaylistBox      *m_playlistBox;
 
-    KDirLister  m_dirLister;
     StringHash  m_playlistNames;
     StringHash  m_playlistFiles;
     QStringList m_folderList;
     QStringList m_excludedFolderList;
+    FolderSet   m_managedFolders;
+    FolderSet   m_excludedFolders;
     bool        m_importPlaylists;
+    bool        m_fastTagScan;
     bool        m_searchEnabled;
     bool        m_playing;
 
@@ -302,11 +343,10 @@ private slots:
     void slotEnableDirWatch(bool enable)             { m_collection->enableDirWatch(enable); }
     void slotDirChanged(const QString &path)         { m_collection->dirChanged(path); }
 
-    void slotNewItems(const KFileItemList &list)     { m_collection->newItems(list); }
-
 signals:
     void signalSelectedItemsChanged();
     void signalCountChanged();
+    void signalAddFilesProgress(int added, int count);
 
 private:
     PlaylistCollection *m_collection;
@@ -0,0 +1,118 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "playlistentries.h"
+
+#include <QtCore/QDataStream>
+
+////////////////////////////////////////////////////////////////////////////////
+// public methods
+////////////////////////////////////////////////////////////////////////////////
+
+void PlaylistEntries::clear()
+{
+    m_ids.clear();
+    m_files.clear();
+}
+
+bool PlaylistEntries::read(QDataStream &s, bool withIds, const Resolver &resolver)
+{
+    clear();
+
+    QStringList files;
+    s >> files;
+
+    QVector<quint32> ids;
+    if(withIds) {
+        s >> ids;
+        if(ids.count() != files.count())
+            return false;
+    }
+    else
+        ids.fill(0, files.count());
+
+    for(int i = 0; i < files.count(); ++i) {
+        if(files[i].isEmpty())
+            return false;
+
+        // Going by the id saves resolving the path and looking it up, but the
+        // path still decides, as the cache may have been written by a
+        // different session than the playlists.  Only keep the path if it
+        // is needed.
+
+        if(ids[i] && resolver.path(ids[i]) == files[i])
+            files[i] = QString();
+        else
+            ids[i] = 0;
+    }
+
+    m_ids = ids;
+    m_files = files;
+
+    return true;
+}
+
+int PlaylistEntries::count(const Resolver &resolver) const
+{
+    int count = 0;
+
+    for(int i = 0; i < m_ids.count(); ++i) {
+        if(resolves(i, resolver))
+            ++count;
+    }
+
+    return count;
+}
+
+QStringList PlaylistEntries::files(const Resolver &resolver) const
+{
+    QStringList list;
+
+    for(int i = 0; i < m_ids.count(); ++i) {
+        if(!m_files[i].isEmpty())
+            list.append(m_files[i]);
+        else {
+            const QString path = resolver.path(m_ids[i]);
+            if(!path.isEmpty())
+                list.append(path);
+        }
+    }
+
+    return list;
+}
+
+QVector<quint32> PlaylistEntries::ids(const Resolver &resolver) const
+{
+    QVector<quint32> list;
+
+    for(int i = 0; i < m_ids.count(); ++i) {
+        if(resolves(i, resolver))
+            list.append(m_ids[i]);
+    }
+
+    return list;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// private methods
+////////////////////////////////////////////////////////////////////////////////
+
+bool PlaylistEntries::resolves(int i, const Resolver &resolver) const
+{
+    return !m_files[i].isEmpty() || resolver.contains(m_ids[i]);
+}
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,89 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_PLAYLISTENTRIES_H
+#define JUK_PLAYLISTENTRIES_H
+
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+class QDataStream;
+
+/**
+ * The entries of a playlist restored from the cache whose items haven't been
+ * created yet, see Playlist::materialize().  Every entry has either its
+ * collection id, or if that didn't lead to the right item when the playlist
+ * was read, its path.
+ *
+ * An entry whose id doesn't lead to an item any more, as the item was removed
+ * from the collection since, is skipped by count(), files() and ids() alike,
+ * so that the lists written to the cache always have the same length.
+ */
+class PlaylistEntries
+{
+public:
+    /**
+     * Tells what became of the collection ids.
+     */
+    class Resolver
+    {
+    public:
+        virtual ~Resolver() {}
+
+        /**
+         * Returns the path of the item with \a id, or an empty string if
+         * there isn't one.
+         */
+        virtual QString path(quint32 id) const = 0;
+
+        virtual bool contains(quint32 id) const { return !path(id).isEmpty(); }
+    };
+
+    bool isEmpty() const { return m_ids.isEmpty(); }
+    void clear();
+
+    /**
+     * Reads the files, and if \a withIds is set the ids after them, in the
+     * form Cache::savePlaylists() writes them.  Returns false if the stream
+     * is damaged, leaving this empty.
+     */
+    bool read(QDataStream &s, bool withIds, const Resolver &resolver);
+
+    /**
+     * Every entry, including the ones that don't resolve any more, with an
+     * id of 0 for the ones that are kept by path.
+     */
+    const QVector<quint32> &rawIds() const { return m_ids; }
+    const QStringList &rawFiles() const { return m_files; }
+
+    int count(const Resolver &resolver) const;
+    QStringList files(const Resolver &resolver) const;
+
+    /**
+     * The ids in the same order as files(), 0 for an entry kept by path.
+     */
+    QVector<quint32> ids(const Resolver &resolver) const;
+
+private:
+    bool resolves(int i, const Resolver &resolver) const;
+
+    QVector<quint32> m_ids;
+    QStringList m_files;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
@@ -117,39 +117,40 @@ const QPixmap *PlaylistItem::pixmap(int column) const
 
 QString PlaylistItem::text(int column) const
 {
-    const Tag *tag = d->fileHandle.tag();
-    if(!tag)
-        return QString();
+    // The tag columns come from the collection's track table, which keeps
+    // them next to those of the other tracks.
+
+    const TrackTable &table = CollectionList::instance()->trackTable();
+    const TrackTable::Row row = m_collectionItem->row();
 
     switch(column) {
     case TrackColumn:
-        return tag->title();
     case ArtistColumn:
-        return tag->artist();
     case AlbumColumn:
-        return tag->album();
+    case GenreColumn:
+    case CommentColumn:
+        return table.text(row, column);
     case CoverColumn:
         return QString();
     case TrackNumberColumn:
-        return tag->track() > 0
-            ? QString::number(tag->track())
+        return table.track(row) > 0
+            ? QString::number(table.track(row))
             : QString();
-    case GenreColumn:
-        return tag->genre();
     case YearColumn:
-        return tag->year() > 0
-            ? QString::number(tag->year())
+        return table.year(row) > 0
+            ? QString::number(table.year(row))
             : QString();
     case LengthColumn:
-        return tag->lengthString();
+    {
+        const Tag *tag = d->fileHandle.tag();
+        return tag ? tag->lengthString() : QString();
+    }
     case BitrateColumn:
-        return QString::number(tag->bitrate());
-    case CommentColumn:
-        return tag->comment();
+        return QString::number(table.bitrate(row));
     case FileNameColumn:
-        return d->fileHandle.fileInfo().fileName();
+        return d->fileHandle.fileName();
     case FullPathColumn:
-        return d->fileHandle.fileInfo().absoluteFilePath();
+        return d->fileHandle.absFilePath();
     default:
         return K3ListViewItem::text(column);
     }
@@ -200,7 +201,7 @@ void PlaylistItem::guessTagInfo(TagGuesser::Type type)
     case TagGuesser::FileName:
     {
         TagGuesser guesser(d->fileHandle.absFilePath());
-        Tag *tag = TagTransactionManager::duplicateTag(d->fileHandle.tag());
+        Tag *tag = TagTransactionManager::duplicateTag(d->fileHandle);
 
         if(!guesser.title().isNull())
             tag->setTitle(guesser.title());
@@ -229,7 +230,7 @@ Playlist *PlaylistItem::playlist() const
 
 QVector<int> PlaylistItem::cachedWidths() const
 {
-    return d->cachedWidths;
+    return CollectionList::instance()->trackTable().widths(m_collectionItem->row());
 }
 
 void PlaylistItem::refresh()
@@ -355,30 +356,32 @@ int PlaylistItem::compare(const PlaylistItem *firstItem, const PlaylistItem *sec
 
     const FileHandle& fileHandle1 = firstItem->d->fileHandle;
     const FileHandle& fileHandle2 = secondItem->d->fileHandle;
-    const Tag *tag1 = fileHandle1.tag();
-    const Tag *tag2 = fileHandle2.tag();
+
+    const TrackTable &table = CollectionList::instance()->trackTable();
+    const TrackTable::Row row1 = firstItem->m_collectionItem->row();
+    const TrackTable::Row row2 = secondItem->m_collectionItem->row();
 
     switch(column) {
     case TrackNumberColumn:
-        if(tag1->track() > tag2->track())
+        if(table.track(row1) > table.track(row2))
             return 1;
-        else if(tag1->track() < tag2->track())
+        else if(table.track(row1) < table.track(row2))
             return -1;
         else
             return 0;
         break;
     case LengthColumn:
-        if(tag1->seconds() > tag2->seconds())
+        if(table.seconds(row1) > table.seconds(row2))
             return 1;
-        else if(tag1->seconds() < tag2->seconds())
+        else if(table.seconds(row1) < table.seconds(row2))
             return -1;
         else
             return 0;
         break;
     case BitrateColumn:
-        if(tag1->bitrate() > tag2->bitrate())
+        if(table.bitrate(row1) > table.bitrate(row2))
             return 1;
-        else if(tag1->bitrate() < tag2->bitrate())
+        else if(table.bitrate(row1) < table.bitrate(row2))
             return -1;
         else
             return 0;
@@ -395,8 +398,8 @@ int PlaylistItem::compare(const PlaylistItem *firstItem, const PlaylistItem *sec
         }
         break;
     default:
-        return QString::localeAwareCompare(firstItem->d->metadata[column],
-                                           secondItem->d->metadata[column]);
+        return QString::compare(table.sortKey(row1, column),
+                                table.sortKey(row2, column));
     }
 }
 
@@ -203,8 +203,6 @@ protected:
         Data(const QString &path) : fileHandle(path) {}
 
         FileHandle fileHandle;
-        QVector<QString> metadata; ///< Artist, album, or genre tags.  Other columns unfilled
-        QVector<int> cachedWidths;
     };
 
     KSharedPtr<Data> data() const { return d; }
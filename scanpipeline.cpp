@@ -0,0 +1,449 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scanpipeline.h"
+
+#include <kdebug.h>
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFileInfo>
+#include <QtCore/QRunnable>
+#include <QtCore/QThread>
+
+#include "mediafiles.h"
+#include "tag.h"
+
+// Enough files queued to keep every reader busy while the walkers wait for
+// the disk, and enough tracks for several batches of the GUI thread.
+
+static const int fileQueueSize = 1024;
+static const int trackQueueSize = 4096;
+
+////////////////////////////////////////////////////////////////////////////////
+// ScanStatus
+////////////////////////////////////////////////////////////////////////////////
+
+void ScanStatus::add(const ScanStatus &other)
+{
+    running = running || other.running;
+    walking = walking || other.walking;
+    foldersVisited += other.foldersVisited;
+    filesFound += other.filesFound;
+    filesRead += other.filesRead;
+    readFailures += other.readFailures;
+    bytesRead += other.bytesRead;
+    queuedFiles += other.queuedFiles;
+    queuedTracks += other.queuedTracks;
+}
+
+double ScanStatus::filesPerSecond() const
+{
+    return elapsed > 0 ? filesRead * 1000.0 / elapsed : 0.0;
+}
+
+double ScanStatus::bytesPerSecond() const
+{
+    return elapsed > 0 ? bytesRead * 1000.0 / elapsed : 0.0;
+}
+
+int ScanStatus::remainingSeconds() const
+{
+    const double rate = filesPerSecond();
+
+    if(walking || rate <= 0.0)
+        return -1;
+
+    return qRound(qMax(0, filesFound - filesRead) / rate);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TrackReader
+////////////////////////////////////////////////////////////////////////////////
+
+CachedTrack TrackReader::operator()(const QString &file) const
+{
+    CachedTrack track;
+
+    if(!Tag::readTrack(file, track, fastProperties))
+        return CachedTrack();
+
+    const FileStat stat = FileStat::read(file);
+
+    track.modificationTime = stat.lastModified;
+    track.size   = stat.size;
+    track.inode  = stat.inode;
+    track.device = stat.device;
+
+    return track;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// FolderWalker
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+class WalkerThread : public QRunnable
+{
+public:
+    WalkerThread(FolderWalker *walker) : m_walker(walker) {}
+    virtual void run() { m_walker->run(); }
+
+private:
+    FolderWalker *m_walker;
+};
+
+class FileLister : public FolderWalker
+{
+public:
+    QStringList files;
+
+protected:
+    virtual bool visitFile(const QString &file, const FileStat &)
+    {
+        QMutexLocker locker(&m_mutex);
+        files.append(file);
+        return true;
+    }
+
+private:
+    QMutex m_mutex;
+};
+
+}
+
+FolderWalker::FolderWalker() :
+    m_previousManifest(0),
+    m_busy(0)
+{
+
+}
+
+FolderWalker::~FolderWalker()
+{
+
+}
+
+void FolderWalker::addFolders(const QStringList &folders)
+{
+    QMutexLocker locker(&m_mutex);
+
+    foreach(const QString &folder, folders) {
+        const QString canonicalPath = QFileInfo(folder).canonicalFilePath();
+
+        if(!canonicalPath.isEmpty())
+            enqueue(canonicalPath);
+    }
+}
+
+void FolderWalker::run()
+{
+    QMutexLocker locker(&m_mutex);
+
+    forever {
+        while(m_folders.isEmpty() && m_busy > 0 && !isCancelled())
+            m_folderAdded.wait(&m_mutex);
+
+        // Nothing left, and nobody who could still find more.
+
+        if(m_folders.isEmpty() || isCancelled())
+            break;
+
+        // Taking the folder found last keeps the walk mostly depth first,
+        // which keeps the list short.
+
+        const QString folder = m_folders.takeLast();
+        ++m_busy;
+        m_foldersVisited.ref();
+
+        locker.unlock();
+
+        FolderManifest::Folder entry;
+        entry.modified = FolderManifest::modificationTime(folder);
+
+        const FolderManifest::Folder *previous =
+            m_previousManifest ? m_previousManifest->find(folder) : 0;
+
+        const bool exists = entry.modified >= 0;
+
+        if(previous && exists && previous->modified == entry.modified)
+            entry.subfolders = previous->subfolders;
+        else {
+            // A folder that changed within the second it is listed in might
+            // change again without its modification time moving on, so that
+            // one is recorded as invalid, to be listed again next time.
+
+            if(entry.modified >= QDateTime::currentDateTime().toTime_t())
+                entry.modified = -1;
+
+            // QDir::System keeps QDirIterator from looking at the type of
+            // every entry, which the lstat() below does anyway.
+
+            QDirIterator it(folder, QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
+
+            while(it.hasNext() && !isCancelled()) {
+                it.next();
+
+                // The folder is canonical, so an entry in it is as well,
+                // unless it is a symlink.  Only those have to be resolved.
+
+                QString canonicalPath = it.filePath();
+                FileStat stat = FileStat::read(canonicalPath, false);
+
+                if(stat.isSymLink) {
+                    canonicalPath = QFileInfo(canonicalPath).canonicalFilePath();
+
+                    if(canonicalPath.isEmpty())
+                        continue;
+
+                    stat = FileStat::read(canonicalPath);
+                }
+
+                if(stat.isDir)
+                    entry.subfolders.append(canonicalPath);
+                else if(stat.isFile) {
+                    if(!visitFile(canonicalPath, stat))
+                        m_cancelled = 1;
+                }
+            }
+        }
+
+        locker.relock();
+
+        foreach(const QString &subfolder, entry.subfolders)
+            enqueue(subfolder);
+
+        if(exists)
+            m_manifest.insert(folder, entry);
+
+        --m_busy;
+        m_folderAdded.wakeAll();
+    }
+}
+
+void FolderWalker::cancel()
+{
+    QMutexLocker locker(&m_mutex);
+    m_cancelled = 1;
+    m_folderAdded.wakeAll();
+}
+
+QStringList FolderWalker::listFiles(const QStringList &folders, // static
+                                    const FolderSet &excludedFolders, int threads)
+{
+    FileLister lister;
+    lister.setExcludedFolders(excludedFolders);
+    lister.addFolders(folders);
+
+    // The calling thread walks as well.
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, threads - 1));
+
+    for(int i = 1; i < threads; ++i)
+        pool.start(new WalkerThread(&lister));
+
+    lister.run();
+    pool.waitForDone();
+
+    lister.files.sort();
+    return lister.files;
+}
+
+void FolderWalker::enqueue(const QString &folder)
+{
+    if(m_excludedFolders.contains(folder) || m_visited.contains(folder))
+        return;
+
+    m_visited.insert(folder);
+    m_folders.append(folder);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ScanPipeline::Stage
+////////////////////////////////////////////////////////////////////////////////
+
+class ScanPipeline::Stage : public QRunnable
+{
+public:
+    Stage(ScanPipeline *pipeline, void (ScanPipeline::*run)()) :
+        m_pipeline(pipeline),
+        m_run(run) {}
+
+    virtual void run() { (m_pipeline->*m_run)(); }
+
+private:
+    ScanPipeline *m_pipeline;
+    void (ScanPipeline::*m_run)();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// public methods
+////////////////////////////////////////////////////////////////////////////////
+
+ScanPipeline::ScanPipeline(QObject *parent) :
+    QObject(parent),
+    m_walker(this),
+    m_importPlaylists(false),
+    m_fastProperties(false),
+    m_files(fileQueueSize),
+    m_tracks(trackQueueSize),
+    m_bytesRead(0)
+{
+
+}
+
+ScanPipeline::~ScanPipeline()
+{
+    cancel();
+}
+
+void ScanPipeline::start(const QStringList &folders)
+{
+    const int readers = qMax(1, QThread::idealThreadCount());
+
+    m_walker.addFolders(folders);
+    m_files.setProducers(FolderWalker::defaultThreads);
+    m_tracks.setProducers(readers);
+
+    m_threads.setMaxThreadCount(FolderWalker::defaultThreads + readers);
+
+    for(int i = 0; i < FolderWalker::defaultThreads; ++i)
+        m_threads.start(new Stage(this, &ScanPipeline::walk));
+
+    for(int i = 0; i < readers; ++i)
+        m_threads.start(new Stage(this, &ScanPipeline::read));
+}
+
+void ScanPipeline::cancel()
+{
+    m_cancelled = 1;
+    m_walker.cancel();
+    m_files.cancel();
+    m_tracks.cancel();
+    m_threads.waitForDone();
+}
+
+int ScanPipeline::takeTracks(CachedTrackList &tracks, int max)
+{
+    return m_tracks.take(tracks, max);
+}
+
+ScanStatus ScanPipeline::status() const
+{
+    ScanStatus status;
+
+    status.running = !isFinished();
+    status.walking = m_files.hasProducers();
+    status.foldersVisited = m_walker.foldersVisited();
+    status.filesFound = m_filesFound;
+    status.filesRead = m_filesRead;
+    status.readFailures = m_readFailures;
+    status.queuedFiles = m_files.count();
+    status.queuedTracks = m_tracks.count();
+
+    QMutexLocker locker(&m_bytesMutex);
+    status.bytesRead = m_bytesRead;
+
+    return status;
+}
+
+QStringList ScanPipeline::takePlaylistFiles()
+{
+    QMutexLocker locker(&m_playlistMutex);
+
+    const QStringList files = m_playlistFiles;
+    m_playlistFiles.clear();
+    return files;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// private methods
+////////////////////////////////////////////////////////////////////////////////
+
+void ScanPipeline::walk()
+{
+    m_walker.run();
+    m_files.removeProducer();
+}
+
+void ScanPipeline::read()
+{
+    const TrackReader reader(m_fastProperties);
+    QString file;
+
+    while(m_files.pop(file)) {
+        const CachedTrack track = reader(file);
+
+        m_filesRead.ref();
+
+        if(track.path.isEmpty()) {
+            m_readFailures.ref();
+            continue;
+        }
+
+        {
+            QMutexLocker locker(&m_bytesMutex);
+            m_bytesRead += qMax(qint64(0), track.size);
+        }
+
+        bool wasEmpty = false;
+
+        if(!m_tracks.push(track, &wasEmpty))
+            break;
+
+        if(wasEmpty)
+            emit signalTracksReady();
+    }
+
+    if(m_tracks.removeProducer() && !m_cancelled)
+        emit signalTracksReady();
+}
+
+bool ScanPipeline::Walker::visitFile(const QString &file, const FileStat &)
+{
+    if(m_pipeline->m_knownFiles.contains(file))
+        return true;
+
+    // One look at the suffix settles nearly every file; the rest cost a
+    // single mime type lookup, see MediaFiles::formatOf().
+
+    const MediaFiles::Format format = MediaFiles::roughFormatOf(file);
+
+    if(format == MediaFiles::Unknown)
+        return true;
+
+    if(format == MediaFiles::Playlist) {
+        if(m_pipeline->m_importPlaylists) {
+            QMutexLocker locker(&m_pipeline->m_playlistMutex);
+            m_pipeline->m_playlistFiles.append(file);
+        }
+
+        return true;
+    }
+
+    if(!QFileInfo(file).isReadable())
+        return true;
+
+    m_pipeline->m_filesFound.ref();
+    return m_pipeline->m_files.push(file);
+}
+
+#include "scanpipeline.moc"
+
+// vim: set et sw=4 tw=0 sta:
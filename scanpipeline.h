@@ -0,0 +1,481 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_SCANPIPELINE_H
+#define JUK_SCANPIPELINE_H
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QQueue>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+#include <QtCore/QWaitCondition>
+
+#include "cachefile.h"
+#include "foldermanifest.h"
+#include "folderset.h"
+
+/**
+ * Reads a single file with Tag::readTrack() and fills in its FileStat
+ * fingerprint.  Returns a track with an empty path if the file couldn't be
+ * read.  Safe to use from any thread, e.g. with QtConcurrent::mapped().
+ */
+struct TrackReader
+{
+    typedef CachedTrack result_type;
+
+    /**
+     * See Tag::readTrack() for \a fastProperties.
+     */
+    explicit TrackReader(bool fastProperties = false) : fastProperties(fastProperties) {}
+
+    CachedTrack operator()(const QString &file) const;
+
+    bool fastProperties;
+};
+
+/**
+ * The progress of a folder scan, see CollectionList::folderScanStatus().
+ */
+struct ScanStatus
+{
+    ScanStatus() : running(false), walking(false), foldersVisited(0), filesFound(0),
+        filesRead(0), readFailures(0), bytesRead(0), queuedFiles(0), queuedTracks(0),
+        elapsed(0) {}
+
+    /**
+     * Adds the counters of \a other, e.g. an earlier part of the same scan.
+     */
+    void add(const ScanStatus &other);
+
+    double filesPerSecond() const;
+    double bytesPerSecond() const;
+
+    /**
+     * Returns the number of seconds until every file found is read, or -1
+     * while that can't be told yet, e.g. as more files are still being
+     * found.
+     */
+    int remainingSeconds() const;
+
+    bool running;
+    bool walking;       ///< Still listing folders, so filesFound still grows.
+    int foldersVisited;
+    int filesFound;     ///< New media files.
+    int filesRead;      ///< Including the readFailures.
+    int readFailures;
+    qint64 bytesRead;   ///< The total size of the files read.
+    int queuedFiles;    ///< Found, but not read yet.
+    int queuedTracks;   ///< Read, but not in the collection yet.
+    int elapsed;        ///< Milliseconds.
+};
+
+/**
+ * A queue between two stages of a ScanPipeline.  It blocks the producers
+ * while it is full and the consumers while it is empty, until all of the
+ * producers are done.
+ */
+template <class T>
+class ScanQueue
+{
+public:
+    explicit ScanQueue(int capacity) :
+        m_capacity(capacity),
+        m_producers(0),
+        m_cancelled(false) {}
+
+    void setProducers(int producers)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_producers = producers;
+    }
+
+    /**
+     * Adds \a item, waiting for room first.  \a wasEmpty is set if the queue
+     * was empty before.  Returns false if the queue was cancelled.
+     */
+    bool push(const T &item, bool *wasEmpty = 0)
+    {
+        QMutexLocker locker(&m_mutex);
+
+        while(m_items.count() >= m_capacity && !m_cancelled)
+            m_notFull.wait(&m_mutex);
+
+        if(m_cancelled)
+            return false;
+
+        if(wasEmpty)
+            *wasEmpty = m_items.isEmpty();
+
+        m_items.enqueue(item);
+        m_notEmpty.wakeOne();
+        return true;
+    }
+
+    /**
+     * Takes the next item, waiting for one if needed.  Returns false once
+     * the queue is drained or cancelled.
+     */
+    bool pop(T &item)
+    {
+        QMutexLocker locker(&m_mutex);
+
+        while(m_items.isEmpty() && m_producers > 0 && !m_cancelled)
+            m_notEmpty.wait(&m_mutex);
+
+        if(m_cancelled || m_items.isEmpty())
+            return false;
+
+        item = m_items.dequeue();
+        m_notFull.wakeOne();
+        return true;
+    }
+
+    /**
+     * Moves up to \a max items to \a items without waiting.  Returns the
+     * number of items moved.
+     */
+    template <class List>
+    int take(List &items, int max)
+    {
+        QMutexLocker locker(&m_mutex);
+
+        int count = 0;
+        while(count < max && !m_items.isEmpty()) {
+            items.append(m_items.dequeue());
+            ++count;
+        }
+
+        if(count > 0)
+            m_notFull.wakeAll();
+
+        return count;
+    }
+
+    /**
+     * Called by every producer when it's done.  Returns true for the last
+     * one.
+     */
+    bool removeProducer()
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if(--m_producers > 0)
+            return false;
+
+        m_notEmpty.wakeAll();
+        return true;
+    }
+
+    bool isDrained() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_producers <= 0 && m_items.isEmpty();
+    }
+
+    /**
+     * Returns true until every producer is done.
+     */
+    bool hasProducers() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_producers > 0;
+    }
+
+    int count() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_items.count();
+    }
+
+    /**
+     * Drops everything queued and makes every waiting or later call return
+     * false.
+     */
+    void cancel()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_cancelled = true;
+        m_items.clear();
+        m_notEmpty.wakeAll();
+        m_notFull.wakeAll();
+    }
+
+private:
+    mutable QMutex m_mutex;
+    QWaitCondition m_notEmpty;
+    QWaitCondition m_notFull;
+    QQueue<T> m_items;
+    int m_capacity;
+    int m_producers;
+    bool m_cancelled;
+};
+
+/**
+ * Lists everything below a set of folders with several threads at once.
+ * Every thread that calls run() takes the next folder from a shared list,
+ * lists its entries, hands the files to visitFile() and adds the subfolders
+ * to the list, until every folder is done.  So sibling folders are listed
+ * concurrently, which hides the latency of network file systems and keeps
+ * fast disks busy.
+ *
+ * A folder reached twice, through a symlink or overlapping folders, is only
+ * listed once, and the excluded folders aren't descended into at all.
+ *
+ * Every folder reached is recorded in manifest().  With the manifest of an
+ * earlier walk, folders that haven't changed since aren't listed again: their
+ * subfolders are taken from that manifest and their files aren't visited.
+ */
+class FolderWalker
+{
+public:
+    /**
+     * Listing folders mostly means waiting for the file system, so this many
+     * threads pay off regardless of the number of cores.
+     */
+    static const int defaultThreads = 4;
+
+    FolderWalker();
+    virtual ~FolderWalker();
+
+    /**
+     * Must be set before the first run().
+     */
+    void setExcludedFolders(const FolderSet &folders) { m_excludedFolders = folders; }
+
+    /**
+     * The manifest of an earlier walk, which must stay around until the walk
+     * is done.  Must be set before the first run().
+     */
+    void setPreviousManifest(const FolderManifest *manifest) { m_previousManifest = manifest; }
+
+    /**
+     * The folders reached by the walk.  Only complete once every run() has
+     * returned, and only usable if the walk wasn't cancelled.
+     */
+    const FolderManifest &manifest() const { return m_manifest; }
+
+    /**
+     * The number of folders the walk went through so far, including the
+     * unchanged ones that weren't listed.
+     */
+    int foldersVisited() const { return m_foldersVisited; }
+
+    /**
+     * Adds \a folders to the walk.  Must be called before the first run().
+     */
+    void addFolders(const QStringList &folders);
+
+    /**
+     * Walks until every folder has been listed or the walk is cancelled.
+     * Meant to be called from several threads at once.
+     */
+    void run();
+
+    /**
+     * Makes every run() return as soon as possible.
+     */
+    void cancel();
+
+    /**
+     * Lists all of the files below \a folders, sorted, with \a threads
+     * threads.  Blocks until the walk is done.
+     */
+    static QStringList listFiles(const QStringList &folders, const FolderSet &excludedFolders,
+                                 int threads = defaultThreads);
+
+protected:
+    /**
+     * Called from the walking threads for every regular file found, with its
+     * canonical path and its status.  Returning false cancels the walk.
+     */
+    virtual bool visitFile(const QString &file, const FileStat &stat) = 0;
+
+private:
+    bool isCancelled() const { return m_cancelled; }
+
+    /**
+     * Adds \a folder to the folders to be listed unless it is excluded or
+     * was added before.  m_mutex must be held.
+     */
+    void enqueue(const QString &folder);
+
+    FolderSet m_excludedFolders;
+    const FolderManifest *m_previousManifest;
+
+    QMutex m_mutex;
+    QWaitCondition m_folderAdded;
+    QStringList m_folders;   ///< Waiting to be listed.
+    QSet<QString> m_visited; ///< Every folder ever added to m_folders.
+    int m_busy;              ///< Threads listing a folder right now.
+    FolderManifest m_manifest;
+
+    QAtomicInt m_foldersVisited;
+    QAtomicInt m_cancelled;
+};
+
+/**
+ * Finds and reads the media files below a set of folders in three stages:
+ *
+ * \li a few FolderWalker threads list the folders and queue the media files
+ *     that aren't in the collection yet,
+ * \li a thread per core reads those with TrackReader,
+ * \li the GUI thread collects the results in batches with takeTracks().
+ *
+ * Both queues are bounded, so a stage that falls behind holds up the ones
+ * before it instead of piling up files in memory.  The threads belong to the
+ * pipeline, not the global thread pool, as they spend most of their time
+ * waiting for the disk or for each other.
+ */
+class ScanPipeline : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ScanPipeline(QObject *parent = 0);
+
+    /**
+     * Cancels the scan and waits for the threads to stop.
+     */
+    virtual ~ScanPipeline();
+
+    /**
+     * Files that are skipped without being read.  Must be set before start().
+     */
+    void setKnownFiles(const QSet<QString> &files) { m_knownFiles = files; }
+
+    /**
+     * Folders that aren't descended into.  Must be set before start().
+     */
+    void setExcludedFolders(const FolderSet &folders) { m_walker.setExcludedFolders(folders); }
+
+    /**
+     * Whether to collect the playlist files found, see takePlaylistFiles().
+     * Must be set before start().
+     */
+    void setImportPlaylists(bool import) { m_importPlaylists = import; }
+
+    /**
+     * Skips the folders that haven't changed since \a manifest was recorded,
+     * see FolderWalker.  Must be set before start().
+     */
+    void setPreviousManifest(const FolderManifest *manifest) { m_walker.setPreviousManifest(manifest); }
+
+    /**
+     * Whether the files are read with estimated audio properties.  Must be
+     * set before start().
+     */
+    void setFastProperties(bool fast) { m_fastProperties = fast; }
+
+    /**
+     * Starts scanning \a folders.  Can only be called once.
+     */
+    void start(const QStringList &folders);
+
+    /**
+     * Stops all of the stages as soon as possible and drops the tracks that
+     * haven't been taken yet.  Blocks until the threads have stopped.
+     */
+    void cancel();
+
+    /**
+     * Moves up to \a max of the tracks read so far to \a tracks.  Returns the
+     * number of tracks moved.
+     */
+    int takeTracks(CachedTrackList &tracks, int max);
+
+    /**
+     * Returns the playlist files found.  Only complete once isFinished().
+     */
+    QStringList takePlaylistFiles();
+
+    /**
+     * Returns true once every file has been read and every track has been
+     * taken.
+     */
+    bool isFinished() const { return m_tracks.isDrained(); }
+
+    /**
+     * The number of media files found so far, and how many of those have
+     * been read.  Some may have failed to read.
+     */
+    int filesFound() const { return m_filesFound; }
+    int filesRead() const { return m_filesRead; }
+
+    /**
+     * Everything known about the progress of the scan so far.  Can be called
+     * from any thread.  The elapsed time is left to the caller.
+     */
+    ScanStatus status() const;
+
+    /**
+     * The folders scanned, for the next scan.  Only complete once
+     * isFinished().
+     */
+    const FolderManifest &manifest() const { return m_walker.manifest(); }
+
+signals:
+    /**
+     * Emitted from a reader thread when tracks are available after the queue
+     * had been emptied by takeTracks(), and once the scan is finished.
+     * Connect to it from the GUI thread to get a queued connection.
+     */
+    void signalTracksReady();
+
+private:
+    class Stage;
+
+    class Walker : public FolderWalker
+    {
+    public:
+        Walker(ScanPipeline *pipeline) : m_pipeline(pipeline) {}
+
+    protected:
+        virtual bool visitFile(const QString &file, const FileStat &stat);
+
+    private:
+        ScanPipeline *m_pipeline;
+    };
+
+    void walk();
+    void read();
+
+    QThreadPool m_threads;
+    Walker m_walker;
+    QSet<QString> m_knownFiles;
+    bool m_importPlaylists;
+    bool m_fastProperties;
+
+    ScanQueue<QString> m_files;
+    ScanQueue<CachedTrack> m_tracks;
+
+    QMutex m_playlistMutex;
+    QStringList m_playlistFiles;
+
+    QAtomicInt m_filesFound;
+    QAtomicInt m_filesRead;
+    QAtomicInt m_readFailures;
+    QAtomicInt m_cancelled;
+
+    mutable QMutex m_bytesMutex;
+    qint64 m_bytesRead;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
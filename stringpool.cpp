@@ -0,0 +1,156 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stringpool.h"
+
+#include <QtCore/QHash>
+
+// A power of two, so that a hash is turned into a slot with a mask.  The
+// table grows once it is three quarters full, which keeps the probe
+// sequences short.
+
+static const int initialSlots = 1024;
+
+////////////////////////////////////////////////////////////////////////////////
+// public methods
+////////////////////////////////////////////////////////////////////////////////
+
+StringPool *StringPool::instance() // static
+{
+    // Never deleted, so that items destroyed on exit can still release
+    // their strings.
+
+    static StringPool *pool = new StringPool;
+    return pool;
+}
+
+StringPool::StringPool() :
+    m_slots(initialSlots)
+{
+
+}
+
+QString StringPool::intern(const QString &s)
+{
+    if(s.isEmpty())
+        return s;
+
+    if((m_statistics.strings + 1) * 4 > m_slots.size() * 3)
+        grow();
+
+    const uint hash = qHash(s);
+    Slot &slot = m_slots[find(s, hash)];
+
+    ++m_statistics.lookups;
+
+    if(slot.refs > 0) {
+        ++slot.refs;
+        ++m_statistics.hits;
+        m_statistics.bytesSaved += s.size() * sizeof(QChar);
+        return slot.string;
+    }
+
+    slot.string = s;
+    slot.hash = hash;
+    slot.refs = 1;
+    ++m_statistics.strings;
+
+    return s;
+}
+
+void StringPool::release(const QString &s)
+{
+    if(s.isEmpty())
+        return;
+
+    const int i = find(s, qHash(s));
+    Slot &slot = m_slots[i];
+
+    if(slot.refs == 0)
+        return;
+
+    if(--slot.refs > 0)
+        m_statistics.bytesSaved -= s.size() * sizeof(QChar);
+    else
+        remove(i);
+}
+
+StringPool::Statistics StringPool::statistics() const
+{
+    return m_statistics;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// private methods
+////////////////////////////////////////////////////////////////////////////////
+
+int StringPool::find(const QString &s, uint hash) const
+{
+    const int mask = m_slots.size() - 1;
+    int i = hash & mask;
+
+    while(m_slots[i].refs > 0 && (m_slots[i].hash != hash || m_slots[i].string != s))
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+void StringPool::remove(int slot)
+{
+    // Rather than leaving a marker behind, the strings after the freed slot
+    // that probed past it are moved back, so lookups never get longer.
+
+    const int mask = m_slots.size() - 1;
+    int hole = slot;
+    int i = slot;
+
+    forever {
+        i = (i + 1) & mask;
+
+        if(m_slots[i].refs == 0)
+            break;
+
+        const int home = m_slots[i].hash & mask;
+
+        // The string may move into the hole unless its home slot lies
+        // between the two, counting around the end of the table.
+
+        const bool stays = hole < i ? (home > hole && home <= i)
+                                    : (home > hole || home <= i);
+
+        if(!stays) {
+            m_slots[hole] = m_slots[i];
+            hole = i;
+        }
+    }
+
+    m_slots[hole] = Slot();
+    --m_statistics.strings;
+}
+
+void StringPool::grow()
+{
+    const QVector<Slot> old = m_slots;
+
+    m_slots = QVector<Slot>(old.size() * 2);
+
+    foreach(const Slot &slot, old) {
+        if(slot.refs > 0)
+            m_slots[find(slot.string, slot.hash)] = slot;
+    }
+}
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,94 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_STRINGPOOL_H
+#define JUK_STRINGPOOL_H
+
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+/**
+ * Keeps one copy of every artist, album, genre and so on that repeats across
+ * the collection, so that all the tags with the same value share its data.
+ *
+ * Every intern() takes a reference on the pooled string, which has to be
+ * given back with release() once the holder is done with it; the string
+ * leaves the pool with its last reference.  Getting that wrong costs sharing,
+ * but never correctness, since the holders keep their own implicitly shared
+ * copies either way.
+ *
+ * instance() is the pool of the tag values.  TrackTable keeps a pool of its
+ * own for its sort keys, so that the two don't skew each other's
+ * statistics.
+ *
+ * Like Tag, the pool may only be used from the GUI thread.
+ */
+class StringPool
+{
+public:
+    struct Statistics
+    {
+        Statistics() : strings(0), lookups(0), hits(0), bytesSaved(0) {}
+
+        int strings;       ///< Distinct strings in the pool.
+        quint64 lookups;   ///< Calls to intern() with a non-empty string.
+        quint64 hits;      ///< Those that found the string pooled already.
+        qint64 bytesSaved; ///< What the references beyond the first would take unshared.
+
+        double hitRate() const { return lookups > 0 ? double(hits) / lookups : 0.0; }
+    };
+
+    StringPool();
+
+    static StringPool *instance();
+
+    /**
+     * Returns the pooled copy of \a s, adding \a s if it isn't there yet,
+     * and takes a reference on it.  Empty strings aren't pooled.
+     */
+    QString intern(const QString &s);
+
+    /**
+     * Gives back a reference taken by intern().
+     */
+    void release(const QString &s);
+
+    Statistics statistics() const;
+
+private:
+    struct Slot
+    {
+        Slot() : hash(0), refs(0) {}
+
+        QString string;
+        uint hash;
+        int refs; ///< 0 if the slot is free.
+    };
+
+    /**
+     * Returns the slot holding \a s, or the free slot it would go into.
+     */
+    int find(const QString &s, uint hash) const;
+    void remove(int slot);
+    void grow();
+
+    QVector<Slot> m_slots;
+    Statistics m_statistics;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
@@ -28,8 +28,22 @@
 #include <id3v2framefactory.h>
 
 #include "cache.h"
+#include "cachefile.h"
 #include "mediafiles.h"
-#include "stringshare.h"
+#include "stringpool.h"
+
+static QString lengthStringFor(int totalSeconds)
+{
+    const int seconds = totalSeconds % 60;
+    const int minutes = (totalSeconds - seconds) / 60;
+
+    return QString::number(minutes) + (seconds >= 10 ? ":" : ":0") + QString::number(seconds);
+}
+
+static quint32 pictureHash(const QByteArray &picture)
+{
+    return picture.isEmpty() ? 0 : CacheFile::checksum(picture.constData(), picture.size());
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // public members
@@ -38,10 +52,14 @@
 
 Tag::Tag(const QString &fileName) :
     m_fileName(fileName),
+    m_seconds(0),
+    m_embeddedArtHash(0),
     m_track(0),
     m_year(0),
-    m_seconds(0),
     m_bitrate(0),
+    m_estimatedProperties(false),
+    m_embeddedArtKnown(false),
+    m_hasEmbeddedArt(false),
     m_isValid(false)
 {
     if(fileName.isEmpty()) {
@@ -50,17 +68,46 @@ Tag::Tag(const QString &fileName) :
         return;
     }
 
-    TagLib::File *file = MediaFiles::fileFactoryByType(fileName);
-    if(file && file->isValid()) {
-        setup(file);
-        delete file;
-    }
-    else {
-        kError() << "Couldn't resolve the mime type of \"" <<
-            fileName << "\" -- this shouldn't happen." << endl;
+    CachedTrack track;
+
+    if(readTrack(fileName, track)) {
+        read(track);
+        m_isValid = true;
     }
 }
 
+Tag::Tag(const Tag &tag) :
+    m_fileName(tag.m_fileName),
+    m_title(tag.m_title),
+    m_artist(tag.m_artist),
+    m_album(tag.m_album),
+    m_genre(tag.m_genre),
+    m_comment(tag.m_comment),
+    m_seconds(tag.m_seconds),
+    m_embeddedArtHash(tag.m_embeddedArtHash),
+    m_track(tag.m_track),
+    m_year(tag.m_year),
+    m_bitrate(tag.m_bitrate),
+    m_estimatedProperties(tag.m_estimatedProperties),
+    m_embeddedArtKnown(tag.m_embeddedArtKnown),
+    m_hasEmbeddedArt(tag.m_hasEmbeddedArt),
+    m_isValid(tag.m_isValid)
+{
+    // The copy holds references of its own.
+
+    StringPool *pool = StringPool::instance();
+
+    m_comment = pool->intern(m_comment);
+    m_artist  = pool->intern(m_artist);
+    m_album   = pool->intern(m_album);
+    m_genre   = pool->intern(m_genre);
+}
+
+Tag::~Tag()
+{
+    releaseSharedStrings();
+}
+
 bool Tag::save()
 {
     bool result;
@@ -86,6 +133,25 @@ bool Tag::save()
     return result;
 }
 
+void Tag::setAudioProperties(int seconds, int bitrate)
+{
+    m_seconds = seconds;
+    m_bitrate = packed(bitrate);
+    m_estimatedProperties = false;
+}
+
+void Tag::setEmbeddedArt(const QByteArray &picture)
+{
+    m_embeddedArtKnown = true;
+    m_hasEmbeddedArt = !picture.isEmpty();
+    m_embeddedArtHash = pictureHash(picture);
+}
+
+QString Tag::lengthString() const
+{
+    return lengthStringFor(m_seconds);
+}
+
 QString Tag::playingString() const
 {
     QString str;
@@ -101,6 +167,12 @@ QString Tag::playingString() const
 
 CacheDataStream &Tag::read(CacheDataStream &s)
 {
+    releaseSharedStrings();
+
+    // The length string is made when it is asked for.
+
+    QString lengthString;
+
     switch(s.cacheVersion()) {
     case 1: {
         qint32 track;
@@ -116,12 +188,12 @@ CacheDataStream &Tag::read(CacheDataStream &s)
           >> year
           >> m_comment
           >> bitrate
-          >> m_lengthString
+          >> lengthString
           >> seconds;
 
-        m_track = track;
-        m_year = year;
-        m_bitrate = bitrate;
+        m_track = packed(track);
+        m_year = packed(year);
+        m_bitrate = packed(bitrate);
         m_seconds = seconds;
         break;
     }
@@ -129,6 +201,8 @@ CacheDataStream &Tag::read(CacheDataStream &s)
         static QString dummyString;
         static int dummyInt;
         QString bitrateString;
+        int track;
+        int year;
 
         s >> dummyInt
           >> m_title
@@ -136,18 +210,21 @@ CacheDataStream &Tag::read(CacheDataStream &s)
           >> m_album
           >> m_genre
           >> dummyInt
-          >> m_track
+          >> track
           >> dummyString
-          >> m_year
+          >> year
           >> dummyString
           >> m_comment
           >> bitrateString
-          >> m_lengthString
+          >> lengthString
           >> m_seconds
           >> dummyString;
 
+        m_track = packed(track);
+        m_year = packed(year);
+
         bool ok;
-        m_bitrate = bitrateString.toInt(&ok);
+        m_bitrate = packed(bitrateString.toInt(&ok));
         if(!ok)
             m_bitrate = 0;
         break;
@@ -158,66 +235,139 @@ CacheDataStream &Tag::read(CacheDataStream &s)
     return s;
 }
 
+bool Tag::readTrack(const QString &fileName, CachedTrack &track, bool fastProperties) // static
+{
+    const MediaFiles::Format format = MediaFiles::formatOf(fileName);
+    TagLib::File *file = MediaFiles::fileFactoryByType(fileName, format,
+        fastProperties ? TagLib::AudioProperties::Fast : TagLib::AudioProperties::Average);
+
+    if(!file || !file->isValid()) {
+        kError() << "Couldn't resolve the mime type of \"" <<
+            fileName << "\" -- this shouldn't happen." << endl;
+        delete file;
+        return false;
+    }
+
+    if(!file->tag()) {
+        kWarning() << "Can't setup invalid file" << fileName;
+        delete file;
+        return false;
+    }
+
+    track.path    = fileName;
+    track.title   = TStringToQString(file->tag()->title()).trimmed();
+    track.artist  = TStringToQString(file->tag()->artist()).trimmed();
+    track.album   = TStringToQString(file->tag()->album()).trimmed();
+    track.genre   = TStringToQString(file->tag()->genre()).trimmed();
+    track.comment = TStringToQString(file->tag()->comment()).trimmed();
+
+    track.track = file->tag()->track();
+    track.year  = file->tag()->year();
+
+    if(file->audioProperties()) {
+        track.seconds = file->audioProperties()->length();
+        track.bitrate = file->audioProperties()->bitrate();
+    }
+
+    // The other formats keep their length in a header, so it's exact either
+    // way.  A variable bitrate MP3 without a Xing header is the one that has
+    // to be read through for it.
+
+    track.estimatedProperties = fastProperties && format == MediaFiles::MP3;
+
+    // While the file is open anyway, so that the cover column doesn't have
+    // to open it again.
+
+    const QByteArray picture = MediaFiles::embeddedArt(file);
+
+    track.embeddedArtKnown = true;
+    track.hasEmbeddedArt = !picture.isEmpty();
+    track.embeddedArtHash = pictureHash(picture);
+
+    if(track.title.isEmpty()) {
+        int i = fileName.lastIndexOf('/');
+        int j = fileName.lastIndexOf('.');
+        track.title = i > 0 ? fileName.mid(i + 1, j - i - 1) : fileName;
+    }
+
+    delete file;
+    return true;
+}
+
+void Tag::read(const CachedTrack &track)
+{
+    releaseSharedStrings();
+
+    m_title   = track.title;
+    m_artist  = track.artist;
+    m_album   = track.album;
+    m_genre   = track.genre;
+    m_comment = track.comment;
+    m_track   = packed(track.track);
+    m_year    = packed(track.year);
+    m_seconds = track.seconds;
+    m_bitrate = packed(track.bitrate);
+    m_estimatedProperties = track.estimatedProperties;
+    m_embeddedArtKnown = track.embeddedArtKnown;
+    m_hasEmbeddedArt = track.hasEmbeddedArt;
+    m_embeddedArtHash = track.embeddedArtHash;
+
+    // The cache only shares the values within each of its chunks, so the
+    // pool is what shares them across the whole collection.
+
+    minimizeMemoryUsage();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // private methods
 ////////////////////////////////////////////////////////////////////////////////
 
 Tag::Tag(const QString &fileName, bool) :
     m_fileName(fileName),
+    m_seconds(0),
+    m_embeddedArtHash(0),
     m_track(0),
     m_year(0),
-    m_seconds(0),
     m_bitrate(0),
+    m_estimatedProperties(false),
+    m_embeddedArtKnown(false),
+    m_hasEmbeddedArt(false),
     m_isValid(true)
 {
 
 }
 
-void Tag::setup(TagLib::File *file)
+void Tag::minimizeMemoryUsage()
 {
-    if(!file || !file->tag()) {
-        kWarning() << "Can't setup invalid file" << m_fileName;
-        return;
-    }
-
-    m_title   = TStringToQString(file->tag()->title()).trimmed();
-    m_artist  = TStringToQString(file->tag()->artist()).trimmed();
-    m_album   = TStringToQString(file->tag()->album()).trimmed();
-    m_genre   = TStringToQString(file->tag()->genre()).trimmed();
-    m_comment = TStringToQString(file->tag()->comment()).trimmed();
-
-    m_track = file->tag()->track();
-    m_year  = file->tag()->year();
+    // Try to reduce memory usage: share tags that frequently repeat, squeeze others
 
-    m_seconds = file->audioProperties()->length();
-    m_bitrate = file->audioProperties()->bitrate();
+    m_title.squeeze();
 
-    const int seconds = m_seconds % 60;
-    const int minutes = (m_seconds - seconds) / 60;
+    StringPool *pool = StringPool::instance();
 
-    m_lengthString = QString::number(minutes) + (seconds >= 10 ? ":" : ":0") + QString::number(seconds);
+    m_comment = pool->intern(m_comment);
+    m_artist  = pool->intern(m_artist);
+    m_album   = pool->intern(m_album);
+    m_genre   = pool->intern(m_genre);
+}
 
-    if(m_title.isEmpty()) {
-        int i = m_fileName.lastIndexOf('/');
-        int j = m_fileName.lastIndexOf('.');
-        m_title = i > 0 ? m_fileName.mid(i + 1, j - i - 1) : m_fileName;
-    }
+void Tag::releaseSharedStrings()
+{
+    StringPool *pool = StringPool::instance();
 
-    minimizeMemoryUsage();
-    m_isValid = true;
+    pool->release(m_comment);
+    pool->release(m_artist);
+    pool->release(m_album);
+    pool->release(m_genre);
 }
 
-void Tag::minimizeMemoryUsage()
+void Tag::share(QString &field, const QString &value) // static
 {
-    // Try to reduce memory usage: share tags that frequently repeat, squeeze others
-
-    m_title.squeeze();
-    m_lengthString.squeeze();
+    StringPool *pool = StringPool::instance();
 
-    m_comment = StringShare::tryShare(m_comment);
-    m_artist  = StringShare::tryShare(m_artist);
-    m_album   = StringShare::tryShare(m_album);
-    m_genre   = StringShare::tryShare(m_genre);
+    const QString shared = pool->intern(value);
+    pool->release(field);
+    field = shared;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
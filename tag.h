@@ -20,9 +20,8 @@
 
 #include <QDateTime>
 
-namespace TagLib { class File; }
-
 class CacheDataStream;
+struct CachedTrack;
 
 /*!
  * This should really be called "metadata" and may at some point be titled as
@@ -38,6 +37,8 @@ public:
      * Create an empty tag.  Used in FileHandle for cache restoration.
      */
     Tag(const QString &fileName, bool);
+    Tag(const Tag &tag);
+    ~Tag();
 
     bool save();
 
@@ -49,28 +50,55 @@ public:
     int year() const { return m_year; }
     QString comment() const { return m_comment; }
 
+    /**
+     * Empty for the Tag of a FileHandle, which keeps the path itself.  Only
+     * the copies that TagTransactionManager writes out have one.
+     */
     QString fileName() const { return m_fileName; }
 
     void setTitle(const QString &value) { m_title = value; }
-    void setArtist(const QString &value) { m_artist = value; }
-    void setAlbum(const QString &value) { m_album = value; }
-    void setGenre(const QString &value) { m_genre = value; }
-    void setTrack(int value) { m_track = value; }
-    void setYear(int value) { m_year = value; }
-    void setComment(const QString &value) { m_comment = value; }
+    void setArtist(const QString &value) { share(m_artist, value); }
+    void setAlbum(const QString &value) { share(m_album, value); }
+    void setGenre(const QString &value) { share(m_genre, value); }
+    void setTrack(int value) { m_track = packed(value); }
+    void setYear(int value) { m_year = packed(value); }
+    void setComment(const QString &value) { share(m_comment, value); }
 
     void setFileName(const QString &value) { m_fileName = value; }
 
     int seconds() const { return m_seconds; }
     int bitrate() const { return m_bitrate; }
 
+    /**
+     * True if seconds() and bitrate() are estimates from a fast read, see
+     * readTrack().
+     */
+    bool hasEstimatedProperties() const { return m_estimatedProperties; }
+
+    /**
+     * Replaces the estimated length and bitrate with exact ones.
+     */
+    void setAudioProperties(int seconds, int bitrate);
+
+    /**
+     * Whether the file has a cover picture in its tags, as found when it was
+     * read, and the CacheFile::checksum() of that picture.  Only meaningful
+     * if isEmbeddedArtKnown(), which it isn't for tracks from older caches.
+     */
+    bool isEmbeddedArtKnown() const { return m_embeddedArtKnown; }
+    bool hasEmbeddedArt() const { return m_hasEmbeddedArt; }
+    quint32 embeddedArtHash() const { return m_embeddedArtHash; }
+
+    void setEmbeddedArt(const QByteArray &picture);
+
     bool isValid() const { return m_isValid; }
 
     /**
      * As a convenience, since producing a length string from a number of second
-     * isn't a one liner, provide the length in string form.
+     * isn't a one liner, provide the length in string form.  It is only made
+     * when asked for, since few of them are on screen at a time.
      */
-    QString lengthString() const { return m_lengthString; }
+    QString lengthString() const;
 
     /**
      * Convenience function to return a concise string describing the track,
@@ -80,9 +108,40 @@ public:
 
     CacheDataStream &read(CacheDataStream &s);
 
+    /**
+     * Fills in the tag from a record of the memory mapped collection cache.
+     */
+    void read(const CachedTrack &track);
+
+    /**
+     * Reads the tags, audio properties and embedded art of \a fileName into
+     * \a track, opening the file only once.
+     * Unlike the rest of Tag this may be used from any thread, which is how
+     * folder scans read many files at once.  Returns false if the file
+     * couldn't be read.
+     *
+     * With \a fastProperties TagLib doesn't look further into the file than
+     * it needs for the tags, so the length and bitrate of some formats are
+     * only estimates.  Those tracks have CachedTrack::estimatedProperties set.
+     */
+    static bool readTrack(const QString &fileName, CachedTrack &track,
+                          bool fastProperties = false);
+
 private:
-    void setup(TagLib::File *file);
+    Tag &operator=(const Tag &); // not implemented
+
+    /**
+     * Replaces \a field with the pooled copy of \a value, see StringPool.
+     */
+    static void share(QString &field, const QString &value);
+
+    /**
+     * Track numbers, years and bitrates all fit into 16 bits.
+     */
+    static quint16 packed(int value) { return quint16(qBound(0, value, 0xffff)); }
+
     void minimizeMemoryUsage();
+    void releaseSharedStrings();
 
     QString m_fileName;
     QString m_title;
@@ -90,13 +149,18 @@ private:
     QString m_album;
     QString m_genre;
     QString m_comment;
-    int m_track;
-    int m_year;
+
+    // There is one of these for every track, so the numbers are packed.
+
     int m_seconds;
-    int m_bitrate;
-    QDateTime m_modificationTime;
-    QString m_lengthString;
-    bool m_isValid;
+    quint32 m_embeddedArtHash;
+    quint16 m_track;
+    quint16 m_year;
+    quint16 m_bitrate;
+    bool m_estimatedProperties : 1;
+    bool m_embeddedArtKnown : 1;
+    bool m_hasEmbeddedArt : 1;
+    bool m_isValid : 1;
 };
 
 QDataStream &operator<<(QDataStream &s, const Tag &t);
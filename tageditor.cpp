@@ -225,7 +225,7 @@ void TagEditor::slotRefresh()
     trackNameBox->setText(tag->title());
     albumNameBox->setEditText(tag->album());
 
-    fileNameBox->setText(item->file().fileInfo().fileName());
+    fileNameBox->setText(item->file().fileName());
     fileNameBox->setToolTip(item->file().absFilePath());
 
     bitrateBox->setText(QString::number(tag->bitrate()));
@@ -553,7 +553,7 @@ void TagEditor::save(const PlaylistItemList &list)
             if(list.count() > 1)
                 fileName = item->file().fileInfo().absoluteFilePath();
 
-            Tag *tag = TagTransactionManager::duplicateTag(item->file().tag(), fileName);
+            Tag *tag = TagTransactionManager::duplicateTag(item->file(), fileName);
 
             // A bit more ugliness.  If there are multiple files that are
             // being modified, they each have a "enabled" checkbox that
@@ -85,12 +85,10 @@ void TagTransactionManager::changeTagOnItem(PlaylistItem *item, Tag *newTag)
     m_list.append(TagTransactionAtom(item->collectionItem(), newTag));
 }
 
-Tag *TagTransactionManager::duplicateTag(const Tag *tag, const QString &fileName)
+Tag *TagTransactionManager::duplicateTag(const FileHandle &file, const QString &fileName)
 {
-    Q_ASSERT(tag);
-
-    QString name = fileName.isEmpty() ? tag->fileName() : fileName;
-    Tag *newTag = new Tag(*tag);
+    QString name = fileName.isEmpty() ? file.absFilePath() : fileName;
+    Tag *newTag = new Tag(*file.tag());
 
     newTag->setFileName(name);
     return newTag;
@@ -166,7 +164,7 @@ bool TagTransactionManager::processChangeList(bool undo)
 
         QFileInfo newFile(tag->fileName());
 
-        if(item->file().fileInfo().fileName() != newFile.fileName()) {
+        if(item->file().fileName() != newFile.fileName()) {
             if(!renameFile(item->file().fileInfo(), newFile)) {
                 errorItems.append(item->text(1) + QString(" - ") + item->text(0));
                 continue;
@@ -175,7 +173,7 @@ bool TagTransactionManager::processChangeList(bool undo)
 
         if(tag->save()) {
             if(!undo)
-                m_undoList.append(TagTransactionAtom(item, duplicateTag(item->file().tag())));
+                m_undoList.append(TagTransactionAtom(item, duplicateTag(item->file())));
 
             item->file().setFile(tag->fileName());
             item->refreshFromDisk();
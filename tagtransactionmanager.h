@@ -23,6 +23,7 @@
 class PlaylistItem;
 class QWidget;
 class Tag;
+class FileHandle;
 class QFileInfo;
 
 /**
@@ -139,14 +140,13 @@ class TagTransactionManager : public QObject
      * Convienience function to duplicate a Tag object, since the Tag
      * object doesn't have a decent copy constructor.
      *
-     * @param tag The Tag to duplicate.
+     * @param file The file whose Tag to duplicate.
      * @param fileName The filename to assign to the tag.  If an empty QString
-     *        (the default) is passed, the filename of the existing tag is
-     *        used.
+     *        (the default) is passed, the path of \a file is used.
      * @bug Tag should have a correct copy ctor and assignment operator.
      * @return The duplicate Tag.
      */
-    static Tag *duplicateTag(const Tag *tag, const QString &fileName = QString());
+    static Tag *duplicateTag(const FileHandle &file, const QString &fileName = QString());
 
     /**
      * Commits the changes to the PlaylistItems.  It is important that the
@@ -0,0 +1,252 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Times the collection cache on a synthetic library, without any of the GUI:
+ *
+ * \code
+ * cachebenchmark [tracks] [directory]
+ * \endcode
+ *
+ * writes a cache of \a tracks tracks (100000 by default) to \a directory (the
+ * temporary directory by default) the way Cache::writeCacheFile() does,
+ * decodes it again on the global thread pool the way
+ * Cache::loadCachedItemsInParallel() does, and then appends and replays a
+ * journal of changes to a tenth of the tracks.  The file system checks done
+ * while loading are left out, as the files don't exist.
+ */
+
+#include "cachefile.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+#include <QtCore/QtConcurrentMap>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+static const int defaultTrackCount = 100000;
+
+/**
+ * A library where every artist has a few albums of about a dozen tracks, as
+ * that decides how much the strings repeat.  Always the same for the same
+ * number of tracks.
+ */
+static CachedTrackList syntheticLibrary(int count)
+{
+    static const char * const genres[] = {
+        "Rock", "Pop", "Jazz", "Classical", "Electronic", "Hip-Hop", "Folk",
+        "Blues", "Metal", "Soundtrack", "Reggae", "Country"
+    };
+    static const int genreCount = sizeof(genres) / sizeof(genres[0]);
+
+    qsrand(count);
+
+    CachedTrackList tracks;
+    tracks.reserve(count);
+
+    QString artist, album, genre;
+    int albumTracks = 0;
+    int albumNumber = 0;
+    int artistAlbums = 0;
+    int artistNumber = 0;
+
+    for(int i = 0; i < count; ++i) {
+        if(albumTracks == 0) {
+            if(artistAlbums == 0) {
+                artist = QString("Artist %1").arg(++artistNumber);
+                genre = genres[qrand() % genreCount];
+                artistAlbums = 1 + qrand() % 5;
+            }
+
+            album = QString("Album %1 of %2").arg(++albumNumber).arg(artist);
+            albumTracks = 8 + qrand() % 10;
+            --artistAlbums;
+        }
+
+        CachedTrack track;
+        track.track = 1 + (qrand() % 20);
+        track.title = QString("Title of track %1 with some more words").arg(i);
+        track.artist = artist;
+        track.album = album;
+        track.genre = genre;
+        track.comment = qrand() % 10 == 0 ? QString("Ripped by somebody") : QString();
+        track.path = QString("/home/user/Music/%1/%2/%3 - %4.ogg")
+            .arg(artist, album).arg(track.track, 2, 10, QChar('0')).arg(track.title);
+        track.year = 1960 + qrand() % 55;
+        track.seconds = 120 + qrand() % 300;
+        track.bitrate = 128 + 32 * (qrand() % 6);
+        track.modificationTime = QDateTime::fromTime_t(1300000000 + qrand());
+        track.size = 3000000 + qrand() % 7000000;
+        track.inode = 1000 + i;
+        track.device = 2049;
+        track.id = i + 1;
+
+        tracks.append(track);
+        --albumTracks;
+    }
+
+    return tracks;
+}
+
+struct ChunkDecoder
+{
+    typedef int result_type;
+
+    ChunkDecoder(const CacheFileReader *reader) : reader(reader) {}
+
+    int operator()(int chunk) const
+    {
+        CachedTrackChunk result;
+        reader->readChunk(chunk, result);
+        return result.tracks.count();
+    }
+
+    const CacheFileReader *reader;
+};
+
+static void sum(int &total, int count)
+{
+    total += count;
+}
+
+static long peakResidentKiB()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void report(const char *phase, int items, qint64 nsecs)
+{
+    const double seconds = nsecs / 1e9;
+    printf("%-10s %9d items %10.1f ms %12.0f items/s %10ld KiB peak RSS\n",
+           phase, items, seconds * 1000, seconds > 0 ? items / seconds : 0.0,
+           peakResidentKiB());
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+
+    const int count = args.count() > 1 ? args[1].toInt() : defaultTrackCount;
+    const QString dir = args.count() > 2 ? args[2] : QDir::tempPath();
+
+    if(count <= 0) {
+        fprintf(stderr, "usage: %s [tracks] [directory]\n", argv[0]);
+        return 1;
+    }
+
+    const QString cacheFileName = dir + "/cachebenchmark.cache";
+    const QString journalFileName = dir + "/cachebenchmark.journal";
+
+    printf("%d tracks, %d threads\n", count, QThreadPool::globalInstance()->maxThreadCount());
+
+    QElapsedTimer timer;
+
+    // Generate
+
+    timer.start();
+    const CachedTrackList tracks = syntheticLibrary(count);
+    report("generate", count, timer.nsecsElapsed());
+
+    // Save
+
+    timer.start();
+    {
+        QFile f(cacheFileName);
+        if(!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            fprintf(stderr, "unable to write %s\n", qPrintable(cacheFileName));
+            return 1;
+        }
+
+        CacheFileWriter writer;
+        foreach(const CachedTrack &track, tracks)
+            writer.addTrack(track);
+
+        if(!writer.write(&f) || !f.flush()) {
+            fprintf(stderr, "unable to write %s\n", qPrintable(cacheFileName));
+            return 1;
+        }
+    }
+    report("save", count, timer.nsecsElapsed());
+
+    // Load
+
+    timer.start();
+    int loaded = 0;
+    {
+        CacheFileReader reader;
+        if(!reader.open(cacheFileName)) {
+            fprintf(stderr, "unable to read %s\n", qPrintable(cacheFileName));
+            return 1;
+        }
+
+        QList<int> chunks;
+        for(int i = 0; i < reader.chunkCount(); ++i)
+            chunks << i;
+
+        loaded = QtConcurrent::blockingMappedReduced<int>(chunks, ChunkDecoder(&reader), sum);
+    }
+    report("load", loaded, timer.nsecsElapsed());
+
+    if(loaded != count) {
+        fprintf(stderr, "loaded %d of %d tracks\n", loaded, count);
+        return 1;
+    }
+
+    // Journal
+
+    const int changes = qMax(1, count / 10);
+
+    QFile::remove(journalFileName);
+
+    timer.start();
+    {
+        CacheJournal journal;
+        journal.open(journalFileName);
+        for(int i = 0; i < changes; ++i)
+            journal.append(CacheJournal::Modify, tracks[(i * 7) % count]);
+        journal.flush();
+    }
+    report("journal", changes, timer.nsecsElapsed());
+
+    timer.start();
+    QList<CacheJournal::Entry> entries;
+    {
+        CacheJournal journal;
+        journal.open(journalFileName, &entries);
+    }
+    report("replay", entries.count(), timer.nsecsElapsed());
+
+    printf("cache file %lld bytes, %.1f bytes per track\n",
+           QFileInfo(cacheFileName).size(),
+           double(QFileInfo(cacheFileName).size()) / count);
+    printf("journal file %lld bytes\n", QFileInfo(journalFileName).size());
+
+    QFile::remove(cacheFileName);
+    QFile::remove(journalFileName);
+
+    return 0;
+}
+
+// vim: set et sw=4 tw=0 sta:
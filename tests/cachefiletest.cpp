@@ -0,0 +1,672 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cachefile.h"
+
+#include <qtest_kde.h>
+#include <ktempdir.h>
+
+#include <QtCore/QBuffer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QtEndian>
+
+// The offsets of the header and chunk index fields, as in cachefile.cpp.
+
+static const int headerVersion    = 0;
+static const int headerRecordSize = 8;
+static const int headerChunkCount = 16;
+static const int headerIndex      = 24;
+static const int headerChecksum   = 32;
+
+static const int indexOffset      = 0;
+static const int indexRecordCount = 12;
+static const int indexValueCount  = 20;
+
+static const int recordArtist = 16;
+
+static const int valueEntrySize = 8;
+
+class CacheFileTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRoundTrip();
+    void testTruncated();
+    void testWrongVersion();
+    void testBadRecordSize();
+    void testChecksum();
+    void testDamagedChunk();
+    void testDamagedIndex();
+    void testJournal();
+    void testJournalTornTail();
+    void testJournalDiscardBefore();
+    void testJournalReplay();
+
+private:
+    static CachedTrackList library(int count);
+    static QByteArray write(const CachedTrackList &tracks);
+    static void compareTracks(const CachedTrack &track, const CachedTrack &expected);
+
+    /**
+     * Decodes the value table of \a chunk straight from the file.
+     */
+    static QStringList chunkValues(const QByteArray &data, int chunk);
+
+    /**
+     * Fixes up the checksum of the header and index after they were changed
+     * on purpose, so that open() has to find the change on its own.
+     */
+    static void resign(QByteArray &data);
+
+    QString save(const QByteArray &data);
+
+    /**
+     * Starts a journal with a Modify entry for each of \a tracks, flushed one
+     * at a time.  The size of the journal after each one goes to \a ends.
+     */
+    QString writeJournal(const CachedTrackList &tracks, QList<qint64> *ends = 0);
+
+    static bool changeByte(const QString &fileName, qint64 position);
+
+    KTempDir m_dir;
+};
+
+void CacheFileTest::testRoundTrip()
+{
+    // Three chunks, the last one partly filled.  The tracks on either side
+    // of the first chunk boundary share their artist.
+
+    const CachedTrackList tracks = library(2 * CacheFile::chunkRecords + 37);
+    const QString sharedArtist = tracks[CacheFile::chunkRecords].artist;
+
+    QVERIFY(!sharedArtist.isEmpty());
+    QCOMPARE(tracks[CacheFile::chunkRecords - 1].artist, sharedArtist);
+
+    const QByteArray data = write(tracks);
+
+    CacheFileReader reader;
+    QVERIFY(reader.open(save(data)));
+    QCOMPARE(reader.count(), tracks.count());
+    QCOMPARE(reader.chunkCount(), 3);
+
+    CachedTrackList read;
+
+    for(int i = 0; i < reader.chunkCount(); ++i) {
+        CachedTrackChunk chunk;
+        QVERIFY(reader.readChunk(i, chunk));
+        QVERIFY(chunk.damagedTracks.isEmpty());
+        read += chunk.tracks;
+    }
+
+    QCOMPARE(read.count(), tracks.count());
+
+    for(int i = 0; i < tracks.count(); ++i) {
+        compareTracks(read[i], tracks[i]);
+        if(QTest::currentTestFailed())
+            return;
+    }
+
+    // Every chunk has each of its values once, starting with the empty
+    // string, whether or not the chunk before it had them too.
+
+    for(int i = 0; i < reader.chunkCount(); ++i) {
+        const QStringList values = chunkValues(data, i);
+
+        QVERIFY(!values.isEmpty());
+        QVERIFY(values.first().isEmpty());
+        QCOMPARE(values.toSet().count(), values.count());
+
+        QSet<QString> expected;
+        expected.insert(QString());
+
+        foreach(const CachedTrack &track, tracks.mid(i * CacheFile::chunkRecords,
+                                                     CacheFile::chunkRecords))
+        {
+            expected << track.artist << track.album << track.genre << track.comment;
+        }
+
+        QCOMPARE(values.toSet(), expected);
+    }
+
+    QVERIFY(chunkValues(data, 0).contains(sharedArtist));
+    QVERIFY(chunkValues(data, 1).contains(sharedArtist));
+
+    // An empty value refers to the first one.
+
+    const uchar *d = reinterpret_cast<const uchar *>(data.constData());
+    const uchar *records = d + qFromLittleEndian<quint64>(
+        d + qFromLittleEndian<quint64>(d + headerIndex) + indexOffset);
+
+    for(int i = 0; i < CacheFile::chunkRecords; ++i) {
+        if(tracks[i].artist.isEmpty()) {
+            const uchar *record = records + i * CacheFile::recordSize;
+            QCOMPARE(qFromLittleEndian<quint32>(record + recordArtist), quint32(0));
+        }
+    }
+}
+
+void CacheFileTest::testTruncated()
+{
+    const QByteArray data = write(library(CacheFile::chunkRecords + 10));
+    const quint64 index = qFromLittleEndian<quint64>(
+        reinterpret_cast<const uchar *>(data.constData()) + headerIndex);
+
+    CacheFileReader reader;
+
+    // Within the header, within the index, and within the last chunk.
+
+    QVERIFY(!reader.open(save(data.left(CacheFile::headerSize - 1))));
+    QVERIFY(!reader.open(save(data.left(int(index) + CacheFile::indexEntrySize + 4))));
+    QVERIFY(!reader.open(save(data.left(data.size() - 1))));
+
+    QVERIFY(reader.open(save(data)));
+}
+
+void CacheFileTest::testWrongVersion()
+{
+    const QByteArray data = write(library(10));
+    CacheFileReader reader;
+
+    QByteArray unchanged = data;
+    resign(unchanged);
+    QVERIFY(reader.open(save(unchanged)));
+
+    foreach(qint32 version, QList<qint32>() << CacheFile::formatVersion - 1
+                                            << CacheFile::formatVersion + 1
+                                            << CacheFile::firstMappedVersion - 1)
+    {
+        QByteArray changed = data;
+        qToBigEndian<qint32>(version, reinterpret_cast<uchar *>(changed.data()) + headerVersion);
+        resign(changed);
+
+        QVERIFY(!reader.open(save(changed)));
+    }
+}
+
+void CacheFileTest::testBadRecordSize()
+{
+    const QByteArray data = write(library(10));
+    CacheFileReader reader;
+
+    // Too small to hold the fields that every version has, and too large for
+    // the chunks to hold their records.
+
+    foreach(quint32 recordSize, QList<quint32>() << 0
+                                                 << CacheFile::minimumRecordSize - 1
+                                                 << CacheFile::recordSize * 100)
+    {
+        QByteArray changed = data;
+        qToLittleEndian<quint32>(recordSize,
+                                 reinterpret_cast<uchar *>(changed.data()) + headerRecordSize);
+        resign(changed);
+
+        QVERIFY(!reader.open(save(changed)));
+    }
+}
+
+/**
+ * A plain bitwise CRC32C to check the table driven one against.
+ */
+static quint32 referenceChecksum(const char *data, int length)
+{
+    quint32 crc = 0xFFFFFFFF;
+
+    for(int i = 0; i < length; ++i) {
+        crc ^= uchar(data[i]);
+        for(int bit = 0; bit < 8; ++bit)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+    }
+
+    return ~crc;
+}
+
+void CacheFileTest::testChecksum()
+{
+    QCOMPARE(CacheFile::checksum("123456789", 9), quint32(0xE3069283));
+    QCOMPARE(CacheFile::checksum("", 0), quint32(0));
+
+    // Every length around a few multiples of eight, from every alignment, so
+    // that both the eight byte steps and the bytes left over are covered.
+
+    QByteArray data;
+    for(int i = 0; i < 80; ++i)
+        data.append(char(i * 37 + 11));
+
+    for(int start = 0; start < 8; ++start) {
+        for(int length = 0; start + length <= data.size(); ++length) {
+            const char *d = data.constData() + start;
+            QCOMPARE(CacheFile::checksum(d, length), referenceChecksum(d, length));
+        }
+    }
+}
+
+void CacheFileTest::testDamagedChunk()
+{
+    const CachedTrackList tracks = library(2 * CacheFile::chunkRecords + 37);
+    QByteArray data = write(tracks);
+
+    // Change the year of the first track of the middle chunk, which leaves
+    // the paths and ids alone.
+
+    const uchar *d = reinterpret_cast<const uchar *>(data.constData());
+    const quint64 index = qFromLittleEndian<quint64>(d + headerIndex);
+    const quint64 chunk = qFromLittleEndian<quint64>(
+        d + index + CacheFile::indexEntrySize + indexOffset);
+
+    data[int(chunk) + 52] = char(data[int(chunk) + 52] ^ 0x40);
+
+    // The header and index aren't affected, so the file still opens.
+
+    CacheFileReader reader;
+    QVERIFY(reader.open(save(data)));
+    QCOMPARE(reader.chunkCount(), 3);
+
+    CachedTrackChunk first;
+    QVERIFY(reader.readChunk(0, first));
+    QCOMPARE(first.tracks.count(), CacheFile::chunkRecords);
+    QVERIFY(first.damagedTracks.isEmpty());
+
+    CachedTrackChunk damaged;
+    QVERIFY(!reader.readChunk(1, damaged));
+    QVERIFY(damaged.tracks.isEmpty());
+    QCOMPARE(damaged.damagedTracks.count(), CacheFile::chunkRecords);
+
+    for(int i = 0; i < damaged.damagedTracks.count(); ++i) {
+        const CachedTrack &track = tracks[CacheFile::chunkRecords + i];
+
+        QCOMPARE(damaged.damagedTracks[i].path, track.path);
+        QCOMPARE(damaged.damagedTracks[i].id, track.id);
+    }
+
+    CachedTrackChunk last;
+    QVERIFY(reader.readChunk(2, last));
+    QCOMPARE(last.tracks.count(), 37);
+    compareTracks(last.tracks.last(), tracks.last());
+}
+
+void CacheFileTest::testDamagedIndex()
+{
+    const QByteArray data = write(library(2 * CacheFile::chunkRecords + 37));
+    const quint64 index = qFromLittleEndian<quint64>(
+        reinterpret_cast<const uchar *>(data.constData()) + headerIndex);
+
+    CacheFileReader reader;
+
+    // Every byte that the checksum covers: the header up to and including
+    // the checksum itself, and the whole index.
+
+    QList<int> positions;
+
+    for(int i = 0; i < headerChecksum + 4; ++i)
+        positions.append(i);
+    for(int i = 0; i < 3 * int(CacheFile::indexEntrySize); ++i)
+        positions.append(int(index) + i);
+
+    foreach(int position, positions) {
+        QByteArray damaged = data;
+        damaged[position] = char(damaged[position] ^ 0x10);
+
+        if(reader.open(save(damaged)))
+            QFAIL(qPrintable(QString("Damage at byte %1 went unnoticed").arg(position)));
+    }
+
+    QVERIFY(reader.open(save(data)));
+}
+
+void CacheFileTest::testJournal()
+{
+    const CachedTrackList tracks = library(3);
+    const QString fileName = m_dir.name() + "journal";
+    QFile::remove(fileName);
+
+    CacheJournal journal;
+    QList<CacheJournal::Entry> entries;
+
+    QVERIFY(journal.open(fileName, &entries));
+    QVERIFY(entries.isEmpty());
+
+    journal.append(CacheJournal::Add, tracks[0]);
+    journal.append(CacheJournal::Modify, tracks[1]);
+    journal.append(CacheJournal::Remove, tracks[2]);
+
+    const qint64 size = journal.size();
+    QVERIFY(journal.flush());
+    QCOMPARE(journal.size(), size);
+    journal.close();
+
+    QVERIFY(journal.open(fileName, &entries));
+    QCOMPARE(entries.count(), 3);
+
+    QCOMPARE(entries[0].operation, CacheJournal::Add);
+    compareTracks(entries[0].track, tracks[0]);
+    QCOMPARE(entries[1].operation, CacheJournal::Modify);
+    compareTracks(entries[1].track, tracks[1]);
+
+    // Only the path is kept for a removed file.
+
+    QCOMPARE(entries[2].operation, CacheJournal::Remove);
+    QCOMPARE(entries[2].track.path, tracks[2].path);
+    QVERIFY(entries[2].track.title.isEmpty());
+    QCOMPARE(entries[2].track.id, quint32(0));
+}
+
+void CacheFileTest::testJournalTornTail()
+{
+    const CachedTrackList tracks = library(4);
+    QList<qint64> ends;
+    CacheJournal journal;
+    QList<CacheJournal::Entry> entries;
+
+    // The last entry was cut off in the middle.
+
+    QString fileName = writeJournal(tracks.mid(0, 3), &ends);
+    QVERIFY(QFile::resize(fileName, (ends[1] + ends[2]) / 2));
+
+    QVERIFY(journal.open(fileName, &entries));
+    QCOMPARE(entries.count(), 2);
+    QCOMPARE(entries[1].track.path, tracks[1].path);
+    QCOMPARE(QFileInfo(fileName).size(), ends[1]);
+
+    // New entries go right after the ones that were kept.
+
+    journal.append(CacheJournal::Modify, tracks[3]);
+    QVERIFY(journal.flush());
+    journal.close();
+
+    entries.clear();
+    QVERIFY(journal.open(fileName, &entries));
+    QCOMPARE(entries.count(), 3);
+    QCOMPARE(entries[2].track.path, tracks[3].path);
+    journal.close();
+
+    // The last entry is complete, but doesn't match its checksum.
+
+    fileName = writeJournal(tracks.mid(0, 3), &ends);
+    QVERIFY(changeByte(fileName, ends[1] + 10));
+
+    entries.clear();
+    QVERIFY(journal.open(fileName, &entries));
+    QCOMPARE(entries.count(), 2);
+    QCOMPARE(entries[1].track.path, tracks[1].path);
+    QCOMPARE(QFileInfo(fileName).size(), ends[1]);
+}
+
+void CacheFileTest::testJournalDiscardBefore()
+{
+    const CachedTrackList tracks = library(4);
+    QList<qint64> ends;
+    const QString fileName = writeJournal(tracks, &ends);
+
+    CacheJournal journal;
+    QVERIFY(journal.open(fileName));
+    QVERIFY(journal.discardBefore(ends[1]));
+    QVERIFY(journal.isOpen());
+    QVERIFY(!QFile::exists(fileName + ".new"));
+
+    journal.append(CacheJournal::Remove, tracks[0]);
+    QVERIFY(journal.flush());
+    journal.close();
+
+    QList<CacheJournal::Entry> entries;
+    QVERIFY(journal.open(fileName, &entries));
+    QCOMPARE(entries.count(), 3);
+
+    QCOMPARE(entries[0].operation, CacheJournal::Modify);
+    compareTracks(entries[0].track, tracks[2]);
+    QCOMPARE(entries[1].operation, CacheJournal::Modify);
+    compareTracks(entries[1].track, tracks[3]);
+    QCOMPARE(entries[2].operation, CacheJournal::Remove);
+    QCOMPARE(entries[2].track.path, tracks[0].path);
+}
+
+void CacheFileTest::testJournalReplay()
+{
+    const CachedTrackList tracks = library(2);
+    const QString fileName = writeJournal(tracks);
+
+    CachedTrack changed = tracks[0];
+    changed.title = "Changed";
+
+    CacheJournal journal;
+    QVERIFY(journal.open(fileName));
+    journal.append(CacheJournal::Modify, changed);
+    journal.append(CacheJournal::Remove, tracks[1]);
+    QVERIFY(journal.flush());
+    journal.close();
+
+    QList<CacheJournal::Entry> entries;
+    QVERIFY(journal.open(fileName, &entries));
+    QCOMPARE(entries.count(), 4);
+
+    QHash<QString, CacheJournal::Entry> replayed = CacheJournal::replay(entries);
+    QCOMPARE(replayed.count(), 2);
+    QCOMPARE(replayed[tracks[0].path].operation, CacheJournal::Modify);
+    compareTracks(replayed[tracks[0].path].track, changed);
+    QCOMPARE(replayed[tracks[1].path].operation, CacheJournal::Remove);
+
+    // A file that comes back after it was removed.
+
+    journal.append(CacheJournal::Add, tracks[1]);
+    QVERIFY(journal.flush());
+    journal.close();
+
+    entries.clear();
+    QVERIFY(journal.open(fileName, &entries));
+
+    replayed = CacheJournal::replay(entries);
+    QCOMPARE(replayed.count(), 2);
+    QCOMPARE(replayed[tracks[1].path].operation, CacheJournal::Add);
+    compareTracks(replayed[tracks[1].path].track, tracks[1]);
+}
+
+/**
+ * Tracks of a dozen per album, with some of the strings empty and some of them
+ * outside of Latin-1, including characters that take two UTF-16 code units.
+ */
+CachedTrackList CacheFileTest::library(int count) // static
+{
+    static const char * const genres[] = { "Rock", "", "Électronique", "Поп" };
+    static const int genreCount = sizeof(genres) / sizeof(genres[0]);
+
+    CachedTrackList tracks;
+
+    for(int i = 0; i < count; ++i) {
+        const int album = i / 12;
+        CachedTrack track;
+
+        if(i % 7 == 3)
+            track.path = QString::fromUtf8("/music/Прокофьев/%1.flac").arg(i);
+        else
+            track.path = QString("/music/%1/%2.ogg").arg(album).arg(i);
+
+        if(i % 5 == 1)
+            track.title = QString::fromUtf8("坂本龍一 \xF0\x9D\x84\x9E %1").arg(i);
+        else if(i % 5 != 0)
+            track.title = QString("Title %1").arg(i);
+
+        if(i % 11 != 0)
+            track.artist = QString("Artist %1").arg(album / 3);
+
+        track.album = QString::fromUtf8("Album %1 ü").arg(album);
+        track.genre = QString::fromUtf8(genres[album % genreCount]);
+
+        if(i % 3 != 0)
+            track.comment = QString("Comment %1").arg(i % 4);
+
+        track.track = i % 12 + 1;
+        track.year = 1950 + album % 70;
+        track.seconds = 60 + i % 600;
+        track.bitrate = i % 2 ? 128 : 320;
+
+        if(i % 13 != 0)
+            track.modificationTime = QDateTime::fromTime_t(1400000000 + i);
+
+        track.size = i % 17 ? 1000000 + i : -1;
+        track.inode = i % 19 ? 5000 + i : 0;
+        track.device = track.inode ? 2049 : 0;
+        track.id = i % 23 ? i + 1 : 0;
+        track.estimatedProperties = i % 2;
+        track.embeddedArtKnown = i % 3 != 2;
+        track.hasEmbeddedArt = track.embeddedArtKnown && i % 4 == 0;
+        track.embeddedArtHash = track.hasEmbeddedArt ? 0xC0FFEE00 + i : 0;
+
+        tracks.append(track);
+    }
+
+    return tracks;
+}
+
+QByteArray CacheFileTest::write(const CachedTrackList &tracks) // static
+{
+    CacheFileWriter writer;
+
+    foreach(const CachedTrack &track, tracks)
+        writer.addTrack(track);
+
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+
+    if(!writer.write(&buffer))
+        return QByteArray();
+
+    return data;
+}
+
+void CacheFileTest::compareTracks(const CachedTrack &track, // static
+                                  const CachedTrack &expected)
+{
+    QCOMPARE(track.path, expected.path);
+    QCOMPARE(track.title, expected.title);
+    QCOMPARE(track.artist, expected.artist);
+    QCOMPARE(track.album, expected.album);
+    QCOMPARE(track.genre, expected.genre);
+    QCOMPARE(track.comment, expected.comment);
+    QCOMPARE(track.track, expected.track);
+    QCOMPARE(track.year, expected.year);
+    QCOMPARE(track.seconds, expected.seconds);
+    QCOMPARE(track.bitrate, expected.bitrate);
+    QCOMPARE(track.modificationTime, expected.modificationTime);
+    QCOMPARE(track.size, expected.size);
+    QCOMPARE(track.inode, expected.inode);
+    QCOMPARE(track.device, expected.device);
+    QCOMPARE(track.id, expected.id);
+    QCOMPARE(track.estimatedProperties, expected.estimatedProperties);
+    QCOMPARE(track.embeddedArtKnown, expected.embeddedArtKnown);
+    QCOMPARE(track.hasEmbeddedArt, expected.hasEmbeddedArt);
+    QCOMPARE(track.embeddedArtHash, expected.embeddedArtHash);
+}
+
+QStringList CacheFileTest::chunkValues(const QByteArray &data, int chunk) // static
+{
+    const uchar *d = reinterpret_cast<const uchar *>(data.constData());
+    const uchar *entry = d + qFromLittleEndian<quint64>(d + headerIndex) +
+        chunk * CacheFile::indexEntrySize;
+
+    const quint32 count = qFromLittleEndian<quint32>(entry + indexRecordCount);
+    const quint32 valueCount = qFromLittleEndian<quint32>(entry + indexValueCount);
+    const uchar *values = d + qFromLittleEndian<quint64>(entry + indexOffset) +
+        count * CacheFile::recordSize;
+    const uchar *strings = values + valueCount * valueEntrySize;
+
+    QStringList result;
+
+    for(quint32 i = 0; i < valueCount; ++i) {
+        const uchar *value = values + i * valueEntrySize;
+        const quint32 offset = qFromLittleEndian<quint32>(value);
+        const quint32 length = qFromLittleEndian<quint32>(value + 4);
+
+        QString s;
+        for(quint32 j = 0; j < length; ++j)
+            s.append(QChar(qFromLittleEndian<quint16>(strings + (offset + j) * 2)));
+
+        result.append(s);
+    }
+
+    return result;
+}
+
+void CacheFileTest::resign(QByteArray &data) // static
+{
+    uchar *d = reinterpret_cast<uchar *>(data.data());
+    const quint64 index = qFromLittleEndian<quint64>(d + headerIndex);
+    const quint32 chunkCount = qFromLittleEndian<quint32>(d + headerChunkCount);
+
+    const QByteArray covered = data.left(headerChecksum) +
+        data.mid(index, chunkCount * CacheFile::indexEntrySize);
+
+    qToLittleEndian<quint32>(CacheFile::checksum(covered.constData(), covered.size()),
+                             d + headerChecksum);
+}
+
+QString CacheFileTest::save(const QByteArray &data)
+{
+    const QString fileName = m_dir.name() + "cache";
+
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+       file.write(data) != data.size())
+    {
+        return QString();
+    }
+
+    return fileName;
+}
+
+QString CacheFileTest::writeJournal(const CachedTrackList &tracks, QList<qint64> *ends)
+{
+    const QString fileName = m_dir.name() + "journal";
+    QFile::remove(fileName);
+
+    CacheJournal journal;
+    if(!journal.open(fileName))
+        return QString();
+
+    if(ends)
+        ends->clear();
+
+    foreach(const CachedTrack &track, tracks) {
+        journal.append(CacheJournal::Modify, track);
+        if(!journal.flush())
+            return QString();
+
+        if(ends)
+            ends->append(journal.size());
+    }
+
+    return fileName;
+}
+
+bool CacheFileTest::changeByte(const QString &fileName, qint64 position) // static
+{
+    QFile file(fileName);
+    char c;
+
+    if(!file.open(QIODevice::ReadWrite) || !file.seek(position) || !file.getChar(&c))
+        return false;
+
+    return file.seek(position) && file.putChar(c ^ 0x01);
+}
+
+QTEST_KDEMAIN_CORE(CacheFileTest)
+
+#include "cachefiletest.moc"
+
+// vim: set et sw=4 tw=0 sta:
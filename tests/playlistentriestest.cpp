@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "playlistentries.h"
+
+#include <qtest_kde.h>
+
+#include <QtCore/QBuffer>
+#include <QtCore/QDataStream>
+#include <QtCore/QHash>
+
+/**
+ * Stands in for the collection, by id.
+ */
+class TestResolver : public PlaylistEntries::Resolver
+{
+public:
+    virtual QString path(quint32 id) const { return items.value(id); }
+
+    QHash<quint32, QString> items;
+};
+
+class PlaylistEntriesTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRead();
+    void testRemovedItem();
+    void testDamagedStream();
+
+private:
+    static QByteArray save(const QStringList &files, const QVector<quint32> &ids);
+    static bool load(const QByteArray &data, PlaylistEntries &entries,
+                     const TestResolver &resolver);
+};
+
+void PlaylistEntriesTest::testRead()
+{
+    TestResolver resolver;
+    resolver.items.insert(1, "/music/a.mp3");
+    resolver.items.insert(2, "/music/b.mp3");
+
+    // The id of the last entry leads to another file, so that one is kept by
+    // its path.
+
+    const QStringList files = QStringList()
+        << "/music/a.mp3" << "/music/b.mp3" << "/music/c.mp3";
+    const QVector<quint32> ids = QVector<quint32>() << 1 << 2 << 1;
+
+    PlaylistEntries entries;
+    QVERIFY(load(save(files, ids), entries, resolver));
+
+    QCOMPARE(entries.count(resolver), 3);
+    QCOMPARE(entries.files(resolver), files);
+    QCOMPARE(entries.ids(resolver), QVector<quint32>() << 1 << 2 << 0);
+}
+
+void PlaylistEntriesTest::testRemovedItem()
+{
+    TestResolver resolver;
+    resolver.items.insert(1, "/music/a.mp3");
+    resolver.items.insert(2, "/music/b.mp3");
+    resolver.items.insert(3, "/music/c.mp3");
+
+    const QStringList files = QStringList()
+        << "/music/a.mp3" << "/music/b.mp3" << "/music/c.mp3" << "/other/d.mp3";
+    const QVector<quint32> ids = QVector<quint32>() << 1 << 2 << 3 << 0;
+
+    PlaylistEntries entries;
+    QVERIFY(load(save(files, ids), entries, resolver));
+
+    // The item is removed from the collection while the playlist is still
+    // waiting to be materialized, then the playlists are saved and read
+    // again.
+
+    resolver.items.remove(2);
+
+    const QStringList expected = QStringList()
+        << "/music/a.mp3" << "/music/c.mp3" << "/other/d.mp3";
+
+    QCOMPARE(entries.count(resolver), 3);
+    QCOMPARE(entries.files(resolver), expected);
+    QCOMPARE(entries.ids(resolver).count(), entries.files(resolver).count());
+
+    PlaylistEntries reloaded;
+    QVERIFY(load(save(entries.files(resolver), entries.ids(resolver)), reloaded, resolver));
+
+    QCOMPARE(reloaded.count(resolver), 3);
+    QCOMPARE(reloaded.files(resolver), expected);
+    QCOMPARE(reloaded.ids(resolver), QVector<quint32>() << 1 << 3 << 0);
+}
+
+void PlaylistEntriesTest::testDamagedStream()
+{
+    TestResolver resolver;
+    resolver.items.insert(1, "/music/a.mp3");
+
+    PlaylistEntries entries;
+
+    QVERIFY(!load(save(QStringList() << "/music/a.mp3",
+                       QVector<quint32>() << 1 << 2), entries, resolver));
+    QVERIFY(entries.isEmpty());
+
+    QVERIFY(!load(save(QStringList() << QString(),
+                       QVector<quint32>() << 1), entries, resolver));
+    QVERIFY(entries.isEmpty());
+}
+
+QByteArray PlaylistEntriesTest::save(const QStringList &files, // static
+                                     const QVector<quint32> &ids)
+{
+    // The same as Cache::savePlaylists() for a NormalPlaylist, after its
+    // name.
+
+    QByteArray data;
+    QDataStream s(&data, QIODevice::WriteOnly);
+    s.setVersion(QDataStream::Qt_4_3);
+
+    s << files << ids;
+
+    return data;
+}
+
+bool PlaylistEntriesTest::load(const QByteArray &data, PlaylistEntries &entries, // static
+                               const TestResolver &resolver)
+{
+    QDataStream s(data);
+    s.setVersion(QDataStream::Qt_4_3);
+
+    return entries.read(s, true, resolver);
+}
+
+QTEST_KDEMAIN_CORE(PlaylistEntriesTest)
+
+#include "playlistentriestest.moc"
+
+// vim: set et sw=4 tw=0 sta:
@@ -0,0 +1,177 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trackpath.h"
+
+#include <QtCore/QVector>
+
+namespace {
+
+/**
+ * The folders of all of the TrackPaths, with how many refer to each.  Slot
+ * 0 is the empty folder, which isn't counted.
+ */
+class FolderTable
+{
+public:
+    FolderTable() : m_folders(1), m_refs(1) {}
+
+    quint32 insert(const QString &folder)
+    {
+        if(folder.isEmpty())
+            return 0;
+
+        const QHash<QString, quint32>::ConstIterator it = m_ids.constFind(folder);
+
+        if(it != m_ids.constEnd()) {
+            ++m_refs[it.value()];
+            return it.value();
+        }
+
+        quint32 id;
+
+        if(!m_freeIds.isEmpty()) {
+            id = m_freeIds.last();
+            m_freeIds.pop_back();
+        }
+        else {
+            id = m_folders.count();
+            m_folders.append(QString());
+            m_refs.append(0);
+        }
+
+        m_folders[id] = folder;
+        m_refs[id] = 1;
+        m_ids.insert(folder, id);
+
+        return id;
+    }
+
+    /**
+     * Returns the id of \a folder, with a reference taken, or -1 if it isn't
+     * in the table.
+     */
+    qint64 find(const QString &folder)
+    {
+        if(folder.isEmpty())
+            return 0;
+
+        const QHash<QString, quint32>::ConstIterator it = m_ids.constFind(folder);
+
+        if(it == m_ids.constEnd())
+            return -1;
+
+        ++m_refs[it.value()];
+        return it.value();
+    }
+
+    void ref(quint32 id)
+    {
+        if(id != 0)
+            ++m_refs[id];
+    }
+
+    void deref(quint32 id)
+    {
+        if(id == 0 || --m_refs[id] > 0)
+            return;
+
+        m_ids.remove(m_folders[id]);
+        m_folders[id].clear();
+        m_freeIds.append(id);
+    }
+
+    const QString &folder(quint32 id) const { return m_folders[id]; }
+
+private:
+    QVector<QString> m_folders;
+    QVector<int> m_refs;
+    QVector<quint32> m_freeIds;
+    QHash<QString, quint32> m_ids;
+};
+
+}
+
+static FolderTable *folderTable()
+{
+    // Never deleted, so that the paths destroyed on exit can still give up
+    // their folders.
+
+    static FolderTable *table = new FolderTable;
+    return table;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// public methods
+////////////////////////////////////////////////////////////////////////////////
+
+TrackPath::TrackPath(const QString &path)
+{
+    const int separator = path.lastIndexOf('/') + 1;
+
+    m_folder = folderTable()->insert(path.left(separator));
+    m_fileName = path.mid(separator);
+}
+
+TrackPath::TrackPath(const TrackPath &path) :
+    m_folder(path.m_folder),
+    m_fileName(path.m_fileName)
+{
+    folderTable()->ref(m_folder);
+}
+
+TrackPath::~TrackPath()
+{
+    folderTable()->deref(m_folder);
+}
+
+TrackPath &TrackPath::operator=(const TrackPath &path)
+{
+    folderTable()->ref(path.m_folder);
+    folderTable()->deref(m_folder);
+
+    m_folder = path.m_folder;
+    m_fileName = path.m_fileName;
+
+    return *this;
+}
+
+TrackPath TrackPath::find(const QString &path) // static
+{
+    const int separator = path.lastIndexOf('/') + 1;
+    const qint64 folder = folderTable()->find(path.left(separator));
+
+    TrackPath trackPath;
+
+    if(folder >= 0) {
+        trackPath.m_folder = quint32(folder);
+        trackPath.m_fileName = path.mid(separator);
+    }
+
+    return trackPath;
+}
+
+QString TrackPath::folder() const
+{
+    return folderTable()->folder(m_folder);
+}
+
+QString TrackPath::toString() const
+{
+    return folderTable()->folder(m_folder) + m_fileName;
+}
+
+// vim: set et sw=4 tw=0 sta:
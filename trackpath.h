@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_TRACKPATH_H
+#define JUK_TRACKPATH_H
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+/**
+ * The path of a track, kept as the number of its folder in a table that all
+ * of them share, and its file name.  The tracks of an album then only have
+ * their file names to themselves, instead of each having a copy of the same
+ * long folder path, and a hash of track paths compares numbers and file
+ * names.  The full path is put together when it is asked for.
+ *
+ * A folder stays in the table for as long as a TrackPath refers to it.
+ *
+ * Like Tag, this may only be used from the GUI thread.
+ */
+class TrackPath
+{
+public:
+    TrackPath() : m_folder(0) {}
+    explicit TrackPath(const QString &path);
+    TrackPath(const TrackPath &path);
+    ~TrackPath();
+
+    TrackPath &operator=(const TrackPath &path);
+
+    /**
+     * Returns \a path if its folder is in the table already, and a null
+     * TrackPath otherwise, which doesn't equal any other.  Unlike the
+     * constructor this never adds to the table, so it is meant for looking
+     * paths up.
+     */
+    static TrackPath find(const QString &path);
+
+    bool isNull() const { return m_fileName.isEmpty(); }
+
+    /**
+     * The folder, with the trailing separator.
+     */
+    QString folder() const;
+    QString fileName() const { return m_fileName; }
+    QString toString() const;
+
+    quint32 folderId() const { return m_folder; }
+
+    bool operator==(const TrackPath &path) const
+    {
+        return m_folder == path.m_folder && m_fileName == path.m_fileName;
+    }
+    bool operator!=(const TrackPath &path) const { return !(*this == path); }
+
+private:
+    quint32 m_folder; ///< 0 for a path without a folder.
+    QString m_fileName;
+};
+
+inline uint qHash(const TrackPath &path)
+{
+    return qHash(path.fileName()) ^ (path.folderId() * 2654435761U);
+}
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
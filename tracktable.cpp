@@ -0,0 +1,201 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tracktable.h"
+
+#include <QtCore/QByteArray>
+
+#include <string.h>
+
+#include "filehandle.h"
+#include "playlistitem.h"
+#include "tag.h"
+
+static const int columnCount = PlaylistItem::FullPathColumn + 1;
+
+////////////////////////////////////////////////////////////////////////////////
+// public methods
+////////////////////////////////////////////////////////////////////////////////
+
+TrackTable::TrackTable() :
+    m_sortKeys(columnCount),
+    m_widths(columnCount)
+{
+
+}
+
+TrackTable::Row TrackTable::insert(CollectionListItem *item)
+{
+    Row row;
+
+    if(!m_freeRows.isEmpty()) {
+        row = m_freeRows.last();
+        m_freeRows.pop_back();
+    }
+    else {
+        row = m_items.count();
+        resize(row + 1);
+    }
+
+    m_items[row] = item;
+    return row;
+}
+
+void TrackTable::remove(Row row)
+{
+    // The strings are given up right away, the rest is overwritten by the
+    // next item to get the row.
+
+    m_items[row] = 0;
+    m_titles[row].clear();
+    m_artists[row].clear();
+    m_albums[row].clear();
+    m_genres[row].clear();
+    m_comments[row].clear();
+
+    for(int column = 0; column < columnCount; ++column) {
+        if(isPooledColumn(column))
+            m_sortKeyPool.release(m_sortKeys[column][row]);
+
+        m_sortKeys[column][row].clear();
+        m_widths[column][row] = 0;
+    }
+
+    m_freeRows.append(row);
+}
+
+void TrackTable::update(Row row, const FileHandle &file)
+{
+    const Tag *tag = file.tag();
+
+    if(!tag)
+        return;
+
+    m_titles[row]   = tag->title();
+    m_artists[row]  = tag->artist();
+    m_albums[row]   = tag->album();
+    m_genres[row]   = tag->genre();
+    m_comments[row] = tag->comment();
+    m_tracks[row]   = tag->track();
+    m_years[row]    = tag->year();
+    m_bitrates[row] = tag->bitrate();
+    m_seconds[row]  = tag->seconds();
+}
+
+const QString &TrackTable::text(Row row, int column) const
+{
+    static const QString none;
+
+    switch(column) {
+    case PlaylistItem::TrackColumn:
+        return m_titles[row];
+    case PlaylistItem::ArtistColumn:
+        return m_artists[row];
+    case PlaylistItem::AlbumColumn:
+        return m_albums[row];
+    case PlaylistItem::GenreColumn:
+        return m_genres[row];
+    case PlaylistItem::CommentColumn:
+        return m_comments[row];
+    default:
+        return none;
+    }
+}
+
+void TrackTable::setSortKey(Row row, int column, const QString &key)
+{
+    QString &current = m_sortKeys[column][row];
+
+    if(!isPooledColumn(column)) {
+        current = key;
+        return;
+    }
+
+    const QString pooled = m_sortKeyPool.intern(key);
+    m_sortKeyPool.release(current);
+    current = pooled;
+}
+
+QString TrackTable::collationKey(const QString &text) // static
+{
+    if(text.isEmpty())
+        return QString();
+
+    // The same as QString::localeAwareCompare() does with strcoll().
+
+    const QByteArray local = text.toLower().toLocal8Bit();
+    const size_t size = strxfrm(0, local.constData(), 0);
+
+    QByteArray bytes(int(size) + 1, '\0');
+    strxfrm(bytes.data(), local.constData(), size + 1);
+
+    // strxfrm() never produces a 0 byte, so padding with one keeps a key
+    // that is a prefix of another in front of it.
+
+    const uchar *data = reinterpret_cast<const uchar *>(bytes.constData());
+    QString key((int(size) + 1) / 2, Qt::Uninitialized);
+
+    for(int i = 0; i < key.size(); ++i)
+        key[i] = QChar(ushort(data[2 * i] << 8 | data[2 * i + 1]));
+
+    return key;
+}
+
+QVector<int> TrackTable::widths(Row row) const
+{
+    QVector<int> widths(columnCount);
+
+    for(int column = 0; column < columnCount; ++column)
+        widths[column] = m_widths[column][row];
+
+    return widths;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// private methods
+////////////////////////////////////////////////////////////////////////////////
+
+void TrackTable::resize(int rows)
+{
+    m_items.resize(rows);
+    m_titles.resize(rows);
+    m_artists.resize(rows);
+    m_albums.resize(rows);
+    m_genres.resize(rows);
+    m_comments.resize(rows);
+    m_tracks.resize(rows);
+    m_years.resize(rows);
+    m_bitrates.resize(rows);
+    m_seconds.resize(rows);
+
+    for(int column = 0; column < columnCount; ++column) {
+        m_sortKeys[column].resize(rows);
+        m_widths[column].resize(rows);
+    }
+}
+
+bool TrackTable::isPooledColumn(int column) // static
+{
+    // The keys of the other columns hardly ever repeat.
+
+    return column == PlaylistItem::ArtistColumn ||
+           column == PlaylistItem::AlbumColumn ||
+           column == PlaylistItem::GenreColumn ||
+           column == PlaylistItem::YearColumn ||
+           column == PlaylistItem::CommentColumn;
+}
+
+// vim: set et sw=4 tw=0 sta:
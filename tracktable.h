@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_TRACKTABLE_H
+#define JUK_TRACKTABLE_H
+
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include "stringpool.h"
+
+class CollectionListItem;
+class FileHandle;
+
+/**
+ * What the list views show, sort and search by for every track in the
+ * collection, kept a column at a time.  Going through the artists of every
+ * track, for instance, then reads one array instead of following the item,
+ * its shared data, its FileHandle and its Tag for each of them.
+ *
+ * Every CollectionListItem has a row for as long as it exists, which is
+ * reused for another item afterwards.  The PlaylistItems of a track read
+ * the row of their CollectionListItem.
+ *
+ * The tag columns are copies of the Tag, which CollectionListItem::refresh()
+ * updates whenever the Tag changes.
+ */
+class TrackTable
+{
+public:
+    typedef int Row;
+
+    TrackTable();
+
+    Row insert(CollectionListItem *item);
+    void remove(Row row);
+
+    /**
+     * Copies the tag of \a file into \a row.
+     */
+    void update(Row row, const FileHandle &file);
+
+    /**
+     * The number of rows, including free ones, which have no item.
+     */
+    int rowCount() const { return m_items.count(); }
+    int count() const { return m_items.count() - m_freeRows.count(); }
+
+    CollectionListItem *item(Row row) const { return m_items[row]; }
+
+    /**
+     * Returns the tag text of one of the PlaylistItem::ColumnType columns
+     * that are a string in the Tag, or a null string for the others.
+     */
+    const QString &text(Row row, int column) const;
+
+    int track(Row row) const { return m_tracks[row]; }
+    int year(Row row) const { return m_years[row]; }
+    int seconds(Row row) const { return m_seconds[row]; }
+    int bitrate(Row row) const { return m_bitrates[row]; }
+
+    /**
+     * The collationKey() that the string columns are sorted by.  The keys of
+     * the columns whose values repeat are shared through the table's own
+     * StringPool.
+     */
+    const QString &sortKey(Row row, int column) const { return m_sortKeys[column][row]; }
+    void setSortKey(Row row, int column, const QString &key);
+
+    StringPool::Statistics sortKeyStatistics() const { return m_sortKeyPool.statistics(); }
+
+    /**
+     * Returns a key for \a text that orders the same against other keys with
+     * a plain QString::compare() as the text would with
+     * QString::localeAwareCompare(), ignoring case.  Making one costs about
+     * as much as a single locale aware comparison, but a sort does many
+     * comparisons per item.
+     *
+     * The key is the strxfrm() of the text, packed two bytes to a QChar so
+     * that it can be pooled like any other string.
+     */
+    static QString collationKey(const QString &text);
+
+    /**
+     * The width of the text in each column, for the weighted column width
+     * mode.
+     */
+    int width(Row row, int column) const { return m_widths[column][row]; }
+    void setWidth(Row row, int column, int width) { m_widths[column][row] = width; }
+    QVector<int> widths(Row row) const;
+
+private:
+    void resize(int rows);
+    static bool isPooledColumn(int column);
+
+    QVector<CollectionListItem *> m_items;
+    QVector<Row> m_freeRows;
+
+    QVector<QString> m_titles;
+    QVector<QString> m_artists;
+    QVector<QString> m_albums;
+    QVector<QString> m_genres;
+    QVector<QString> m_comments;
+    QVector<quint16> m_tracks;
+    QVector<quint16> m_years;
+    QVector<quint16> m_bitrates;
+    QVector<int> m_seconds;
+
+    QVector<QVector<QString> > m_sortKeys; ///< By column, then row.
+    StringPool m_sortKeyPool;
+    QVector<QVector<int> > m_widths;       ///< Likewise.
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta:
@@ -87,7 +87,7 @@ void TreeViewItemPlaylist::retag(const QStringList &files, Playlist *)
         if(!item)
             continue;
 
-        Tag *tag = TagTransactionManager::duplicateTag(item->file().tag());
+        Tag *tag = TagTransactionManager::duplicateTag(item->file());
         switch(m_columnType) {
         case PlaylistItem::ArtistColumn:
             tag->setArtist(name());
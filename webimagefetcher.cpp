@@ -203,7 +203,7 @@ void WebImageFetcher::slotImageFetched(KJob* j)
 
 void WebImageFetcher::slotCoverChosen()
 {
-    kDebug() << "Adding new cover for " << d->file.tag()->fileName()
+    kDebug() << "Adding new cover for " << d->file.absFilePath()
     << "from URL" << d->url;
 
     coverKey newId = CoverManager::addCover(d->url, d->file.tag()->artist(), d->file.tag()->album());
@@ -0,0 +1,234 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "workscheduler.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QTimerEvent>
+
+// A batch should use about a quarter of the frame budget, so that one slow
+// batch doesn't blow through the budget and every job gets a turn.
+
+static const qint64 budgetNsecs = qint64(WorkScheduler::frameBudget) * 1000000;
+static const qint64 batchTargetNsecs = budgetNsecs / 4;
+static const int maxBatchSize = 65536;
+
+////////////////////////////////////////////////////////////////////////////////
+// WorkJob
+////////////////////////////////////////////////////////////////////////////////
+
+WorkJob::~WorkJob()
+{
+    WorkScheduler::instance()->remove(this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// public methods
+////////////////////////////////////////////////////////////////////////////////
+
+WorkScheduler *WorkScheduler::instance()
+{
+    static WorkScheduler scheduler;
+    return &scheduler;
+}
+
+void WorkScheduler::schedule(WorkJob *job)
+{
+    bool found = false;
+
+    for(int i = 0; i < m_jobs.count(); ++i) {
+        if(m_jobs[i].job == job) {
+            m_jobs[i].waiting = false;
+            found = true;
+            break;
+        }
+    }
+
+    if(!found) {
+        Entry entry;
+        entry.job = job;
+        entry.batchSize = 1;
+        entry.waiting = false;
+        m_jobs.append(entry);
+    }
+
+    updateTimer();
+}
+
+void WorkScheduler::remove(WorkJob *job)
+{
+    for(int i = 0; i < m_jobs.count(); ++i) {
+        if(m_jobs[i].job == job) {
+            m_jobs.removeAt(i);
+            if(m_next > i)
+                --m_next;
+            break;
+        }
+    }
+
+    updateTimer();
+}
+
+bool WorkScheduler::isScheduled(WorkJob *job) const
+{
+    foreach(const Entry &entry, m_jobs) {
+        if(entry.job == job)
+            return true;
+    }
+    return false;
+}
+
+bool WorkScheduler::yieldIfNeeded()
+{
+    if(m_sinceYield.elapsed() < frameBudget)
+        return false;
+
+    QCoreApplication::processEvents();
+    m_sinceYield.restart();
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// protected methods
+////////////////////////////////////////////////////////////////////////////////
+
+void WorkScheduler::timerEvent(QTimerEvent *event)
+{
+    if(event->timerId() == m_timer.timerId())
+        runSlice();
+    else
+        QObject::timerEvent(event);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// private methods
+////////////////////////////////////////////////////////////////////////////////
+
+WorkScheduler::WorkScheduler() :
+    m_next(0),
+    m_running(false)
+{
+    m_sinceYield.start();
+}
+
+void WorkScheduler::runSlice()
+{
+    // A job that processes events itself could get us here again.
+
+    if(m_running)
+        return;
+
+    m_running = true;
+
+    QElapsedTimer slice;
+    slice.start();
+
+    while(slice.nsecsElapsed() < budgetNsecs) {
+
+        // Find the next job that has something to do, round robin.
+
+        int index = -1;
+        for(int i = 0; i < m_jobs.count(); ++i) {
+            const int candidate = (m_next + i) % m_jobs.count();
+            if(!m_jobs[candidate].waiting) {
+                index = candidate;
+                break;
+            }
+        }
+
+        if(index < 0)
+            break;
+
+        WorkJob *job = m_jobs[index].job;
+        const int batchSize = m_jobs[index].batchSize;
+
+        QElapsedTimer batch;
+        batch.start();
+
+        WorkJob::Status status = WorkJob::MoreWork;
+        int units = 0;
+
+        while(units < batchSize && status == WorkJob::MoreWork) {
+            status = job->runUnit();
+            ++units;
+        }
+
+        const qint64 cost = batch.nsecsElapsed();
+
+        // The job may have added or removed jobs, including itself.
+
+        index = -1;
+        for(int i = 0; i < m_jobs.count(); ++i) {
+            if(m_jobs[i].job == job) {
+                index = i;
+                break;
+            }
+        }
+
+        if(index < 0)
+            continue;
+
+        if(status == WorkJob::Done) {
+            m_jobs.removeAt(index);
+            m_next = m_jobs.isEmpty() ? 0 : index % m_jobs.count();
+            job->done();
+            continue;
+        }
+
+        Entry &entry = m_jobs[index];
+
+        if(units == batchSize) {
+            if(cost < batchTargetNsecs / 2 && entry.batchSize < maxBatchSize)
+                entry.batchSize *= 2;
+            else if(cost > batchTargetNsecs && entry.batchSize > 1)
+                entry.batchSize /= 2;
+        }
+
+        if(status == WorkJob::Waiting)
+            entry.waiting = true;
+
+        m_next = index + 1;
+    }
+
+    m_running = false;
+    m_sinceYield.restart();
+
+    updateTimer();
+}
+
+void WorkScheduler::updateTimer()
+{
+    bool runnable = false;
+
+    foreach(const Entry &entry, m_jobs) {
+        if(!entry.waiting) {
+            runnable = true;
+            break;
+        }
+    }
+
+    // A zero timeout fires whenever the event loop has nothing else to do.
+
+    if(runnable && !m_timer.isActive())
+        m_timer.start(0, this);
+    else if(!runnable && m_timer.isActive())
+        m_timer.stop();
+}
+
+#include "workscheduler.moc"
+
+// vim: set et sw=4 tw=0 sta:
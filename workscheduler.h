@@ -0,0 +1,121 @@
+/**
+ * Copyright (C) 2015 Mike Scheutzow <mjs973@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JUK_WORKSCHEDULER_H
+#define JUK_WORKSCHEDULER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QList>
+#include <QtCore/QBasicTimer>
+#include <QtCore/QElapsedTimer>
+
+/**
+ * A long running piece of GUI thread work, split into small units so that
+ * WorkScheduler can interleave it with event processing.
+ */
+class WorkJob
+{
+public:
+    enum Status {
+        MoreWork, ///< Call runUnit() again.
+        Waiting,  ///< Nothing to do until the job is scheduled again.
+        Done      ///< The job is complete, done() will be called next.
+    };
+
+    virtual ~WorkJob();
+
+    /**
+     * Performs one small unit of work, ideally well under a millisecond.
+     */
+    virtual Status runUnit() = 0;
+
+    /**
+     * Called once after runUnit() returned Done.  The job has already been
+     * removed from the scheduler, so it is safe to delete it from here.
+     */
+    virtual void done() {}
+};
+
+/**
+ * Runs WorkJobs on the GUI thread from the event loop.  Each time the event
+ * loop is idle the scheduler runs units from all of its jobs in turn until
+ * frameBudget milliseconds are used up, then returns so that the GUI can
+ * repaint and handle input.
+ *
+ * Checking the clock after every unit would cost more than many units do, so
+ * units are run in batches.  The batch size of every job is adjusted to the
+ * cost of its units as measured so far.
+ */
+class WorkScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    static WorkScheduler *instance();
+
+    /**
+     * The time in milliseconds spent on jobs before the event loop gets to run
+     * again.  Small enough to keep the interface at 60 frames per second.
+     */
+    static const int frameBudget = 8;
+
+    /**
+     * Adds \a job to the scheduler, or wakes it up if it returned Waiting.
+     * The scheduler does not take ownership of the job.
+     */
+    void schedule(WorkJob *job);
+
+    /**
+     * Removes \a job without calling done().  Deleting a job does this
+     * automatically.
+     */
+    void remove(WorkJob *job);
+
+    bool isScheduled(WorkJob *job) const;
+
+    /**
+     * For loops that have to run synchronously: processes pending events if
+     * the frame budget has been used up since the last time.  Returns true if
+     * events were processed.
+     */
+    bool yieldIfNeeded();
+
+protected:
+    virtual void timerEvent(QTimerEvent *event);
+
+private:
+    WorkScheduler();
+
+    void runSlice();
+    void updateTimer();
+
+    struct Entry
+    {
+        WorkJob *job;
+        int batchSize;
+        bool waiting;
+    };
+
+    QList<Entry> m_jobs;
+    QBasicTimer m_timer;
+    QElapsedTimer m_sinceYield;
+    int m_next;
+    bool m_running;
+};
+
+#endif
+
+// vim: set et sw=4 tw=0 sta: